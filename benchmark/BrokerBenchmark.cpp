@@ -0,0 +1,450 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/MQTT.hpp"
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace mqtt;
+
+// *****************************************************************************
+//! \brief Command line options.
+// *****************************************************************************
+struct Options
+{
+    std::string host = "localhost";
+    size_t port = 1883u;
+    //! \brief Messages sent per configuration (shared by publishers).
+    size_t messages = 20000u;
+    //! \brief Messages per second per publisher, 0 for as fast as possible.
+    size_t rate = 0u;
+    //! \brief Maximum number of in-flight QoS 1 and 2 messages per client.
+    size_t inflight = 100u;
+    //! \brief Start a mosquitto broker on the port instead of connecting to
+    //! a running one.
+    bool start_broker = false;
+    //! \brief Connect with Client::Connection::lowLatency().
+    bool low_latency = false;
+    //! \brief First core of the network threads (one core per client) with
+    //! --low-latency, -1 for no pinning.
+    int cpu = -1;
+    //! \brief Certificate authority of the broker, for connecting with TLS.
+    std::string cafile;
+    //! \brief Ask for the kernel TLS offload (Tls::kernel_offload).
+    bool kernel_tls = false;
+    //! \brief Measure the time for connecting this number of clients instead
+    //! of sweeping the parameters.
+    size_t fleet = 0u;
+    //! \brief Connections of the fleet being established at once.
+    size_t concurrency = 256u;
+    //! \brief Swept parameters.
+    std::vector<size_t> payloads{16u, 256u, 4096u, 65536u};
+    std::vector<size_t> qos{0u, 1u, 2u};
+    std::vector<size_t> subscriptions{1u, 1000u};
+    std::vector<size_t> clients{1u, 4u};
+};
+
+//-----------------------------------------------------------------------------
+//! \brief Parse a comma separated list of numbers.
+//-----------------------------------------------------------------------------
+static std::vector<size_t> parseList(std::string const& text)
+{
+    std::vector<size_t> values;
+    std::stringstream stream(text);
+    std::string value;
+    while (std::getline(stream, value, ','))
+    {
+        values.push_back(std::stoul(value));
+    }
+    return values;
+}
+
+//-----------------------------------------------------------------------------
+static Options parseOptions(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string const arg(argv[i]);
+        std::string const value((i + 1 < argc) ? argv[i + 1] : "");
+        if (arg == "--start-broker") { options.start_broker = true; continue; }
+        else if (arg == "--low-latency") { options.low_latency = true; continue; }
+        else if (arg == "--kernel-tls") { options.kernel_tls = true; continue; }
+        else if (arg == "--cpu") options.cpu = std::stoi(value);
+        else if (arg == "--cafile") options.cafile = value;
+        else if (arg == "--fleet") options.fleet = std::stoul(value);
+        else if (arg == "--concurrency") options.concurrency = std::stoul(value);
+        else if (arg == "--host") options.host = value;
+        else if (arg == "--port") options.port = std::stoul(value);
+        else if (arg == "--messages") options.messages = std::stoul(value);
+        else if (arg == "--rate") options.rate = std::stoul(value);
+        else if (arg == "--inflight") options.inflight = std::stoul(value);
+        else if (arg == "--payloads") options.payloads = parseList(value);
+        else if (arg == "--qos") options.qos = parseList(value);
+        else if (arg == "--subscriptions") options.subscriptions = parseList(value);
+        else if (arg == "--clients") options.clients = parseList(value);
+        else
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        ++i;
+    }
+    return options;
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Wait until the predicate holds. Return false on timeout.
+//-----------------------------------------------------------------------------
+template<class Predicate>
+static bool waitFor(Predicate predicate, std::chrono::milliseconds const timeout)
+{
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+static uint64_t now()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Create a client and wait for its connection.
+//-----------------------------------------------------------------------------
+static std::unique_ptr<Client> connect(Options const& options)
+{
+    Client::Settings settings;
+    settings.max_inflight_messages = options.inflight;
+    std::unique_ptr<Client> client(new Client(settings));
+
+    // Busy polling threads shall not share their core.
+    static int clients = 0;
+    Client::Connection connection;
+    if (options.low_latency)
+    {
+        connection = Client::Connection::lowLatency(options.host, options.port,
+            (options.cpu < 0) ? -1 : options.cpu + clients++);
+    }
+    connection.address = options.host;
+    connection.port = options.port;
+    connection.tls.cafile = options.cafile;
+    connection.tls.kernel_offload = options.kernel_tls;
+    if (!client->connect(connection) || !waitFor([&client]() {
+            return client->status() == Client::Status::Connected;
+        }, std::chrono::seconds(5)))
+    {
+        std::cerr << "Cannot connect to " << options.host << ":" << options.port
+                  << ": " << client->error().message() << std::endl;
+        return nullptr;
+    }
+    return client;
+}
+
+// *****************************************************************************
+//! \brief Results of a configuration.
+// *****************************************************************************
+struct Result
+{
+    size_t sent = 0u;
+    size_t received = 0u;
+    double msg_per_s = 0.0;
+    LatencyHistogram latency;
+};
+
+//-----------------------------------------------------------------------------
+//! \brief Publishers send timestamped messages to a subscriber, all of them
+//! in this process, through the broker. The round-trip latency of a message
+//! is the time between its publication and its reception by the callback.
+//-----------------------------------------------------------------------------
+static bool run(Options const& options, size_t const id, size_t const payload,
+                QoS const qos, size_t const subscriptions, size_t const clients,
+                Result& result)
+{
+    std::string const prefix = "benchmark/" + std::to_string(::getpid()) +
+                               "/" + std::to_string(id);
+
+    // Subscriber: idle subscriptions fill the topic tree, one of them
+    // receiving the traffic.
+    std::unique_ptr<Client> subscriber = connect(options);
+    if (subscriber == nullptr)
+        return false;
+
+    std::atomic<size_t> received{0u};
+    std::atomic<uint64_t> last{0u};
+    std::atomic<size_t> acknowledged{0u};
+    std::vector<Topic> filters(subscriptions);
+    for (size_t i = 0u; i < subscriptions; ++i)
+    {
+        bool const traffic = (i + 1u == subscriptions);
+        filters[i].name = prefix + (traffic ? "/data/+" : "/idle/" + std::to_string(i) + "/+");
+        Client::ReceptionCallback callback = [&](Message const& message)
+        {
+            uint64_t sent;
+            std::memcpy(&sent, message.data(), sizeof(sent));
+            uint64_t const t = now();
+            result.latency.record(std::chrono::nanoseconds(t - sent));
+            last.store(t, std::memory_order_relaxed);
+            received.fetch_add(1u, std::memory_order_relaxed);
+        };
+        if (!subscriber->subscribe(filters[i], qos, traffic ? callback : [](Message const&) {},
+                                   [&acknowledged](int) { acknowledged.fetch_add(1u); }))
+        {
+            std::cerr << subscriber->error().message() << std::endl;
+            return false;
+        }
+    }
+    if (!waitFor([&]() { return acknowledged.load() == subscriptions; },
+                 std::chrono::seconds(10)))
+    {
+        std::cerr << "Subscriptions not acknowledged" << std::endl;
+        return false;
+    }
+
+    // Publishers.
+    std::vector<std::unique_ptr<Client>> publishers;
+    for (size_t i = 0u; i < clients; ++i)
+    {
+        publishers.push_back(connect(options));
+        if (publishers.back() == nullptr)
+            return false;
+    }
+
+    std::atomic<size_t> sent{0u};
+    uint64_t const start = now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0u; i < clients; ++i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            Client& publisher = *publishers[i];
+            Topic topic{prefix + "/data/" + std::to_string(i)};
+            std::vector<uint8_t> buffer(std::max(payload, sizeof(uint64_t)), 0x55);
+            size_t const count = options.messages / clients;
+            for (size_t n = 0u; n < count; ++n)
+            {
+                if (options.rate != 0u)
+                {
+                    uint64_t const due = start + n * 1000000000u / options.rate;
+                    while (now() < due)
+                        std::this_thread::yield();
+                }
+                // Do not let the mosquitto lib queue an unbounded number of
+                // messages.
+                while (publisher.inflight() >= options.inflight)
+                    std::this_thread::yield();
+
+                uint64_t const t = now();
+                std::memcpy(buffer.data(), &t, sizeof(t));
+                if (publisher.publish(topic, buffer, qos))
+                {
+                    sent.fetch_add(1u, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    for (auto& thread: threads)
+    {
+        thread.join();
+    }
+
+    // Wait for the last messages, until no more message is received.
+    size_t previous = size_t(-1);
+    while (received.load() < sent.load() && received.load() != previous)
+    {
+        previous = received.load();
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    result.sent = sent.load();
+    result.received = received.load();
+    uint64_t const duration = std::max<uint64_t>(1u, last.load() - start);
+    result.msg_per_s = 1e9 * double(result.received) / double(duration);
+
+    for (auto& publisher: publishers)
+    {
+        publisher->disconnect();
+    }
+    subscriber->disconnect();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+static double us(std::chrono::nanoseconds const ns)
+{
+    return double(ns.count()) / 1000.0;
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Measure the time until a fleet of clients is connected. Return
+//! EXIT_FAILURE if a client could not connect.
+//-----------------------------------------------------------------------------
+static int startup(Options const& options)
+{
+    std::vector<std::unique_ptr<Client>> fleet;
+    std::vector<Client*> clients;
+    fleet.reserve(options.fleet);
+    clients.reserve(options.fleet);
+
+    uint64_t const start = now();
+    for (size_t i = 0u; i < options.fleet; ++i)
+    {
+        fleet.emplace_back(new Client());
+        clients.push_back(fleet.back().get());
+    }
+    uint64_t const created = now();
+
+    Client::Connection connection;
+    connection.address = options.host;
+    connection.port = options.port;
+    connection.tls.cafile = options.cafile;
+    size_t const connected = Client::connectAll(clients, connection,
+        options.concurrency, std::chrono::seconds(60));
+    uint64_t const end = now();
+
+    std::cout << "{\"benchmark\": \"startup\""
+              << ", \"clients\": " << options.fleet
+              << ", \"concurrency\": " << options.concurrency
+              << ", \"connected\": " << connected
+              << ", \"create_ms\": " << (created - start) / 1000000u
+              << ", \"connect_ms\": " << (end - created) / 1000000u
+              << "}" << std::endl;
+    return (connected == options.fleet) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Run all configurations. Return EXIT_FAILURE if a client could not
+//! connect or if QoS 1 or 2 messages have been lost.
+//-----------------------------------------------------------------------------
+static int sweep(Options const& options)
+{
+    int status = EXIT_SUCCESS;
+    size_t id = 0u;
+    for (size_t const clients: options.clients)
+    {
+        for (size_t const subscriptions: options.subscriptions)
+        {
+            for (size_t const qos: options.qos)
+            {
+                for (size_t const payload: options.payloads)
+                {
+                    Result result;
+                    if (!run(options, id++, payload, QoS(qos),
+                             std::max<size_t>(1u, subscriptions),
+                             std::max<size_t>(1u, clients), result))
+                    {
+                        return EXIT_FAILURE;
+                    }
+
+                    std::cout << "{\"benchmark\": \"broker\""
+                              << ", \"payload\": " << payload
+                              << ", \"qos\": " << qos
+                              << ", \"subscriptions\": " << subscriptions
+                              << ", \"clients\": " << clients
+                              << ", \"sent\": " << result.sent
+                              << ", \"received\": " << result.received
+                              << ", \"msg_per_s\": " << result.msg_per_s
+                              << ", \"p50_us\": " << us(result.latency.percentile(0.5))
+                              << ", \"p99_us\": " << us(result.latency.percentile(0.99))
+                              << ", \"p999_us\": " << us(result.latency.percentile(0.999))
+                              << ", \"max_us\": " << us(result.latency.max())
+                              << "}" << std::endl;
+
+                    // QoS 1 and 2 messages shall not be lost.
+                    if ((qos != 0u) && (result.received < result.sent))
+                    {
+                        status = EXIT_FAILURE;
+                    }
+                }
+            }
+        }
+    }
+    return status;
+}
+
+// *****************************************************************************
+//! \brief Throughput and round-trip latency through a MQTT broker, sweeping
+//! payload sizes, QoS, number of subscriptions of the receiving client and
+//! number of publishing clients. Prints a JSON line per configuration.
+//!
+//! g++ --std=c++17 -O2 -Wall -Wextra -I../include BrokerBenchmark.cpp
+//! ../src/*.cpp -o broker_benchmark `pkg-config --cflags --libs libmosquitto`
+//! -lpthread
+//!
+//! Usage: ./broker_benchmark [--start-broker] [--host localhost] [--port 1883]
+//! [--messages 20000] [--rate 0] [--inflight 100] [--payloads 16,256,4096,65536]
+//! [--qos 0,1,2] [--subscriptions 1,1000] [--clients 1,4] [--low-latency]
+//! [--cpu 2] [--cafile ca.crt] [--kernel-tls]
+//!
+//! Or, for the time until a fleet of clients is connected:
+//! ./broker_benchmark --fleet 10000 [--concurrency 256]
+// *****************************************************************************
+int main(int argc, char* argv[])
+{
+    Options const options = parseOptions(argc, argv);
+
+    pid_t broker = 0;
+    if (options.start_broker)
+    {
+        broker = ::fork();
+        if (broker == 0)
+        {
+            std::string const port = std::to_string(options.port);
+            ::execlp("mosquitto", "mosquitto", "-p", port.c_str(), nullptr);
+            std::cerr << "Cannot start mosquitto: " << std::strerror(errno) << std::endl;
+            ::_exit(EXIT_FAILURE);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+
+    int const status = (options.fleet != 0u) ? startup(options) : sweep(options);
+
+    if (broker > 0)
+    {
+        ::kill(broker, SIGTERM);
+        ::waitpid(broker, nullptr, 0);
+    }
+    return status;
+}
@@ -0,0 +1,161 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/MQTT.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace mqtt;
+
+// *****************************************************************************
+//! \brief Count heap allocations made by each thread, so only the ones of the
+//! thread dispatching messages are counted.
+// *****************************************************************************
+static thread_local size_t s_allocations = 0u;
+
+void* operator new(size_t size)
+{
+    ++s_allocations;
+    if (void* p = std::malloc(size == 0u ? 1u : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace mqtt {
+
+// *****************************************************************************
+//! \brief Friend of Client registering callbacks without sending SUBSCRIBE
+//! packets, and giving synthetic messages to the callback of the mosquitto lib
+//! as done by the network thread.
+// *****************************************************************************
+class DispatchBenchmark
+{
+public:
+
+    static void subscribe(Client& client, std::string const& filter,
+                          Client::ReceptionCallback callback)
+    {
+        client.attach(filter, QoS::QoS0, 0, std::move(callback));
+    }
+
+    static void subscribe(Client& client, std::string const& filter,
+                          ReceptionPolicy const& policy,
+                          Client::ReceptionCallback callback)
+    {
+        client.attach(filter, QoS::QoS0, policy, std::move(callback));
+    }
+
+    static void deliver(Client& client, mosquitto_message const& message)
+    {
+        Client::on_message_received_wrapper(client.m_mosquitto, &client, &message, nullptr);
+    }
+};
+
+} // namespace mqtt
+
+// *****************************************************************************
+//! \brief Benchmark of the dispatch of received messages to the callbacks of
+//! subscriptions: Client::on_message_received_wrapper(), then the delivery
+//! policies and the topic tree. No broker is needed: subscriptions are only
+//! registered and synthetic messages are given to the wrapper. The number of
+//! heap allocations made while dispatching is counted and shall be zero.
+//!
+//! g++ --std=c++17 -O2 -Wall -Wextra -I../include DispatchBenchmark.cpp
+//! ../src/*.cpp -o dispatch_benchmark `pkg-config --cflags --libs libmosquitto`
+//! -lpthread
+//!
+//! Usage: ./dispatch_benchmark [number of subscriptions] [number of messages]
+// *****************************************************************************
+int main(int argc, char* argv[])
+{
+    size_t const subscriptions = (argc > 1) ? std::stoul(argv[1]) : 1000u;
+    size_t const messages = (argc > 2) ? std::stoul(argv[2]) : 1000000u;
+
+    // Long topic names, beyond the small string optimization, with overlapping
+    // wildcard subscriptions. The messages of line1 also go through a delivery
+    // policy.
+    Client client;
+    size_t calls = 0u;
+    auto const callback = [&calls](Message const&) { ++calls; };
+    std::vector<std::string> topics;
+    for (size_t i = 0u; i < subscriptions; ++i)
+    {
+        topics.push_back("plant/line" + std::to_string(i % 10u) +
+                         "/device_with_a_long_name_" + std::to_string(i) +
+                         "/temperature");
+        DispatchBenchmark::subscribe(client, topics.back(), callback);
+    }
+    DispatchBenchmark::subscribe(client, "plant/+/+/temperature", callback);
+    DispatchBenchmark::subscribe(client, "plant/line0/#", callback);
+    ReceptionPolicy policy;
+    policy.interval = std::chrono::nanoseconds(1);
+    DispatchBenchmark::subscribe(client, "plant/line1/#", policy, callback);
+
+    std::string const payload(64u, 'x');
+    mosquitto_message message{};
+    message.payload = const_cast<char*>(payload.data());
+    message.payloadlen = int(payload.size());
+
+    // Warm up: thread_local buffers and per topic states of the policy.
+    for (auto const& topic: topics)
+    {
+        message.topic = const_cast<char*>(topic.c_str());
+        DispatchBenchmark::deliver(client, message);
+    }
+
+    calls = 0u;
+    size_t const allocations = s_allocations;
+    auto const start = std::chrono::steady_clock::now();
+    for (size_t i = 0u; i < messages; ++i)
+    {
+        message.mid = int(i);
+        message.topic = const_cast<char*>(topics[i % topics.size()].c_str());
+        DispatchBenchmark::deliver(client, message);
+    }
+    auto const stop = std::chrono::steady_clock::now();
+    size_t const dispatch_allocations = s_allocations - allocations;
+
+    double const ns = double(std::chrono::duration_cast<
+        std::chrono::nanoseconds>(stop - start).count());
+    std::cout << "{\"benchmark\": \"dispatch\""
+              << ", \"subscriptions\": " << subscriptions + 3u
+              << ", \"messages\": " << messages
+              << ", \"callbacks\": " << calls
+              << ", \"ns_per_message\": " << (ns / double(messages))
+              << ", \"msg_per_s\": " << (1e9 * double(messages) / ns)
+              << ", \"allocations_per_message\": "
+              << (double(dispatch_allocations) / double(messages))
+              << "}" << std::endl;
+
+    return (dispatch_allocations == 0u) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
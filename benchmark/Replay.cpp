@@ -0,0 +1,391 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/MQTT.hpp"
+#include "MQTT/Capture.hpp"
+#include <signal.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace mqtt;
+
+// *****************************************************************************
+//! \brief Command line options.
+// *****************************************************************************
+struct Options
+{
+    //! \brief "capture" or "replay".
+    std::string mode;
+    //! \brief Path of the capture log.
+    std::string file;
+    std::string host = "localhost";
+    size_t port = 1883u;
+    //! \brief Capture: subscribed topic filters.
+    std::vector<std::string> topics{"#"};
+    //! \brief Capture: QoS of the subscriptions.
+    size_t qos = 0u;
+    //! \brief Capture: duration in seconds, 0 until interrupted.
+    size_t duration = 0u;
+    //! \brief Replay: number of publishing clients.
+    size_t clients = 1u;
+    //! \brief Replay: speed factor, 0 for as fast as possible.
+    double speed = 1.0;
+    //! \brief Replay: number of times the log is replayed.
+    size_t loops = 1u;
+    //! \brief Maximum number of in-flight QoS 1 and 2 messages per client.
+    size_t inflight = 100u;
+};
+
+//-----------------------------------------------------------------------------
+//! \brief Parse a comma separated list of strings.
+//-----------------------------------------------------------------------------
+static std::vector<std::string> parseList(std::string const& text)
+{
+    std::vector<std::string> values;
+    std::stringstream stream(text);
+    std::string value;
+    while (std::getline(stream, value, ','))
+    {
+        values.push_back(value);
+    }
+    return values;
+}
+
+//-----------------------------------------------------------------------------
+static Options parseOptions(int argc, char* argv[])
+{
+    Options options;
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " capture|replay <file> [options]"
+                  << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    options.mode = argv[1];
+    options.file = argv[2];
+    for (int i = 3; i < argc; ++i)
+    {
+        std::string const arg(argv[i]);
+        std::string const value((i + 1 < argc) ? argv[i + 1] : "");
+        if (arg == "--host") options.host = value;
+        else if (arg == "--port") options.port = std::stoul(value);
+        else if (arg == "--topics") options.topics = parseList(value);
+        else if (arg == "--qos") options.qos = std::stoul(value);
+        else if (arg == "--duration") options.duration = std::stoul(value);
+        else if (arg == "--clients") options.clients = std::max<size_t>(1u, std::stoul(value));
+        else if (arg == "--speed") options.speed = std::stod(value);
+        else if (arg == "--loops") options.loops = std::stoul(value);
+        else if (arg == "--inflight") options.inflight = std::stoul(value);
+        else
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        ++i;
+    }
+    return options;
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Wait until the predicate holds. Return false on timeout.
+//-----------------------------------------------------------------------------
+template<class Predicate>
+static bool waitFor(Predicate predicate, std::chrono::milliseconds const timeout)
+{
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+static uint64_t now()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+//-----------------------------------------------------------------------------
+static double us(std::chrono::nanoseconds const ns)
+{
+    return double(ns.count()) / 1000.0;
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Create a client and wait for its connection.
+//-----------------------------------------------------------------------------
+static std::unique_ptr<Client> connect(Options const& options)
+{
+    Client::Settings settings;
+    settings.max_inflight_messages = options.inflight;
+    std::unique_ptr<Client> client(new Client(settings));
+
+    Client::Connection connection;
+    connection.address = options.host;
+    connection.port = options.port;
+    if (!client->connect(connection) || !waitFor([&client]() {
+            return client->status() == Client::Status::Connected;
+        }, std::chrono::seconds(5)))
+    {
+        std::cerr << "Cannot connect to " << options.host << ":" << options.port
+                  << ": " << client->error().message() << std::endl;
+        return nullptr;
+    }
+    return client;
+}
+
+static std::atomic<bool> s_interrupted{false};
+
+//-----------------------------------------------------------------------------
+static void onInterrupt(int)
+{
+    s_interrupted = true;
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Record the messages of the subscribed topics until the duration
+//! elapses or the program is interrupted.
+//-----------------------------------------------------------------------------
+static int capture(Options const& options)
+{
+    CaptureLog log(options.file);
+    if (!log.open())
+    {
+        std::cerr << "Cannot create " << options.file << ": "
+                  << std::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::unique_ptr<Client> client = connect(options);
+    if (client == nullptr)
+        return EXIT_FAILURE;
+
+    client->capture(&log);
+    std::vector<Topic> filters(options.topics.size());
+    for (size_t i = 0u; i < filters.size(); ++i)
+    {
+        filters[i].name = options.topics[i];
+        if (!client->subscribe(filters[i], QoS(options.qos)))
+        {
+            std::cerr << client->error().message() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    ::signal(SIGINT, onInterrupt);
+    ::signal(SIGTERM, onInterrupt);
+    auto const end = std::chrono::steady_clock::now() +
+                     std::chrono::seconds(options.duration);
+    while (!s_interrupted &&
+           ((options.duration == 0u) || (std::chrono::steady_clock::now() < end)))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    client->disconnect();
+    client->capture(nullptr);
+    std::cout << "{\"capture\": \"" << options.file << "\""
+              << ", \"messages\": " << log.size()
+              << ", \"lost\": " << log.lost()
+              << "}" << std::endl;
+    log.close();
+    return (log.lost() == 0u) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Busy wait the last microseconds before the given time, sleeping
+//! before for not burning the core on slow traffic.
+//-----------------------------------------------------------------------------
+static void waitUntil(uint64_t const due)
+{
+    uint64_t t = now();
+    if (due > t + 2000000u)
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(due - t - 1000000u));
+    }
+    while (now() < due)
+    {
+        std::this_thread::yield();
+    }
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Republish the log through the clients, keeping the delays between
+//! messages divided by the speed factor. The messages of a topic are sent by
+//! the same client for keeping their order. The lag is the delay between the
+//! due time of a message and its publication.
+//-----------------------------------------------------------------------------
+static int replay(Options const& options)
+{
+    CaptureReader reader;
+    if (!reader.open(options.file))
+    {
+        std::cerr << "Cannot read " << options.file << ": "
+                  << std::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::unique_ptr<Client>> clients;
+    for (size_t i = 0u; i < options.clients; ++i)
+    {
+        clients.push_back(connect(options));
+        if (clients.back() == nullptr)
+            return EXIT_FAILURE;
+    }
+
+    // Topics indexed by their number in the log, named on their first
+    // message.
+    std::vector<Topic> topics;
+    LatencyHistogram lag;
+    size_t sent = 0u;
+    size_t failed = 0u;
+    size_t bytes = 0u;
+    uint64_t const start = now();
+    uint64_t offset = 0u;
+    for (size_t loop = 0u; loop < options.loops; ++loop)
+    {
+        reader.rewind();
+        CaptureReader::Record record;
+        uint64_t first = 0u;
+        uint64_t last = 0u;
+        bool begin = true;
+        while (reader.next(record))
+        {
+            if (begin)
+            {
+                first = record.timestamp;
+                begin = false;
+            }
+            last = record.timestamp;
+            if (record.topic >= topics.size())
+            {
+                topics.resize(reader.topics().size());
+            }
+            if (topics[record.topic].name.empty())
+            {
+                topics[record.topic].name = std::string(record.name);
+            }
+
+            uint64_t due = now();
+            if (options.speed > 0.0)
+            {
+                due = start + offset + uint64_t(double(record.timestamp - first) /
+                                                options.speed);
+                waitUntil(due);
+            }
+
+            Client& client = *clients[record.topic % clients.size()];
+            // Do not let the mosquitto lib queue an unbounded number of
+            // messages.
+            while (client.inflight() >= options.inflight)
+                std::this_thread::yield();
+
+            Topic& topic = topics[record.topic];
+            topic.retain = record.retain;
+            if (client.publish(topic, record.payload, record.size, QoS(record.qos)))
+            {
+                ++sent;
+                bytes += record.size;
+            }
+            else
+            {
+                ++failed;
+            }
+            lag.record(std::chrono::nanoseconds(now() - due));
+        }
+        if (options.speed > 0.0)
+        {
+            offset += uint64_t(double(last - first) / options.speed);
+        }
+    }
+
+    // Let the last messages go.
+    for (auto& client: clients)
+    {
+        waitFor([&client]() { return client->inflight() == 0u; },
+                std::chrono::seconds(10));
+    }
+    double const duration = double(std::max<uint64_t>(1u, now() - start)) / 1e9;
+
+    std::cout << "{\"benchmark\": \"replay\""
+              << ", \"file\": \"" << options.file << "\""
+              << ", \"speed\": " << options.speed
+              << ", \"clients\": " << options.clients
+              << ", \"sent\": " << sent
+              << ", \"failed\": " << failed
+              << ", \"duration_s\": " << duration
+              << ", \"msg_per_s\": " << double(sent) / duration
+              << ", \"mb_per_s\": " << double(bytes) / duration / 1e6
+              << ", \"lag_p50_us\": " << us(lag.percentile(0.5))
+              << ", \"lag_p99_us\": " << us(lag.percentile(0.99))
+              << ", \"lag_max_us\": " << us(lag.max())
+              << "}" << std::endl;
+
+    for (auto& client: clients)
+    {
+        client->disconnect();
+    }
+    return (failed == 0u) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// *****************************************************************************
+//! \brief Capture the traffic of a broker into a log file (see Capture.hpp)
+//! and replay it later, through one or more clients, at the speed of the
+//! capture multiplied by a factor. Prints a JSON line.
+//!
+//! g++ --std=c++17 -O2 -Wall -Wextra -I../include Replay.cpp ../src/*.cpp
+//! -o replay `pkg-config --cflags --libs libmosquitto` -lpthread
+//!
+//! Usage: ./replay capture <file> [--host localhost] [--port 1883]
+//! [--topics '#'] [--qos 0] [--duration 0]
+//!
+//! ./replay replay <file> [--host localhost] [--port 1883] [--clients 1]
+//! [--speed 1] [--loops 1] [--inflight 100]
+// *****************************************************************************
+int main(int argc, char* argv[])
+{
+    Options const options = parseOptions(argc, argv);
+    if (options.mode == "capture")
+        return capture(options);
+    if (options.mode == "replay")
+        return replay(options);
+
+    std::cerr << "Unknown mode " << options.mode << std::endl;
+    return EXIT_FAILURE;
+}
@@ -60,9 +60,9 @@ private:
 
     virtual void onMessageReceived(Message const& msg) override
     {
-        // Conversion from raw C string into C++ string.
+        // View on the payload (no copy).
         std::string topic(msg.topic);
-        std::string const& message = msg.cast_to<std::string>();
+        std::string_view message = msg.str();
 
         // Example of usage of the fields.
         std::cout << "[InheritanceClient] Received message " << msg.mid
@@ -73,7 +73,7 @@ private:
                 << std::endl;
 
         // Send back the echoed message.
-        publish(OUTPUT_TOPIC, message + " back from InheritanceClient", QoS::QoS0);
+        publish(OUTPUT_TOPIC, std::string(message) + " back from InheritanceClient", QoS::QoS0);
     }
 
     //-------------------------------------------------------------------------
@@ -138,9 +138,9 @@ public:
         // --------------------------------------------------------------------
         auto onMessageReceived = [this](const Message& msg)
         {
-            // Conversion from raw C string into C++ string.
+            // View on the payload (no copy).
             std::string topic(msg.topic);
-            std::string const& message = msg.cast_to<std::string>();
+            std::string_view message = msg.str();
 
             // Example of usage of the fields.
             std::cout << "[LambdaClient] Received message " << msg.mid
@@ -151,7 +151,7 @@ public:
                     << std::endl;
 
             // Send back the echoed message.
-            m_client.publish(OUTPUT_TOPIC, message + " back from LambdaClient", QoS::QoS0);
+            m_client.publish(OUTPUT_TOPIC, std::string(message) + " back from LambdaClient", QoS::QoS0);
         };
 
         // --------------------------------------------------------------------
@@ -204,7 +204,7 @@ private:
 };
 
 // *****************************************************************************
-//! \brief g++ --std=c++14 -Wall -Wextra -I../include ../src/MQTT.cpp Example.cpp
+//! \brief g++ --std=c++17 -Wall -Wextra -I../include ../src/*.cpp Example.cpp
 //! -o example `pkg-config --cflags --libs libmosquitto`
 // *****************************************************************************
 int main()
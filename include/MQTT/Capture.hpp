@@ -0,0 +1,207 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_CAPTURE_HPP
+#  define ASYNC_MQTT_CAPTURE_HPP
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <mutex>
+#  include <string>
+#  include <string_view>
+#  include <unordered_map>
+#  include <vector>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Log of captured messages, written to a memory-mapped file for being
+//! replayed later (see CaptureReader).
+//!
+//! The file is a header followed by records aligned on 8 bytes, in the order
+//! of the capture. The name of a topic is stored once, by a record defining
+//! its number, before its first message. The file grows by steps of the given
+//! size and is truncated to its content when closed. The header is updated
+//! after each record, so a log is readable up to its last record after a
+//! crash of the process.
+//!
+//! Thread safe: the log can be shared by several clients (see
+//! Client::capture()).
+// ****************************************************************************
+class CaptureLog
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief Do not create the file yet.
+    //! \param[in] path the path of the log file, replaced if existing.
+    //! \param[in] growth the size in bytes by which the file grows.
+    //-------------------------------------------------------------------------
+    CaptureLog(std::string path, size_t const growth = 64u * 1024u * 1024u);
+
+    //-------------------------------------------------------------------------
+    //! \brief Close the file.
+    //-------------------------------------------------------------------------
+    ~CaptureLog();
+
+    CaptureLog(CaptureLog const&) = delete;
+    CaptureLog& operator=(CaptureLog const&) = delete;
+
+    //-------------------------------------------------------------------------
+    //! \brief Create the file.
+    //! \return false on a system error (see errno).
+    //-------------------------------------------------------------------------
+    bool open();
+
+    //-------------------------------------------------------------------------
+    //! \brief Append a message.
+    //! \param[in] timestamp the time of the reception in nanoseconds.
+    //! \return false if the log is not opened or on a system error (see
+    //! errno), the message being lost.
+    //-------------------------------------------------------------------------
+    bool append(uint64_t const timestamp, std::string_view const topic,
+                uint8_t const* payload, size_t const size, int const qos,
+                bool const retain);
+
+    //-------------------------------------------------------------------------
+    //! \brief Truncate the file to its content and unmap it.
+    //-------------------------------------------------------------------------
+    void close();
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of messages captured.
+    //-------------------------------------------------------------------------
+    size_t size() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of messages lost on a system error.
+    //-------------------------------------------------------------------------
+    size_t lost() const;
+
+private:
+
+    bool reserve(size_t const length);
+    uint8_t* write(uint8_t const kind, uint64_t const timestamp,
+                   uint32_t const topic, size_t const size);
+
+    std::string m_path;
+    size_t m_growth;
+    mutable std::mutex m_mutex;
+    int m_fd = -1;
+    uint8_t* m_base = nullptr;
+    //! \brief Mapped size of the file.
+    size_t m_capacity = 0u;
+    //! \brief Offset after the last record.
+    size_t m_tail = 0u;
+    size_t m_messages = 0u;
+    size_t m_lost = 0u;
+    //! \brief Numbers of the topics already defined in the log, indexed by
+    //! the hash of their name (see topicHash()).
+    std::unordered_multimap<uint64_t, uint32_t> m_topics;
+    //! \brief Names of the topics, indexed by their number.
+    std::vector<std::string> m_names;
+};
+
+// ****************************************************************************
+//! \brief Sequential reader of a log written by CaptureLog. The file is
+//! mapped read-only and records are given in place, without copy. Not thread
+//! safe.
+// ****************************************************************************
+class CaptureReader
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief Captured message. Views on the mapped file, valid until the
+    //! reader is closed.
+    //-------------------------------------------------------------------------
+    struct Record
+    {
+        //! \brief Time of the reception in nanoseconds.
+        uint64_t timestamp = 0u;
+        //! \brief Number of the topic in the log, from 0 (see topics()).
+        uint32_t topic = 0u;
+        std::string_view name;
+        uint8_t const* payload = nullptr;
+        size_t size = 0u;
+        int qos = 0;
+        bool retain = false;
+    };
+
+    CaptureReader() = default;
+    ~CaptureReader();
+
+    CaptureReader(CaptureReader const&) = delete;
+    CaptureReader& operator=(CaptureReader const&) = delete;
+
+    //-------------------------------------------------------------------------
+    //! \brief Map the log file.
+    //! \return false on a system error (see errno) or if the file is not a
+    //! capture log (errno is EINVAL).
+    //-------------------------------------------------------------------------
+    bool open(std::string const& path);
+
+    //-------------------------------------------------------------------------
+    //! \brief Unmap the file.
+    //-------------------------------------------------------------------------
+    void close();
+
+    //-------------------------------------------------------------------------
+    //! \brief Give the next message.
+    //! \return false at the end of the log, or on a truncated record.
+    //-------------------------------------------------------------------------
+    bool next(Record& record);
+
+    //-------------------------------------------------------------------------
+    //! \brief Restart from the first message.
+    //-------------------------------------------------------------------------
+    void rewind() { m_head = m_first; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of messages of the log.
+    //-------------------------------------------------------------------------
+    size_t size() const { return m_messages; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the names of the topics read so far, indexed by their
+    //! number.
+    //-------------------------------------------------------------------------
+    std::vector<std::string_view> const& topics() const { return m_topics; }
+
+private:
+
+    uint8_t const* m_base = nullptr;
+    size_t m_size = 0u;
+    size_t m_first = 0u;
+    size_t m_head = 0u;
+    size_t m_tail = 0u;
+    size_t m_messages = 0u;
+    std::vector<std::string_view> m_topics;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_CAPTURE_HPP
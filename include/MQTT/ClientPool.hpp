@@ -0,0 +1,170 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_CLIENT_POOL_HPP
+#  define ASYNC_MQTT_CLIENT_POOL_HPP
+
+#  include "MQTT/MQTT.hpp"
+#  include <memory>
+#  include <mutex>
+#  include <vector>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Set of MQTT clients connected to the same broker, used for spreading
+//! the publishing load over several connections (each one having its own
+//! socket, network thread and window of in-flight messages).
+//!
+//! Client ids are derived from Settings::client_id by appending "-<index>"
+//! (let it empty for random ids from the broker). Messages are routed to a
+//! member by the hash of their topic, which keeps in order the messages of a
+//! same topic, or in round-robin.
+// ****************************************************************************
+class ClientPool
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief How messages are routed to members.
+    //-------------------------------------------------------------------------
+    enum class Routing
+    {
+        //! \brief By the hash of the topic name: messages of a same topic are
+        //! sent by the same connection, so their order is kept.
+        TopicHash,
+        //! \brief Each message sent by the next member.
+        RoundRobin
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Create the members.
+    //! \param[in] size the number of connections (at least 1).
+    //! \param[in] settings the settings of members. Their client id is
+    //! derived from settings.client_id.
+    //! \param[in] routing how messages are routed to members.
+    //-------------------------------------------------------------------------
+    ClientPool(size_t const size, Client::Settings const& settings,
+               Routing const routing = Routing::TopicHash);
+
+    //-------------------------------------------------------------------------
+    //! \brief Connect all members to the broker.
+    //! \param[in] onConnected callback called by each member once connected
+    //! (may be called concurrently from several network threads).
+    //! \param[in] onDisconnected callback called by each member once
+    //! disconnected.
+    //! \return true if all members have been connected, else return false.
+    //-------------------------------------------------------------------------
+    bool connect(Client::Connection const& settings,
+                 Client::ConnectionCallback onConnected = nullptr,
+                 Client::ConnectionCallback onDisconnected = nullptr);
+
+    //-------------------------------------------------------------------------
+    //! \brief Disconnect all members from the broker.
+    //! \return true if all members have been disconnected.
+    //-------------------------------------------------------------------------
+    bool disconnect();
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a message through the member selected by the routing.
+    //! \return true if not internal error occured, else return false.
+    //-------------------------------------------------------------------------
+    bool publish(Topic& topic, uint8_t const* payload, size_t const size, QoS const qos);
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a vector of bytes through the member selected by the
+    //! routing.
+    //-------------------------------------------------------------------------
+    bool publish(Topic& topic, std::vector<uint8_t> const& payload, QoS const qos)
+    {
+        return publish(topic, payload.data(), payload.size(), qos);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a string through the member selected by the routing.
+    //-------------------------------------------------------------------------
+    bool publish(Topic& topic, std::string const& payload, QoS const qos)
+    {
+        return publish(topic, reinterpret_cast<uint8_t const*>(payload.c_str()),
+                       payload.size() + 1u, qos);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the status of the pool: InDefect if a member is in
+    //! defect, Connected if all members are connected, else Disconnected.
+    //-------------------------------------------------------------------------
+    Client::Status status() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of connected members.
+    //-------------------------------------------------------------------------
+    size_t connected() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the last error of the pool: the error of the last
+    //! member which failed, whatever the thread calling the pool.
+    //-------------------------------------------------------------------------
+    std::error_code error() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the member selected by the routing for the topic.
+    //-------------------------------------------------------------------------
+    Client& route(Topic const& topic);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the i-th member.
+    //-------------------------------------------------------------------------
+    Client& operator[](size_t const i) { return *m_clients[i]; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of members.
+    //-------------------------------------------------------------------------
+    size_t size() const { return m_clients.size(); }
+
+private:
+
+    //-------------------------------------------------------------------------
+    //! \brief Remember the error of the member which failed for error().
+    //-------------------------------------------------------------------------
+    bool check(Client const& client, bool const result);
+
+private:
+
+    //! \brief The members.
+    std::vector<std::unique_ptr<Client>> m_clients;
+    //! \brief How messages are routed to members.
+    Routing m_routing;
+    //! \brief Next member for Routing::RoundRobin.
+    std::atomic<size_t> m_next{0u};
+    //! \brief Error of the last member which failed, copied when it failed
+    //! since the error of a member belongs to the thread calling it.
+    mutable std::mutex m_mutex;
+    std::error_code m_error;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_CLIENT_POOL_HPP
@@ -0,0 +1,275 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_CODEC_HPP
+#  define ASYNC_MQTT_CODEC_HPP
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <cstring>
+#  include <new>
+#  include <tuple>
+#  include <type_traits>
+#  include <utility>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Description of the fields of a struct, to be specialized for
+//! publishing it in little endian whatever the host. Fields are encoded in the
+//! given order without padding. They shall be arithmetic or enum types.
+//!
+//! \code
+//!   struct Sensor { uint32_t id; float temperature; uint16_t flags; };
+//!
+//!   template<> struct mqtt::Layout<Sensor>
+//!   {
+//!       static constexpr auto fields()
+//!       {
+//!           return std::make_tuple(&Sensor::id, &Sensor::temperature,
+//!                                  &Sensor::flags);
+//!       }
+//!   };
+//! \endcode
+//!
+//! Without specialization, trivially copyable types are sent as their bytes
+//! in memory (host byte order and padding).
+// ****************************************************************************
+template<class T>
+struct Layout {};
+
+namespace detail {
+
+//-----------------------------------------------------------------------------
+//! \brief Type of pointed member.
+//-----------------------------------------------------------------------------
+template<class P> struct MemberOf;
+template<class T, class M> struct MemberOf<M T::*> { using type = M; };
+
+template<class T, class = void>
+struct HasLayout : std::false_type {};
+template<class T>
+struct HasLayout<T, std::void_t<decltype(Layout<T>::fields())>> : std::true_type {};
+
+//-----------------------------------------------------------------------------
+//! \brief Copy bytes of a field reversing them on big endian hosts.
+//-----------------------------------------------------------------------------
+inline void copyLittleEndian(uint8_t* to, uint8_t const* from, size_t const size)
+{
+#  if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    for (size_t i = 0u; i < size; ++i)
+    {
+        to[i] = from[size - 1u - i];
+    }
+#  else
+    std::memcpy(to, from, size);
+#  endif
+}
+
+} // namespace detail
+
+// ****************************************************************************
+//! \brief Conversion of values of type T from and to payloads. Defined for
+//! trivially copyable types (copied as they are) and for types with a Layout
+//! (fields in little endian).
+//!
+//! Specialize it for other serializations (FlatBuffers, Cap'n Proto ...) with
+//! the same static functions:
+//!   - size_t size(T const& value): number of bytes of the encoded value.
+//!   - void encode(T const& value, uint8_t* buffer): write size(value) bytes.
+//!   - bool decode(uint8_t const* data, size_t size, T& value): return false
+//!     if the payload is not a valid encoding.
+//! and optionally `static constexpr bool zero_copy = true` if the bytes of a
+//! T in memory are its encoding (Message::view() then avoids copies).
+// ****************************************************************************
+template<class T, class Enable = void>
+struct Codec {};
+
+//-----------------------------------------------------------------------------
+//! \brief Trivially copyable types: the payload is the bytes of the value.
+//-----------------------------------------------------------------------------
+template<class T>
+struct Codec<T, std::enable_if_t<std::is_trivially_copyable<T>::value &&
+                                 !std::is_array<T>::value &&
+                                 !std::is_pointer<T>::value &&
+                                 !detail::HasLayout<T>::value>>
+{
+    static constexpr bool zero_copy = true;
+
+    static constexpr size_t size(T const&) { return sizeof(T); }
+
+    static void encode(T const& value, uint8_t* buffer)
+    {
+        std::memcpy(buffer, &value, sizeof(T));
+    }
+
+    static bool decode(uint8_t const* data, size_t const size, T& value)
+    {
+        if (size != sizeof(T))
+            return false;
+        std::memcpy(&value, data, sizeof(T));
+        return true;
+    }
+};
+
+//-----------------------------------------------------------------------------
+//! \brief Types with a Layout: fields in little endian, without padding.
+//-----------------------------------------------------------------------------
+template<class T>
+struct Codec<T, std::enable_if_t<detail::HasLayout<T>::value>>
+{
+    //! \brief Number of bytes of the encoded value.
+    static constexpr size_t bytes = std::apply([](auto... fields)
+    {
+        return (size_t(0) + ... + sizeof(typename detail::MemberOf<
+            decltype(fields)>::type));
+    }, Layout<T>::fields());
+
+    static constexpr size_t size(T const&) { return bytes; }
+
+    static void encode(T const& value, uint8_t* buffer)
+    {
+        std::apply([&](auto... fields)
+        {
+            ((check<decltype(fields)>(),
+              detail::copyLittleEndian(buffer,
+                  reinterpret_cast<uint8_t const*>(&(value.*fields)),
+                  sizeof(value.*fields)),
+              buffer += sizeof(value.*fields)), ...);
+        }, Layout<T>::fields());
+    }
+
+    static bool decode(uint8_t const* data, size_t const size, T& value)
+    {
+        if (size != bytes)
+            return false;
+        std::apply([&](auto... fields)
+        {
+            ((detail::copyLittleEndian(
+                  reinterpret_cast<uint8_t*>(&(value.*fields)), data,
+                  sizeof(value.*fields)),
+              data += sizeof(value.*fields)), ...);
+        }, Layout<T>::fields());
+        return true;
+    }
+
+private:
+
+    template<class P>
+    static constexpr void check()
+    {
+        using M = typename detail::MemberOf<P>::type;
+        static_assert(std::is_arithmetic<M>::value || std::is_enum<M>::value,
+                      "Layout fields shall be arithmetic or enum types");
+    }
+};
+
+//-----------------------------------------------------------------------------
+//! \brief Is there a Codec for T?
+//-----------------------------------------------------------------------------
+template<class T, class = void>
+struct IsEncodable : std::false_type {};
+template<class T>
+struct IsEncodable<T, std::void_t<decltype(&Codec<T>::encode)>> : std::true_type {};
+
+//-----------------------------------------------------------------------------
+//! \brief Are the bytes of a T in memory its encoding?
+//-----------------------------------------------------------------------------
+template<class T, class = void>
+struct IsZeroCopy : std::false_type {};
+template<class T>
+struct IsZeroCopy<T, std::void_t<decltype(Codec<T>::zero_copy)>>
+    : std::integral_constant<bool, Codec<T>::zero_copy> {};
+
+// ****************************************************************************
+//! \brief Typed read-only view on a payload, returned by Message::view<T>().
+//!
+//! When the encoding of T is its bytes in memory and the payload is aligned
+//! for T, the view points into the payload (no copy). Else the payload is
+//! decoded into storage held by the view. Like the message, the view shall
+//! not be used after the callback completes. Check it is valid before use:
+//! the payload may not be a T.
+// ****************************************************************************
+template<class T>
+class View
+{
+public:
+
+    View(uint8_t const* data, size_t const size)
+    {
+        if constexpr (IsZeroCopy<T>::value)
+        {
+            if (size != sizeof(T))
+                return ;
+            if (reinterpret_cast<uintptr_t>(data) % alignof(T) == 0u)
+            {
+                m_value = reinterpret_cast<T const*>(data);
+                return ;
+            }
+            std::memcpy(&m_storage, data, sizeof(T));
+            m_value = std::launder(reinterpret_cast<T const*>(&m_storage));
+        }
+        else
+        {
+            T* value = ::new (&m_storage) T();
+            if (Codec<T>::decode(data, size, *value))
+            {
+                m_value = value;
+            }
+            else
+            {
+                value->~T();
+            }
+        }
+    }
+
+    ~View()
+    {
+        if constexpr (!std::is_trivially_destructible<T>::value)
+        {
+            if (m_value == std::launder(reinterpret_cast<T const*>(&m_storage)))
+                m_value->~T();
+        }
+    }
+
+    View(View const&) = delete;
+    View& operator=(View const&) = delete;
+
+    //! \brief Return false if the payload could not be decoded as a T.
+    explicit operator bool() const { return m_value != nullptr; }
+    T const* get() const { return m_value; }
+    T const& operator*() const { return *m_value; }
+    T const* operator->() const { return m_value; }
+
+private:
+
+    T const* m_value = nullptr;
+    std::aligned_storage_t<sizeof(T), alignof(T)> m_storage;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_CODEC_HPP
@@ -0,0 +1,168 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_COMPRESSION_HPP
+#  define ASYNC_MQTT_COMPRESSION_HPP
+
+#  include <mosquitto.h>
+#  include <cstddef>
+#  include <cstdint>
+#  include <string>
+#  include <string_view>
+#  include <vector>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+//! \brief Compression algorithm of published payloads. Available when the
+//! library is compiled with -DMQTT_WITH_LZ4 (link with -llz4) or
+//! -DMQTT_WITH_ZSTD (link with -lzstd).
+//-----------------------------------------------------------------------------
+enum class Compression { None, LZ4, Zstd };
+
+// ****************************************************************************
+//! \brief Optional compression stage of payloads.
+//!
+//! Payloads are compressed as standard LZ4 or zstd frames. With MQTT v5,
+//! compressed messages are marked with the user property "content-encoding"
+//! (set to "lz4" or "zstd") and received payloads are decompressed only when
+//! marked, whatever the settings of the receiving client, as long as the
+//! algorithm has been compiled in. MQTT v3.1.1 has no properties: received
+//! payloads are given as they are, unless recognizing compressed frames by
+//! their magic number has been enabled (a plain payload starting with the same
+//! bytes would then be corrupted).
+//!
+//! Small payloads (under the threshold) and payloads not getting smaller are
+//! sent as they are. zstd dictionaries trained on messages of a topic prefix
+//! (zstd --train) may be registered: they are used for publishing on topics
+//! starting with the prefix and, found back by their id, for decompressing.
+//!
+//! Compressed and decompressed payloads are written in buffers owned by the
+//! calling thread, which keep their capacity: no memory is allocated once
+//! warmed up. A payload stays valid until the next call of the same thread.
+// ****************************************************************************
+class Compressor
+{
+public:
+
+    //! \brief MQTT payloads cannot exceed 256 MB: bigger decompressed sizes
+    //! are rejected.
+    static constexpr size_t MAX_PAYLOAD_SIZE = 268435455u;
+
+    //-------------------------------------------------------------------------
+    //! \brief Configure the compression of published payloads.
+    //! \param[in] algorithm the compression algorithm, Compression::None for
+    //! only decompressing received payloads.
+    //! \param[in] threshold payloads smaller than this number of bytes are not
+    //! compressed.
+    //! \param[in] level the compression level, 0 for the algorithm default.
+    //! \param[in] v5 the protocol is MQTT v5: add the user property marking
+    //! compressed messages and only decompress marked ones.
+    //! \param[in] sniff MQTT v3.1.1: decompress received payloads starting
+    //! with the magic number of a compressed frame.
+    //-------------------------------------------------------------------------
+    Compressor(Compression const algorithm, size_t const threshold,
+               int const level, bool const v5, bool const sniff);
+
+    ~Compressor();
+
+    Compressor(Compressor const&) = delete;
+    Compressor& operator=(Compressor const&) = delete;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return true if the algorithm has been compiled in.
+    //-------------------------------------------------------------------------
+    static bool supported(Compression const algorithm);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the algorithm used for publishing.
+    //-------------------------------------------------------------------------
+    Compression algorithm() const { return m_algorithm; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Register a zstd dictionary for topics starting with the given
+    //! prefix (the longest matching prefix wins). To be called before
+    //! publishing or receiving messages.
+    //! \return false if zstd is not compiled in or the dictionary is invalid.
+    //-------------------------------------------------------------------------
+    bool addDictionary(std::string const& prefix, uint8_t const* dictionary,
+                       size_t const size);
+
+    //-------------------------------------------------------------------------
+    //! \brief Compress the payload published on the given topic.
+    //! \param[out] out the compressed payload, in a buffer of the thread.
+    //! \param[out] out_size its number of bytes.
+    //! \return false if the payload shall be sent as it is.
+    //-------------------------------------------------------------------------
+    bool compress(std::string_view const topic, uint8_t const* data,
+                  size_t const size, uint8_t const*& out, size_t& out_size) const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Decompress the received payload if it is marked as compressed
+    //! by its MQTT v5 properties (or, if enabled with MQTT v3.1.1, starts with
+    //! the magic number of a compressed frame).
+    //! \param[in] properties the MQTT v5 properties of the message, or nullptr.
+    //! \param[out] out the decompressed payload, in a buffer of the thread.
+    //! \param[out] out_size its number of bytes.
+    //! \return false if the payload is not compressed (or cannot be
+    //! decompressed) and shall be given as it is.
+    //-------------------------------------------------------------------------
+    bool decompress(mosquitto_property const* properties,
+                    uint8_t const* data, size_t const size,
+                    uint8_t const*& out, size_t& out_size) const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the MQTT v5 properties marking compressed messages, or
+    //! nullptr.
+    //-------------------------------------------------------------------------
+    mosquitto_property const* properties() const { return m_properties; }
+
+private:
+
+    struct Dictionary
+    {
+        std::string prefix;
+        unsigned id;
+        void* compression;
+        void* decompression;
+    };
+
+    Dictionary const* dictionaryOf(std::string_view const topic) const;
+    Compression encodingOf(mosquitto_property const* properties,
+                           uint8_t const* data, size_t const size) const;
+
+    Compression m_algorithm;
+    size_t m_threshold;
+    int m_level;
+    bool m_v5;
+    bool m_sniff;
+    std::vector<Dictionary> m_dictionaries;
+    mosquitto_property* m_properties = nullptr;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_COMPRESSION_HPP
@@ -0,0 +1,210 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_IN_FLIGHT_HPP
+#  define ASYNC_MQTT_IN_FLIGHT_HPP
+
+#  include <array>
+#  include <atomic>
+#  include <chrono>
+#  include <cstddef>
+#  include <cstdint>
+#  include <mutex>
+#  include <vector>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Histogram of durations with a bounded relative error (HDR-style).
+//!
+//! Values are stored in buckets of logarithmic magnitude, each of them split
+//! into 32 linear sub-buckets, so any recorded value is known at ~3% whatever
+//! its magnitude, for a fixed memory footprint. Durations are in nanoseconds
+//! and saturate at ~73 minutes.
+//!
+//! Recording is done by a single thread (the network thread) while any thread
+//! may read the histogram: counters are relaxed atomics and a reader may see
+//! a value recorded during its reading or not.
+// ****************************************************************************
+class LatencyHistogram
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief Record a duration.
+    //-------------------------------------------------------------------------
+    void record(std::chrono::nanoseconds const duration);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of recorded durations.
+    //-------------------------------------------------------------------------
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the smallest recorded duration (0 if empty).
+    //-------------------------------------------------------------------------
+    std::chrono::nanoseconds min() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the greatest recorded duration (0 if empty).
+    //-------------------------------------------------------------------------
+    std::chrono::nanoseconds max() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the mean of recorded durations (0 if empty).
+    //-------------------------------------------------------------------------
+    std::chrono::nanoseconds mean() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the duration below which the given fraction of recorded
+    //! durations lies (0 if empty).
+    //! \param[in] quantile in [0, 1], for example 0.99 for the p99.
+    //-------------------------------------------------------------------------
+    std::chrono::nanoseconds percentile(double const quantile) const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Forget all recorded durations.
+    //-------------------------------------------------------------------------
+    void reset();
+
+private:
+
+    //! \brief Number of linear sub-buckets per magnitude, as a power of two.
+    static constexpr unsigned SUB_BITS = 5u;
+    static constexpr uint64_t SUB_COUNT = uint64_t(1) << SUB_BITS;
+    //! \brief Greatest magnitude (as a power of two of nanoseconds).
+    static constexpr unsigned MAX_BITS = 42u;
+    static constexpr size_t BUCKETS = (MAX_BITS - SUB_BITS + 1u) * SUB_COUNT;
+
+    static size_t indexOf(uint64_t const value);
+    static uint64_t highestOf(size_t const index);
+
+    std::array<std::atomic<uint64_t>, BUCKETS> m_buckets{};
+    std::atomic<uint64_t> m_count{0u};
+    std::atomic<uint64_t> m_sum{0u};
+    std::atomic<uint64_t> m_min{UINT64_MAX};
+    std::atomic<uint64_t> m_max{0u};
+};
+
+// ****************************************************************************
+//! \brief Table of the QoS 1 and QoS 2 messages sent and not yet acknowledged
+//! by the broker, with the time they have been sent, and the histograms of
+//! their acknowledgement latencies.
+//!
+//! Message ids are kept in an open addressing table (linear probing, backward
+//! shift deletion) sized for the maximum number of in-flight messages: once
+//! warmed up, opening and closing entries does not allocate memory. The table
+//! grows if the mosquitto lib queues more messages than expected.
+// ****************************************************************************
+class InFlightTable
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    //-------------------------------------------------------------------------
+    //! \brief Create an empty table.
+    //! \param[in] capacity the expected maximum number of in-flight messages.
+    //-------------------------------------------------------------------------
+    explicit InFlightTable(size_t const capacity = 20u);
+
+    //-------------------------------------------------------------------------
+    //! \brief Call the function sending a message and, if it succeeded and the
+    //! QoS is greater than 0, open an entry for the message id it returned.
+    //! The table is locked during the sending so the acknowledgement cannot be
+    //! closed before being opened.
+    //! \param[in] qos the quality of service of the message.
+    //! \param[in] mid the message id set by send.
+    //! \param[in] send function returning a mosquitto error code.
+    //! \return the code returned by send.
+    //-------------------------------------------------------------------------
+    template<class Send>
+    int track(int const qos, int const& mid, Send&& send)
+    {
+        if (qos == 0)
+            return send();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Clock::time_point const now = Clock::now();
+        int const rc = send();
+        if (rc == 0)
+        {
+            open(mid, qos, now);
+        }
+        return rc;
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Close the entry of an acknowledged message and record its
+    //! latency. Does nothing for unknown message ids (QoS 0 messages).
+    //! \return true if the entry existed.
+    //-------------------------------------------------------------------------
+    bool close(int const mid);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of messages waiting for their acknowledgement.
+    //-------------------------------------------------------------------------
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return for how long the oldest in-flight message has been
+    //! waiting for its acknowledgement (0 if there is none).
+    //-------------------------------------------------------------------------
+    std::chrono::nanoseconds oldest() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the histogram of acknowledgement latencies of messages of
+    //! the given QoS (1 or 2). QoS 0 messages are not acknowledged: their
+    //! histogram stays empty.
+    //-------------------------------------------------------------------------
+    LatencyHistogram const& latency(int const qos) const
+    {
+        return m_latencies[size_t(qos) % m_latencies.size()];
+    }
+
+private:
+
+    struct Entry
+    {
+        //! \brief Message id, 0 for a free slot (mosquitto never uses 0).
+        int mid = 0;
+        int qos = 0;
+        Clock::time_point sent;
+    };
+
+    void open(int const mid, int const qos, Clock::time_point const sent);
+    size_t slotOf(int const mid) const;
+    void grow();
+
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+    std::atomic<size_t> m_size{0u};
+    std::array<LatencyHistogram, 3> m_latencies;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_IN_FLIGHT_HPP
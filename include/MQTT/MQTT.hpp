@@ -27,16 +27,37 @@
 #ifndef ASYNC_MQTT_CLIENT_HPP
 #  define ASYNC_MQTT_CLIENT_HPP
 
+#  include "MQTT/TopicTree.hpp"
+#  include "MQTT/RingBuffer.hpp"
+#  include "MQTT/InFlight.hpp"
+#  include "MQTT/Metrics.hpp"
+#  include "MQTT/Codec.hpp"
+#  include "MQTT/Compression.hpp"
+#  include "MQTT/TopicAliases.hpp"
+#  include "MQTT/OfflineQueue.hpp"
+#  include "MQTT/ReceptionFilter.hpp"
+#  include "MQTT/TopicCache.hpp"
+#  include "MQTT/TopicPattern.hpp"
+#  include "MQTT/RateLimiter.hpp"
+#  include "MQTT/Tls.hpp"
 #  include <mosquitto.h>
 #  include <string>
 #  include <cstring>
+#  include <algorithm>
 #  include <vector>
 #  include <cassert>
-#  include <map>
+#  include <memory>
+#  include <string_view>
 #  include <atomic>
 #  include <functional>
 #  include <chrono>
+#  include <limits>
 #  include <system_error>
+#  include <mutex>
+#  include <shared_mutex>
+#  include <condition_variable>
+#  include <thread>
+#  include <unordered_map>
 
 namespace mqtt {
 
@@ -60,6 +81,82 @@ enum class QoS
     QoS2  //! \brief Exactly once
 };
 
+// ****************************************************************************
+//! \brief Errors detected by the wrapper itself, each one with its own code
+//! of the "MQTT client" category and a static message: reporting them does not
+//! allocate. Their default_error_condition() is the matching code of the
+//! mosquitto lib (ie. MOSQ_ERR_INVAL for EmptyTopic), given to acknowledgement
+//! callbacks. Errors of the mosquitto lib keep their code, in the "MQTT"
+//! category.
+// ****************************************************************************
+enum class Error
+{
+    // MOSQ_ERR_INVAL
+    EmptyTopic = 1,
+    InvalidPayload,
+    InvalidTopicHandle,
+    MalformedTopicFilter,
+    PolicyWithoutCallback,
+    InvalidDictionary,
+    TooManyChunks,
+    StreamAlreadyPublished,
+    InvalidCpu,
+    // MOSQ_ERR_NOMEM
+    PublishQueueFull,
+    PublishRateExceeded,
+    // MOSQ_ERR_NOT_SUPPORTED
+    CompressionNotCompiled,
+    OptionsNeedV5,
+    TuningNeedsLinux,
+    TlsNeedsOpenSSL,
+    // MOSQ_ERR_ERRNO (see errno)
+    OfflineQueueOpen,
+    OfflineQueueWrite,
+    StreamRead,
+    CannotPinThread,
+    CannotScheduleThread,
+    // MOSQ_ERR_PAYLOAD_SIZE
+    OfflineMessageTooBig,
+    // MOSQ_ERR_TLS
+    InvalidTlsSettings
+};
+
+//-----------------------------------------------------------------------------
+//! \brief Category of the errors of the mosquitto lib ("MQTT").
+//-----------------------------------------------------------------------------
+std::error_category const& mosquittoCategory() noexcept;
+
+//-----------------------------------------------------------------------------
+//! \brief Category of the errors of the wrapper ("MQTT client").
+//-----------------------------------------------------------------------------
+std::error_category const& clientCategory() noexcept;
+
+//-----------------------------------------------------------------------------
+//! \brief For comparing error() with an Error: client.error() ==
+//! Error::EmptyTopic.
+//-----------------------------------------------------------------------------
+inline std::error_code make_error_code(Error const error) noexcept
+{
+    return { int(error), clientCategory() };
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Return the code of the mosquitto lib matching an error of the
+//! wrapper or of the mosquitto lib.
+//-----------------------------------------------------------------------------
+inline int mosquittoError(std::error_code const& error) noexcept
+{
+    return error.default_error_condition().value();
+}
+
+} // namespace mqtt
+
+namespace std {
+template<> struct is_error_code_enum<mqtt::Error> : true_type {};
+} // namespace std
+
+namespace mqtt {
+
 // ****************************************************************************
 //! \brief An MQTT topic is and identifier used by the broker to filter
 //! messages from connected clients.
@@ -74,6 +171,58 @@ struct Topic
     int id = 0;
 };
 
+// ****************************************************************************
+//! \brief Topic name checked and hashed once, typically at startup, for
+//! topics published many times: Client::publish(TopicHandle&, ...) does not
+//! check it again and, with MQTT v5, remembers its topic alias instead of
+//! looking it up on each publication. A handle shall be published by one
+//! client at a time.
+//!
+//! hash() is the hash used by TopicTree and TopicCache, and is() compares a
+//! received topic, so the handle can also serve lookups on reception.
+// ****************************************************************************
+class TopicHandle
+{
+public:
+
+    TopicHandle() = default;
+
+    //-------------------------------------------------------------------------
+    //! \brief Check the topic name: not empty, at most 65535 bytes and no
+    //! wildcards nor null characters. See valid().
+    //-------------------------------------------------------------------------
+    explicit TopicHandle(std::string_view const name, bool const retain = false);
+
+    //-------------------------------------------------------------------------
+    //! \brief Is the name a valid topic name for publishing?
+    //-------------------------------------------------------------------------
+    bool valid() const { return m_valid; }
+
+    std::string const& name() const { return m_topic.name; }
+    bool retain() const { return m_topic.retain; }
+    uint64_t hash() const { return m_hash; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the message id of the last publication.
+    //-------------------------------------------------------------------------
+    int id() const { return m_topic.id; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Is the given topic the topic of this handle?
+    //-------------------------------------------------------------------------
+    bool is(std::string_view const topic) const { return topic == m_topic.name; }
+
+private:
+
+    friend class Client;
+
+    Topic m_topic;
+    uint64_t m_hash = 0u;
+    bool m_valid = false;
+    //! \brief Alias of the last connection, updated by the client.
+    TopicAliases::Binding m_alias;
+};
+
 // ****************************************************************************
 //! \brief C++ Wrapper on the C struct mosquitto_message with some helper
 //! methods. Note that message returned by the subscribe() callback or by
@@ -87,9 +236,64 @@ struct Topic
 //!  - uint32_t payloadlen;
 //!  - int qos;
 //!  - bool retain;
+//!
+//! To keep the message after the callback completes without deep copying the
+//! payload in your own containers, call share(): the returned handle owns a
+//! copy of the message made once by the library and can be passed to other
+//! threads at the cost of a reference count.
 // ****************************************************************************
+struct Message;
+
+//-----------------------------------------------------------------------------
+//! \brief Reference counted handle on a message owned by the library. The
+//! message is freed when the last handle is released.
+//-----------------------------------------------------------------------------
+using SharedMessage = std::shared_ptr<Message const>;
+
 struct Message : mosquitto_message
 {
+    //---------------------------------------------------------------------
+    //! \brief Return the address of the payload. No copy is made: the memory
+    //! has the lifetime of the message.
+    //---------------------------------------------------------------------
+    uint8_t const* data() const
+    {
+        return static_cast<uint8_t const*>(this->payload);
+    }
+
+    //---------------------------------------------------------------------
+    //! \brief Return the number of bytes of the payload.
+    //---------------------------------------------------------------------
+    size_t size() const
+    {
+        return size_t(this->payloadlen);
+    }
+
+    //---------------------------------------------------------------------
+    //! \brief Return a view on the payload as a string. No copy is made: the
+    //! view has the lifetime of the message. The terminating null character
+    //! sent by Client::publish(Topic&, std::string const&, QoS) is not part
+    //! of the view.
+    //---------------------------------------------------------------------
+    std::string_view str() const
+    {
+        std::string_view view(static_cast<char const*>(this->payload), size());
+        if ((!view.empty()) && (view.back() == '\0'))
+        {
+            view.remove_suffix(1u);
+        }
+        return view;
+    }
+
+    //---------------------------------------------------------------------
+    //! \brief Return a handle owning a copy of this message made by the
+    //! mosquitto library (mosquitto_message_copy). The handle can be stored
+    //! or passed to another thread after the callback completes without any
+    //! further copy.
+    //! \return the handle or nullptr if the copy failed.
+    //---------------------------------------------------------------------
+    SharedMessage share() const;
+
     //---------------------------------------------------------------------
     //! \brief Since received message payloads are temporary, when callback
     //! such as onMessageReceived() the payload content is no longer available
@@ -113,32 +317,77 @@ struct Message : mosquitto_message
         return buffer.size();
     }
 
+    //---------------------------------------------------------------------
+    //! \brief Return a typed view on the payload decoded by Codec<T> (see
+    //! Codec.hpp). No copy is made for trivially copyable types when the
+    //! payload is aligned. The view is invalid (false) if the payload is not
+    //! a T. Like the message, the view shall not be used after the callback
+    //! completes.
+    //---------------------------------------------------------------------
+    template<class T>
+    View<T> view() const
+    {
+        return View<T>(data(), size());
+    }
+
+    //---------------------------------------------------------------------
+    //! \brief Decode the payload into the given value with Codec<T>.
+    //! \return false if the payload is not a T.
+    //---------------------------------------------------------------------
+    template<class T>
+    bool decode(T& value) const
+    {
+        return Codec<T>::decode(data(), size(), value);
+    }
+
     //---------------------------------------------------------------------
     //! \brief Cast the payload into the desired struct/class passed as
     //! template. Beware this returns a reference on a temporary memory that
     //! will be freed by the library after the callback completes. The client
-    //! should make a copy of the class if he desires to keep it.
+    //! should make a copy of the class if he desires to keep it. A misaligned
+    //! payload is copied into memory owned by the calling thread, overwritten
+    //! by its next call. Prefer view<T>() which also checks the size in
+    //! release builds.
     //---------------------------------------------------------------------
     template<class T>
     T const& cast_to() const
     {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "cast_to() needs a trivially copyable type");
         assert((size_t(payloadlen) == sizeof(T)) && "incompatible size");
-        return *reinterpret_cast<const T*>(payload);
+        if (reinterpret_cast<uintptr_t>(payload) % alignof(T) == 0u)
+        {
+            return *reinterpret_cast<const T*>(payload);
+        }
+
+        thread_local std::aligned_storage_t<sizeof(T), alignof(T)> copy;
+        std::memcpy(&copy, payload, std::min(sizeof(T), size()));
+        return *std::launder(reinterpret_cast<const T*>(&copy));
     }
 };
 
+//-----------------------------------------------------------------------------
+//! \brief Copy the payload into a string. The string is owned by the calling
+//! thread and is overwritten by its next call. Prefer str() which does not
+//! copy.
 //-----------------------------------------------------------------------------
 template<>
 inline std::string const& Message::cast_to<std::string>() const
 {
-    static std::string msg;
+    thread_local std::string msg;
 
-    msg = static_cast<const char*>(payload);
+    msg = str();
     return msg;
 }
 
+class PublishBatch;
+class StreamSource;
+class CaptureLog;
+class DispatchBenchmark;
+
 // ****************************************************************************
-//! \brief Base class, not thread safe, offering an asynchronous MQTT client
+//! \brief Base class, not thread safe (save publications, see below), offering
+//! an asynchronous MQTT client
 //! based on the mosquitto C lib implementing MQTT v3.1.1, v5 protocols. The
 //! MQTT protocol is based on publishing and subscribing messages on topics (aka
 //! channels). A server, called broker allows to dispatch messages to clients
@@ -173,7 +422,27 @@ inline std::string const& Message::cast_to<std::string>() const
 //!
 //! Mostly of methods of this API return true in case of success or return false
 //! in case of failure and for getting the reason of the failure, you shall call
-//! error() (to get the human readable message error().message).
+//! error() (to get the human readable message error().message). Failures
+//! detected by the wrapper are compared with an Error (client.error() ==
+//! Error::PublishQueueFull) and mosquittoError() gives their MOSQ_ERR_XXX code.
+//!
+//! By default, callbacks reacting to received messages are called by the
+//! network thread of the mosquitto lib: a slow callback delays the processing
+//! of the MQTT protocol (ping, acknowledgements ...). Set Settings::delivery to
+//! Delivery::Queued to make the network thread only push received messages in
+//! a bounded lock-free queue: messages are then given to callbacks by consumer
+//! threads (Settings::consumer_threads) or by the thread calling poll(). Set
+//! it to Delivery::Ordered to spread messages over a pool of worker threads
+//! while keeping in order the messages of a same topic (or of a same key given
+//! by Settings::ordering_key).
+//!
+//! Set Settings::publish_queue to make publish() thread safe: producer threads
+//! copy their messages in a bounded lock-free queue of preallocated slots and
+//! a single thread sends them to the mosquitto lib by batches: a thread of the
+//! client with Loop::Threaded, or onWritable() and onTick() with Loop::Manual.
+//! Errors returned by error() belong to the client and the calling thread, like
+//! errno; lastError() returns the last one of any thread. Other methods,
+//! including publish(PublishBatch&), are still to be called by one thread.
 //!
 //! Since this class wraps the mosquitto lib, you can access to C fucntions
 //! thanks to the getter mosquitto(). See
@@ -210,6 +479,84 @@ public:
         Cleanup
     };
 
+    //-------------------------------------------------------------------------
+    //! \brief What happens to subscriptions when the connection is lost?
+    //-------------------------------------------------------------------------
+    enum class Reconnection
+    {
+        //! \brief Subscriptions and connection callbacks are forgotten: they
+        //! shall be made again once connected.
+        Manual,
+        //! \brief Subscriptions and connection callbacks are kept. Topics are
+        //! subscribed again on reconnection, in one SUBSCRIBE per QoS and
+        //! options, unless the broker preserved the session. Reconnections
+        //! are delayed by a growing and randomized delay.
+        Managed
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Which thread gives received messages to callbacks?
+    //-------------------------------------------------------------------------
+    enum class Delivery
+    {
+        //! \brief Callbacks are called by the mosquitto network thread.
+        Direct,
+        //! \brief The network thread pushes messages in a queue drained by
+        //! consumer threads or by poll().
+        Queued,
+        //! \brief The network thread pushes messages in the queue of one of
+        //! the worker threads selected by the hash of their ordering key:
+        //! messages with the same key are processed in order.
+        Ordered
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Where go published messages whose topic matches a subscription
+    //! of the same client?
+    //-------------------------------------------------------------------------
+    enum class Loopback
+    {
+        //! \brief To the broker only, which sends them back.
+        Broker,
+        //! \brief To the callbacks of the matching subscriptions only, from
+        //! the publishing thread (or through the queue of received messages
+        //! with Delivery::Queued and Delivery::Ordered). Other clients
+        //! subscribed on the broker do not receive them.
+        Local,
+        //! \brief To the callbacks and to the broker. With MQTT v5 the
+        //! subscriptions are made with the No Local option so the broker does
+        //! not send them back; with older versions they are received twice.
+        Both
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief What the network thread does when the queue of received messages
+    //! is full (Delivery::Queued or Delivery::Ordered).
+    //-------------------------------------------------------------------------
+    enum class Backpressure
+    {
+        //! \brief Remove the oldest message from the queue.
+        DropOldest,
+        //! \brief Drop the received message.
+        DropNewest,
+        //! \brief Wait for room in the queue. The socket is no longer read
+        //! meanwhile, so the broker is slowed down by TCP flow control. With
+        //! Loop::Manual, wantRead() tells when to stop watching the socket;
+        //! with the network thread of the client (Connection settings) pings
+        //! and acknowledgements are still sent while waiting. The network
+        //! thread of the mosquitto lib cannot do that: it is blocked in the
+        //! reception callback and the broker may drop the connection when
+        //! the consumers are late longer than the keepalive.
+        Block
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the key of the message used for selecting its worker
+    //! thread (Delivery::Ordered). Messages with equal keys are processed in
+    //! order.
+    //-------------------------------------------------------------------------
+    using OrderingKey = std::function<size_t(Message const& message)>;
+
     //-------------------------------------------------------------------------
     //! \brief Settings used for the creation of MQTT client.
     //-------------------------------------------------------------------------
@@ -223,6 +570,183 @@ public:
         //! \brief Will the broker reserve or clean all client messages and
         //! subscriptions when the client disconnect.
         Session session = Session::Cleanup;
+        //! \brief What happens to subscriptions when the connection is lost.
+        Reconnection reconnection = Reconnection::Manual;
+        //! \brief Reconnection::Managed: delay before the first reconnection.
+        //! Each disconnection draws a delay between once and twice this
+        //! value, so clients disconnected at the same time do not reconnect
+        //! at once. Failed attempts grow it quadratically.
+        std::chrono::seconds reconnect_delay = std::chrono::seconds(1);
+        //! \brief Reconnection::Managed: maximum delay between reconnections.
+        std::chrono::seconds reconnect_delay_max = std::chrono::seconds(60);
+        //! \brief Which thread gives received messages to callbacks.
+        Delivery delivery = Delivery::Direct;
+        //! \brief Maximum number of queued received messages (per worker
+        //! thread for Delivery::Ordered).
+        size_t queue_capacity = 4096u;
+        //! \brief Behavior when a queue is full.
+        Backpressure backpressure = Backpressure::Block;
+        //! \brief Delivery::Queued: number of threads draining the queue. Set 0
+        //! to drain it by calling poll() from your own thread. With more than
+        //! one thread, messages of a same topic may be processed out of order.
+        //! Delivery::Ordered: number of worker threads (at least 1).
+        size_t consumer_threads = 0u;
+        //! \brief Key of messages for Delivery::Ordered. Set nullptr to use
+        //! the topic name.
+        OrderingKey ordering_key = nullptr;
+        //! \brief Short-circuit of published messages matching a
+        //! subscription of the client.
+        Loopback loopback = Loopback::Broker;
+        //! \brief Maximum number of QoS 1 and QoS 2 messages being sent
+        //! at once, the next ones being queued by the mosquitto lib. Set 0
+        //! for no limit.
+        size_t max_inflight_messages = 20u;
+        //! \brief Compression of published payloads (see Compression.hpp).
+        //! With MQTT v5, received payloads marked as compressed are
+        //! decompressed whatever this setting.
+        Compression compression = Compression::None;
+        //! \brief Payloads smaller than this number of bytes are not
+        //! compressed.
+        size_t compression_threshold = 1024u;
+        //! \brief Compression level, 0 for the default of the algorithm.
+        int compression_level = 0;
+        //! \brief MQTT v3.1.1: decompress received payloads starting with the
+        //! magic number of a zstd or LZ4 frame. Off by default: a plain
+        //! payload starting with the same bytes would be corrupted.
+        bool compression_sniffing = false;
+        //! \brief MQTT v5: maximum number of QoS 1 and QoS 2 messages the
+        //! broker may send before their acknowledgement (Receive Maximum).
+        //! Set 0 for the default of the mosquitto lib (20).
+        uint16_t receive_maximum = 0u;
+        //! \brief MQTT v5: size of the biggest packet accepted from the broker
+        //! (Maximum Packet Size). Set 0 for no limit.
+        uint32_t maximum_packet_size = 0u;
+        //! \brief MQTT v5: maximum number of topic aliases replacing the names
+        //! of topics of QoS 0 publications, within the limit of the broker
+        //! (Topic Alias Maximum). Set 0 for disabling aliases.
+        uint16_t topic_aliases = 65535u;
+        //! \brief Existing directory of the persistent queue (see
+        //! OfflineQueue.hpp) storing messages published while not connected,
+        //! sent after the connection. Leave empty for failing these
+        //! publications instead. MQTT v5 properties of queued messages are
+        //! not kept.
+        std::string offline_directory{};
+        //! \brief Size of the segment files of the offline queue in bytes.
+        size_t offline_segment_size = 4u * 1024u * 1024u;
+        //! \brief Maximum size of the offline queue on disk in bytes. The
+        //! oldest messages are dropped beyond.
+        size_t offline_capacity = 64u * 1024u * 1024u;
+        //! \brief Number of queued messages sent in a row after connection.
+        size_t offline_batch = 100u;
+        //! \brief Maximum number of queued messages sent per second after
+        //! connection. Set 0 for no limit.
+        size_t offline_rate = 1000u;
+        //! \brief Maximum number of topics whose latest received payload is
+        //! kept by the cache (see cache()). Set 0 for disabling the cache.
+        size_t cache_topics = 0u;
+        //! \brief Payloads bigger than this size in bytes are not cached.
+        size_t cache_max_payload = 65536u;
+        //! \brief Number of messages of the queue making publish() thread
+        //! safe (see Client). Set 0 for sending from the calling thread.
+        size_t publish_queue = 0u;
+        //! \brief Bytes of payload preallocated per message of the publish
+        //! queue. Bigger payloads make their slot grow once.
+        size_t publish_slot_size = 256u;
+        //! \brief Number of priority lanes of the publish queue, the lane 0
+        //! being the most urgent. The lane of a topic is given by
+        //! publish_rules.
+        size_t publish_lanes = 1u;
+        //! \brief Number of messages sent from each lane per round. Leave
+        //! empty for a strict priority: a lane is drained only while the more
+        //! urgent ones are empty or waiting for their rate limit.
+        std::vector<size_t> publish_weights{};
+        //! \brief Rate limit of all published messages. With the publish
+        //! queue, messages exceeding a limit wait in their lane; without it,
+        //! publish() fails at once (see wouldExceed()).
+        RateLimit publish_limit{};
+        //! \brief Lanes and rate limits of topics by prefix.
+        std::vector<PublishRule> publish_rules{};
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Limits of the broker given by CONNACK (MQTT v5). Defaults of the
+    //! protocol for older versions.
+    //-------------------------------------------------------------------------
+    struct Capabilities
+    {
+        //! \brief Maximum number of QoS 1 and QoS 2 messages sent and not yet
+        //! acknowledged. The mosquitto lib queues the next ones.
+        uint16_t receive_maximum = 65535u;
+        //! \brief Size of the biggest packet accepted, 0 for no limit.
+        uint32_t maximum_packet_size = 0u;
+        //! \brief Maximum number of topic aliases, 0 if not supported.
+        uint16_t topic_alias_maximum = 0u;
+        //! \brief Greatest QoS supported.
+        uint8_t maximum_qos = 2u;
+        //! \brief Are retained messages supported?
+        bool retain_available = true;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief MQTT v5 properties of a publication.
+    //-------------------------------------------------------------------------
+    struct PublishProperties
+    {
+        //! \brief Lifetime of the message in the broker, for subscribers not
+        //! yet received it. 0 for no expiry.
+        std::chrono::seconds expiry{0};
+        //! \brief MIME type of the payload, not sent if empty.
+        std::string content_type;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief When does the broker send retained messages on subscription?
+    //-------------------------------------------------------------------------
+    enum class RetainHandling
+    {
+        SendAlways = MQTT_SUB_OPT_SEND_RETAIN_ALWAYS,
+        SendNew = MQTT_SUB_OPT_SEND_RETAIN_NEW,
+        SendNever = MQTT_SUB_OPT_SEND_RETAIN_NEVER
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief MQTT v5 options of a subscription.
+    //-------------------------------------------------------------------------
+    struct SubscriptionOptions
+    {
+        //! \brief Do not receive the messages published by this client.
+        bool no_local = false;
+        //! \brief Keep the retain flag of forwarded messages.
+        bool retain_as_published = false;
+        //! \brief Sending of retained messages.
+        RetainHandling retain_handling = RetainHandling::SendAlways;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Who runs the network loop (reading and writing the socket,
+    //! keeping alive the connection)?
+    //-------------------------------------------------------------------------
+    enum class Loop
+    {
+        //! \brief A thread started by the mosquitto lib on connection.
+        Threaded,
+        //! \brief Your own event loop (epoll, io_uring, ...): watch socket()
+        //! and call onReadable(), onWritable() and onTick(). No thread is
+        //! created.
+        Manual
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Scheduling policy of the network thread.
+    //-------------------------------------------------------------------------
+    enum class Scheduling
+    {
+        //! \brief Keep the policy of the process.
+        Default,
+        //! \brief Real-time first in, first out (SCHED_FIFO). Needs privileges.
+        Fifo,
+        //! \brief Real-time round robin (SCHED_RR). Needs privileges.
+        RoundRobin
     };
 
     //-------------------------------------------------------------------------
@@ -236,6 +760,46 @@ public:
         size_t port = 1883;
         //! \brief Connection timeout in seconds.
         std::chrono::seconds timeout = std::chrono::seconds(60);
+        //! \brief Who runs the network loop.
+        Loop loop = Loop::Threaded;
+        //! \brief Disable the Nagle algorithm: small packets are sent at once
+        //! instead of being gathered.
+        bool tcp_nodelay = false;
+        //! \brief Core the network thread is pinned to (Loop::Threaded, Linux
+        //! only). Set -1 for any core.
+        int cpu = -1;
+        //! \brief Scheduling policy of the network thread (Loop::Threaded).
+        Scheduling scheduling = Scheduling::Default;
+        //! \brief Priority of the real-time scheduling policies.
+        int priority = 0;
+        //! \brief Poll the socket without sleeping (Loop::Threaded): lowest
+        //! latency at the cost of a busy core.
+        bool busy_poll = false;
+        //! \brief TLS of the connection, disabled by default.
+        Tls tls{};
+        //! \brief Return from connect() once the address is resolved, without
+        //! waiting for the TCP handshake (Loop::Threaded): the connection is
+        //! completed by the network thread and notified by the connection
+        //! callback, or by the disconnection callback on failure. Ignored with
+        //! MQTT v5 when Settings::maximum_packet_size is set.
+        bool async = false;
+
+        //---------------------------------------------------------------------
+        //! \brief Return the settings for the lowest latency: no Nagle
+        //! algorithm and a network thread pinned to the given core, polling
+        //! the socket.
+        //---------------------------------------------------------------------
+        static Connection lowLatency(std::string const& address, size_t const port,
+                                     int const cpu = -1)
+        {
+            Connection connection;
+            connection.address = address;
+            connection.port = port;
+            connection.tcp_nodelay = true;
+            connection.cpu = cpu;
+            connection.busy_poll = true;
+            return connection;
+        }
     };
 
     //-------------------------------------------------------------------------
@@ -246,7 +810,7 @@ public:
         //! \brief Return the mosquitto C library version.
         int mosquitto[3] = {0, 0, 0};
         //! \brief Return the C++ wrapper version.
-        int wrapper[3] = {0, 2, 0};
+        int wrapper[3] = {0, 3, 0};
         //! \brief Protocol version.
         int protocol[3] = {0, 0, 0};
     };
@@ -262,13 +826,82 @@ public:
     //-------------------------------------------------------------------------
     using ConnectionCallback = std::function<void(int rc)>;
 
+    //-------------------------------------------------------------------------
+    //! \brief Callback triggered once when the broker acknowledges a request.
+    //! \param[in] rc MOSQ_ERR_SUCCESS for an acknowledged publication or
+    //! unsubscription, the granted QoS for a subscription (0x80 and above if
+    //! refused), the CONNACK code for a connection, or MOSQ_ERR_CONN_LOST if
+    //! the connection was lost before the acknowledgement.
+    //-------------------------------------------------------------------------
+    using AckCallback = std::function<void(int rc)>;
+
+    //-------------------------------------------------------------------------
+    //! \brief Awaitable result of co_connect(), co_subscribe(), co_unsubscribe()
+    //! and co_publish() for C++20 coroutines. The coroutine is suspended until
+    //! the broker acknowledges the request (CONNACK, SUBACK, UNSUBACK, PUBACK
+    //! or PUBCOMP) and is resumed by the mosquitto network thread. The result
+    //! of co_await is the rc given to AckCallback, or the error code if the
+    //! request could not be sent.
+    //! \code
+    //!   int rc = co_await client.co_publish(topic, payload, QoS::QoS1);
+    //! \endcode
+    //-------------------------------------------------------------------------
+    class Acknowledgement
+    {
+    public:
+
+        bool await_ready() const noexcept { return false; }
+
+        template<class Handle>
+        bool await_suspend(Handle handle)
+        {
+            m_address = handle.address();
+            m_resume = [](void* address) { Handle::from_address(address).resume(); };
+            return start();
+        }
+
+        int await_resume() const noexcept { return m_rc; }
+
+    private:
+
+        friend class Client;
+
+        enum class Request { Connect, Subscribe, Unsubscribe, Publish };
+
+        Acknowledgement(Client& client, Request const request)
+            : m_client(client), m_request(request)
+        {}
+
+        //! \brief Send the request. Return false if it failed and the
+        //! coroutine shall not be suspended.
+        bool start();
+
+        Client& m_client;
+        Request m_request;
+        Connection m_connection;
+        Topic* m_topic = nullptr;
+        ReceptionCallback m_callback = nullptr;
+        uint8_t const* m_payload = nullptr;
+        size_t m_size = 0u;
+        QoS m_qos = QoS::QoS0;
+        int m_rc = MOSQ_ERR_SUCCESS;
+        void* m_address = nullptr;
+        void (*m_resume)(void*) = nullptr;
+    };
+
     //-------------------------------------------------------------------------
     //! \brief Initialize the mosquitto library and create a handle of the C
     //! lib.
     //! \param[in] settings configure the MQTT client: client id, MQTT protocol
     //! version, cleanup or preserver message on deconnection.
     //-------------------------------------------------------------------------
-    Client(Client::Settings const& settings = {"", Protocol::V5, Session::Cleanup});
+    Client(Client::Settings const& settings);
+
+    //-------------------------------------------------------------------------
+    //! \brief Initialize the mosquitto library and create a handle of the C
+    //! lib with default settings (random client id, MQTT v5, cleanup session).
+    //-------------------------------------------------------------------------
+    Client();
 
     //-------------------------------------------------------------------------
     //! \brief Release memory. Clean up of the mosquitto library if no other
@@ -286,11 +919,23 @@ public:
     //-------------------------------------------------------------------------
     Client::Status status() const { return m_status; }
 
+    //! \brief Number of clients of which a thread remembers its error().
+    static constexpr size_t THREAD_CLIENTS = 8u;
+
     //-------------------------------------------------------------------------
-    //! \brief Return the last error. To be used when a method of the API has
-    //! returned false.
+    //! \brief Return the last error of the client on the calling thread, like
+    //! errno. To be used when a method of the API has returned false.
+    //! \note A thread remembers its errors on the THREAD_CLIENTS last clients
+    //! it failed on: older ones are forgotten and reported as success.
     //-------------------------------------------------------------------------
-    std::error_code const& error() const { return m_error; }
+    std::error_code error() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the last error of the client on any thread, including
+    //! its own threads (network, forwarding of the publish queue, replay of
+    //! the offline queue).
+    //-------------------------------------------------------------------------
+    std::error_code lastError() const;
 
     //-------------------------------------------------------------------------
     //! \brief Return human readable message depending on the error code.
@@ -311,12 +956,88 @@ public:
                  Client::ConnectionCallback onConnected = nullptr,
                  Client::ConnectionCallback onDisconnected = nullptr);
 
+    //-------------------------------------------------------------------------
+    //! \brief Connect many clients to the same broker in parallel, for
+    //! instance a simulated fleet: connections are started asynchronously
+    //! (Connection::async) while less than the given number of them are being
+    //! established, then the function waits for the last ones. Without TLS,
+    //! the address is resolved once for all clients, and their reconnections
+    //! use the resolved address. Clients shall use Loop::Threaded.
+    //! \param[in] concurrency the maximum number of connections being
+    //! established at once (at least 1).
+    //! \param[in] timeout the maximum duration for connecting all clients.
+    //! \param[in] onConnected, onDisconnected callbacks given to each client
+    //! like for connect().
+    //! \return the number of clients connected before the timeout. Failures
+    //! of clients are given by error() of the calling thread.
+    //-------------------------------------------------------------------------
+    static size_t connectAll(std::vector<Client*> const& clients,
+                             Connection const& settings,
+                             size_t const concurrency = 256u,
+                             std::chrono::milliseconds const timeout = std::chrono::seconds(30),
+                             Client::ConnectionCallback onConnected = nullptr,
+                             Client::ConnectionCallback onDisconnected = nullptr);
+
     //-------------------------------------------------------------------------
     //! \brief Disconnect from the broker. The callback onConnected() or the
     //! lambda will be called depending on parameter passed to connect().
     //-------------------------------------------------------------------------
     bool disconnect();
 
+    //-------------------------------------------------------------------------
+    //! \brief Reconnect to the broker with the settings given to connect().
+    //! To be used with Loop::Manual when onReadable() or onWritable() report
+    //! the loss of the connection (Loop::Threaded reconnects by itself).
+    //-------------------------------------------------------------------------
+    bool reconnect();
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the socket connected to the broker, or -1 if not
+    //! connected. With Loop::Manual, watch it in your event loop: call
+    //! onReadable() when readable and onWritable() when writable.
+    //-------------------------------------------------------------------------
+    int socket() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return true if the kernel encrypts the records sent to the
+    //! broker (Tls::kernel_offload). To be called once connected.
+    //-------------------------------------------------------------------------
+    bool tlsOffloaded() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return true if data are waiting to be written on the socket
+    //! (Loop::Manual): watch the socket for writability.
+    //-------------------------------------------------------------------------
+    bool wantWrite() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return false when the socket shall not be read for now
+    //! (Loop::Manual) because a queue of received messages is full and the
+    //! backpressure is Backpressure::Block: stop watching the socket for
+    //! readability until poll() or consumer threads make room.
+    //-------------------------------------------------------------------------
+    bool wantRead() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Read and process incoming packets (Loop::Manual). Callbacks of
+    //! received messages are called from here for Delivery::Direct.
+    //! \return false if an error occured (ie the connection is lost).
+    //-------------------------------------------------------------------------
+    bool onReadable();
+
+    //-------------------------------------------------------------------------
+    //! \brief Write pending outgoing packets (Loop::Manual).
+    //! \return false if an error occured (ie the connection is lost).
+    //-------------------------------------------------------------------------
+    bool onWritable();
+
+    //-------------------------------------------------------------------------
+    //! \brief Housekeeping (Loop::Manual): keep alive ping and retries of
+    //! messages. Call it about once per second.
+    //! \return false if an error occured.
+    //-------------------------------------------------------------------------
+    bool onTick();
+
     //-------------------------------------------------------------------------
     //! \brief Subscription to given topic with quality of service and optional
     //! callback reacting to incoming message for the given topic.
@@ -325,7 +1046,9 @@ public:
     //! \param[in] onMessageReceived lambda function used as callback called when
     //! a new message has been received from the MQTT broker. Set it to nullptr
     //! to force calling override method onConnected() instead.
-    //! \param[in] topic the desired topic.
+    //! \param[in] topic the desired topic. Its name may contains the wildcards
+    //! '+' and '#'. A message matching several subscriptions is given to the
+    //! callback of each of them.
     //! \param[in] qos the desired quality of service.
     //! \return true if not internal error occured, else return false.
     //-------------------------------------------------------------------------
@@ -339,6 +1062,125 @@ public:
     //-------------------------------------------------------------------------
     bool unsubscribe(Topic& topic);
 
+    //-------------------------------------------------------------------------
+    //! \brief Same as subscribe() with MQTT v5 subscription options.
+    //-------------------------------------------------------------------------
+    bool subscribe(Topic& topic, QoS const qos,
+                   Client::SubscriptionOptions const& options,
+                   Client::ReceptionCallback onMessageReceived = nullptr);
+
+    //-------------------------------------------------------------------------
+    //! \brief Same as subscribe() with a delivery policy (rate limit,
+    //! deduplication, conflation) applied to each matching topic by the
+    //! network thread, before messages are queued (Delivery::Queued and
+    //! Delivery::Ordered) or given to the callback. Conflated messages are
+    //! delivered once per period by a thread of the client, or by onTick()
+    //! with Loop::Manual.
+    //-------------------------------------------------------------------------
+    bool subscribe(Topic& topic, QoS const qos, ReceptionPolicy const& policy,
+                   Client::ReceptionCallback onMessageReceived);
+
+    //-------------------------------------------------------------------------
+    //! \brief Same as subscribe() but also call onAcknowledged once when the
+    //! broker acknowledges the subscription (SUBACK). The callback is called
+    //! by the network thread.
+    //-------------------------------------------------------------------------
+    bool subscribe(Topic& topic, QoS const qos,
+                   Client::ReceptionCallback onMessageReceived,
+                   Client::AckCallback onAcknowledged);
+
+    //-------------------------------------------------------------------------
+    //! \brief Same as unsubscribe() but also call onAcknowledged once when the
+    //! broker acknowledges the unsubscription (UNSUBACK).
+    //-------------------------------------------------------------------------
+    bool unsubscribe(Topic& topic, Client::AckCallback onAcknowledged);
+
+    //-------------------------------------------------------------------------
+    //! \brief Subscription to many topics at once with the same quality of
+    //! service and callback: topics are sent in as few SUBSCRIBE packets as
+    //! allowed by the maximum packet size of the broker, instead of one per
+    //! topic. The id of each topic is set to the id of its packet.
+    //! \return false if a packet could not be sent: topics of the previous
+    //! packets are subscribed.
+    //-------------------------------------------------------------------------
+    bool subscribe(std::vector<Topic>& topics, QoS const qos,
+                   Client::ReceptionCallback onMessageReceived = nullptr);
+
+    //-------------------------------------------------------------------------
+    //! \brief Same as subscribe() of many topics but also call onAcknowledged
+    //! once when the broker has acknowledged all packets, with the greatest
+    //! code of their SUBACK (ie 0x80 if a topic has been refused).
+    //-------------------------------------------------------------------------
+    bool subscribe(std::vector<Topic>& topics, QoS const qos,
+                   Client::ReceptionCallback onMessageReceived,
+                   Client::AckCallback onAcknowledged);
+
+    //-------------------------------------------------------------------------
+    //! \brief Remove the subscription of many topics, in as few UNSUBSCRIBE
+    //! packets as possible.
+    //-------------------------------------------------------------------------
+    bool unsubscribe(std::vector<Topic>& topics);
+
+    //-------------------------------------------------------------------------
+    //! \brief Same as unsubscribe() of many topics but also call
+    //! onAcknowledged once when the broker has acknowledged all packets.
+    //-------------------------------------------------------------------------
+    bool unsubscribe(std::vector<Topic>& topics, Client::AckCallback onAcknowledged);
+
+    //-------------------------------------------------------------------------
+    //! \brief Same as publish() but also call onAcknowledged once when the
+    //! message has been sent (QoS0) or acknowledged by the broker (PUBACK for
+    //! QoS1, PUBCOMP for QoS2). The callback is called by the network thread.
+    //! The message is never stored in the offline queue. With the publish
+    //! queue, onAcknowledged is also called with the error code if sending
+    //! the dequeued message fails.
+    //-------------------------------------------------------------------------
+    bool publish(Topic& topic, uint8_t const* payload, size_t const size,
+                 QoS const qos, Client::AckCallback onAcknowledged);
+
+    //-------------------------------------------------------------------------
+    //! \brief Awaitable connection: resumes on CONNACK with its code.
+    //-------------------------------------------------------------------------
+    Acknowledgement co_connect(Connection const& settings);
+
+    //-------------------------------------------------------------------------
+    //! \brief Awaitable subscription: resumes on SUBACK with the granted QoS.
+    //-------------------------------------------------------------------------
+    Acknowledgement co_subscribe(Topic& topic, QoS const qos,
+                                 Client::ReceptionCallback onMessageReceived = nullptr);
+
+    //-------------------------------------------------------------------------
+    //! \brief Awaitable unsubscription: resumes on UNSUBACK.
+    //-------------------------------------------------------------------------
+    Acknowledgement co_unsubscribe(Topic& topic);
+
+    //-------------------------------------------------------------------------
+    //! \brief Awaitable publication: resumes once the message is sent (QoS0)
+    //! or acknowledged (QoS1, QoS2). The payload is copied by the mosquitto
+    //! lib before the coroutine is suspended.
+    //-------------------------------------------------------------------------
+    Acknowledgement co_publish(Topic& topic, uint8_t const* payload,
+                               size_t const size, QoS const qos);
+
+    //-------------------------------------------------------------------------
+    //! \brief Awaitable publication of a vector of bytes.
+    //-------------------------------------------------------------------------
+    Acknowledgement co_publish(Topic& topic, std::vector<uint8_t> const& payload,
+                               QoS const qos)
+    {
+        return co_publish(topic, payload.data(), payload.size(), qos);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Awaitable publication of a string.
+    //-------------------------------------------------------------------------
+    Acknowledgement co_publish(Topic& topic, std::string const& payload,
+                               QoS const qos)
+    {
+        return co_publish(topic, reinterpret_cast<uint8_t const*>(payload.c_str()),
+                          payload.size() + 1u, qos);
+    }
+
     //-------------------------------------------------------------------------
     //! \brief Send a string message to the given topic with using a desired
     //! quality of service.
@@ -367,6 +1209,205 @@ public:
     //-------------------------------------------------------------------------
     bool publish(Topic& topic, uint8_t const* payload, size_t const size, QoS const qos);
 
+    //-------------------------------------------------------------------------
+    //! \brief Same as publish() with MQTT v5 properties (message expiry,
+    //! content type).
+    //-------------------------------------------------------------------------
+    bool publish(Topic& topic, uint8_t const* payload, size_t const size,
+                 QoS const qos, Client::PublishProperties const& properties);
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a message on a topic checked once (see TopicHandle).
+    //! \return false if the handle is not valid or the message cannot be
+    //! sent.
+    //-------------------------------------------------------------------------
+    bool publish(TopicHandle& topic, uint8_t const* payload, size_t const size,
+                 QoS const qos);
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a string message on a topic checked once.
+    //-------------------------------------------------------------------------
+    bool publish(TopicHandle& topic, std::string const& payload, QoS const qos)
+    {
+        return publish(topic, reinterpret_cast<uint8_t const*>(payload.c_str()),
+                       payload.size() + 1u, qos);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a vector of bytes on a topic checked once.
+    //-------------------------------------------------------------------------
+    bool publish(TopicHandle& topic, std::vector<uint8_t> const& payload,
+                 QoS const qos)
+    {
+        return publish(topic, payload.data(), payload.size(), qos);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a message on a topic formatted by a TopicPattern. The name
+    //! is copied in a buffer kept by the calling thread: no memory is
+    //! allocated once the longest name has been published.
+    //-------------------------------------------------------------------------
+    template<size_t N>
+    bool publish(TopicBuffer<N> const& topic, uint8_t const* payload,
+                 size_t const size, QoS const qos, bool const retain = false)
+    {
+        return publishTo(topic.str(), payload, size, qos, retain);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the limits of the broker given on connection.
+    //-------------------------------------------------------------------------
+    Client::Capabilities capabilities() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Send all messages of the batch, in order. Messages are checked
+    //! once, before sending the first one. Sent messages are removed from the
+    //! batch: in case of failure, the batch holds the messages not sent yet.
+    //! With Settings::publish_queue, messages are queued in their lane like
+    //! by publish().
+    //! \param[inout] batch the messages to send (see PublishBatch.hpp).
+    //! \return true if all messages have been sent, else return false.
+    //-------------------------------------------------------------------------
+    bool publish(PublishBatch& batch);
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a large payload as chunks on the sub-topic "<topic>/chunk"
+    //! (see Stream.hpp), with at most StreamSettings::window chunks not yet
+    //! acknowledged. The first chunks are sent from here, the next ones by
+    //! the network thread as acknowledgements arrive.
+    //! \param[inout] stream the payload, kept alive until completed.
+    //! \param[in] onCompleted called once, with MOSQ_ERR_SUCCESS when all
+    //! chunks have been acknowledged or with the first error. It may be
+    //! called before returning.
+    //! \return false if the stream failed before returning.
+    //-------------------------------------------------------------------------
+    bool publish(Topic& topic, StreamSource& stream, QoS const qos,
+                 Client::AckCallback onCompleted = nullptr);
+
+    //-------------------------------------------------------------------------
+    //! \brief Publish a value encoded by Codec<T> (see Codec.hpp): trivially
+    //! copyable types are sent as they are, types with a Layout have their
+    //! fields sent in little endian.
+    //! \param[in] topic the topic to send the message on.
+    //! \param[in] value the value to send.
+    //! \param[in] qos the quality of service.
+    //! \return true if not internal error occured, else return false.
+    //-------------------------------------------------------------------------
+    template<class T, class = std::enable_if_t<IsEncodable<T>::value>>
+    bool publish(Topic& topic, T const& value, QoS const qos)
+    {
+        if constexpr (IsZeroCopy<T>::value)
+        {
+            return publish(topic, reinterpret_cast<uint8_t const*>(&value),
+                           sizeof(T), qos);
+        }
+        else
+        {
+            // The mosquitto lib copies the payload: the buffer can be reused.
+            thread_local std::vector<uint8_t> buffer;
+            buffer.resize(Codec<T>::size(value));
+            Codec<T>::encode(value, buffer.data());
+            return publish(topic, buffer.data(), buffer.size(), qos);
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Give queued received messages to their callbacks from the
+    //! calling thread. To be used with Delivery::Queued and no consumer thread.
+    //! Does nothing for Delivery::Direct.
+    //! \param[in] max the maximum number of messages to process.
+    //! \return the number of processed messages.
+    //-------------------------------------------------------------------------
+    size_t poll(size_t const max = std::numeric_limits<size_t>::max());
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of received messages dropped because a queue
+    //! was full.
+    //-------------------------------------------------------------------------
+    size_t dropped() const { return m_inbound.dropped.load(std::memory_order_relaxed); }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of QoS 1 and QoS 2 messages sent and not yet
+    //! acknowledged by the broker.
+    //-------------------------------------------------------------------------
+    size_t inflight() const { return m_inflight.size(); }
+
+    //-------------------------------------------------------------------------
+    //! \brief Would a message published now on the topic exceed the rate
+    //! limits (Settings::publish_limit and Settings::publish_rules)? Does not
+    //! block, for producers shedding load themselves.
+    //-------------------------------------------------------------------------
+    bool wouldExceed(std::string_view const topic) const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return for how long the oldest message not yet acknowledged by
+    //! the broker has been waiting (0 if there is none). A growing value means
+    //! the broker or the network is stuck.
+    //-------------------------------------------------------------------------
+    std::chrono::nanoseconds oldestInflight() const { return m_inflight.oldest(); }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the histogram of the durations between publishing a
+    //! message and receiving its acknowledgement (PUBACK for QoS 1, PUBCOMP
+    //! for QoS 2). Empty for QoS 0.
+    //-------------------------------------------------------------------------
+    LatencyHistogram const& ackLatency(QoS const qos) const
+    {
+        return m_inflight.latency(int(qos));
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the current values of the runtime counters: received and
+    //! published messages and bytes, time spent in callbacks, reconnections,
+    //! failed publications, queued and in-flight messages. The snapshot can be
+    //! formatted for Prometheus or StatsD (see Metrics.hpp).
+    //-------------------------------------------------------------------------
+    Metrics::Snapshot metrics() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of messages of the offline queue waiting for
+    //! being sent.
+    //-------------------------------------------------------------------------
+    size_t offline() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of messages dropped by the offline queue
+    //! because it was full.
+    //-------------------------------------------------------------------------
+    size_t offlineDropped() const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the cache of the latest payload received for each topic,
+    //! readable from any thread without lock. Empty if Settings::cache_topics
+    //! is 0. Payloads are cached after decompression and before delivery
+    //! policies.
+    //-------------------------------------------------------------------------
+    TopicCache const& cache() const
+    {
+        return m_cache;
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Append every received message to the given log (see
+    //! Capture.hpp), as received from the broker (before decompression and
+    //! delivery policies) and timestamped by the system clock. The log can be
+    //! shared by several clients and shall outlive the capture. Pass nullptr
+    //! for stopping the capture.
+    //-------------------------------------------------------------------------
+    void capture(CaptureLog* log)
+    {
+        m_capture.store(log, std::memory_order_release);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Register a zstd dictionary (trained with zstd --train) used for
+    //! compressing and decompressing payloads of topics starting with the
+    //! given prefix. To be called before connecting.
+    //! \return false if zstd is not compiled in or the dictionary is invalid.
+    //-------------------------------------------------------------------------
+    bool addDictionary(std::string const& prefix,
+                       std::vector<uint8_t> const& dictionary);
+
 protected:
 
     struct mosquitto* mosquitto() { return m_mosquitto; }
@@ -430,26 +1471,339 @@ private:
 
 private:
 
+    //! \brief Gives synthetic messages to the received message callback,
+    //! without broker (benchmark/DispatchBenchmark.cpp).
+    friend class DispatchBenchmark;
+
     bool instantiate(char const* client_id, const bool clean_session);
 
+    //-------------------------------------------------------------------------
+    //! \brief Give the received message to the callbacks of the matching
+    //! subscriptions, or to onMessageReceived() if none has a callback.
+    //-------------------------------------------------------------------------
+    void dispatch(Message const& message);
+
+    //-------------------------------------------------------------------------
+    //! \brief Subscription with a delivery policy.
+    //-------------------------------------------------------------------------
+    struct Filtered
+    {
+        Filtered(std::string const& filter_, ReceptionPolicy const& policy_,
+                 Client::ReceptionCallback&& callback_)
+            : filter(filter_), policy(policy_),
+              callback(std::make_shared<Client::ReceptionCallback const>(
+                  std::move(callback_)))
+        {}
+
+        std::string filter;
+        ReceptionFilter policy;
+        std::shared_ptr<Client::ReceptionCallback const> callback;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Apply the policies of the subscriptions matching the received
+    //! message and deliver it to the ones accepting it.
+    //! \return true if the message shall also be given to dispatch().
+    //-------------------------------------------------------------------------
+    bool filter(Message const& message);
+
+    //-------------------------------------------------------------------------
+    //! \brief Give a message received, or published with a loopback, to the
+    //! cache, the delivery policies and the callbacks.
+    //-------------------------------------------------------------------------
+    void receive(Message const& message);
+
+    //-------------------------------------------------------------------------
+    //! \brief Settings::loopback: receive the published message if its topic
+    //! matches a subscription.
+    //! \return true if the message has been received.
+    //-------------------------------------------------------------------------
+    bool loopback(Topic const& topic, uint8_t const* payload, size_t const size,
+                  QoS const qos);
+
+    //-------------------------------------------------------------------------
+    //! \brief Add the No Local option to subscriptions when published messages
+    //! are looped back and sent (Loopback::Both, MQTT v5).
+    //-------------------------------------------------------------------------
+    int subscriptionFlags(int const flags) const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Give the message to the callback of a subscription with a
+    //! delivery policy.
+    //-------------------------------------------------------------------------
+    void deliver(Message const& message,
+                 std::shared_ptr<Client::ReceptionCallback const> const& callback);
+
+    //-------------------------------------------------------------------------
+    //! \brief Deliver the messages held by conflating subscriptions whose
+    //! period elapsed.
+    //-------------------------------------------------------------------------
+    void flushConflated();
+
+    //-------------------------------------------------------------------------
+    //! \brief Body of the thread calling flushConflated() (Loop::Threaded).
+    //-------------------------------------------------------------------------
+    void conflate();
+
+    //-------------------------------------------------------------------------
+    //! \brief Check the topic filter and send the SUBSCRIBE packet, updating
+    //! the last error.
+    //-------------------------------------------------------------------------
+    bool request(Topic& topic, QoS const qos, int const flags);
+
+    //-------------------------------------------------------------------------
+    //! \brief Register the callback of a subscription, replacing the previous
+    //! one of the topic filter with or without a policy.
+    //-------------------------------------------------------------------------
+    void attach(std::string const& filter, QoS const qos, int const flags,
+                Client::ReceptionCallback&& onMessageReceived);
+
+    //-------------------------------------------------------------------------
+    //! \brief Same as attach() with a delivery policy.
+    //-------------------------------------------------------------------------
+    void attach(std::string const& filter, QoS const qos,
+                ReceptionPolicy const& policy,
+                Client::ReceptionCallback&& onMessageReceived);
+
+    //-------------------------------------------------------------------------
+    //! \brief Remove the callback with a delivery policy of the topic filter,
+    //! and its conflation. To be called under the unique lock of callbacks.
+    //-------------------------------------------------------------------------
+    void dropFiltered(std::string const& filter);
+
+    //-------------------------------------------------------------------------
+    //! \brief Queued received message, given to the callbacks of matching
+    //! subscriptions, or only to the callback if not null (subscription with
+    //! a delivery policy).
+    //-------------------------------------------------------------------------
+    struct Received
+    {
+        SharedMessage message;
+        std::shared_ptr<Client::ReceptionCallback const> callback;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Queue of received messages and threads draining it.
+    //-------------------------------------------------------------------------
+    struct Lane
+    {
+        explicit Lane(size_t const capacity) : queue(capacity) {}
+
+        //! \brief The queue.
+        RingBuffer<Received> queue;
+        //! \brief Threads draining the queue.
+        std::vector<std::thread> threads;
+        //! \brief Wake up sleeping threads.
+        std::mutex mutex;
+        std::condition_variable signal;
+        //! \brief Number of sleeping threads.
+        std::atomic<size_t> sleeping{0u};
+        //! \brief Wake up the network thread waiting for room in the queue
+        //! (Backpressure::Block).
+        std::condition_variable room;
+        //! \brief Number of threads waiting for room.
+        std::atomic<size_t> blocked{0u};
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Check a message, loop it back (Settings::loopback), and send it
+    //! with transmit(), or push it in the publish queue if enabled
+    //! (onAcknowledged is then registered when the message is sent).
+    //! onAcknowledged is called at once for messages only looped back.
+    //-------------------------------------------------------------------------
+    bool post(Topic& topic, uint8_t const* payload, size_t const size,
+              QoS const qos, Client::PublishProperties const* properties,
+              bool const offline = true,
+              Client::AckCallback onAcknowledged = nullptr);
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a checked message, updating the metrics and the last
+    //! error. Queue it while not connected if offline is set and the offline
+    //! queue enabled.
+    //-------------------------------------------------------------------------
+    bool transmit(Topic& topic, uint8_t const* payload, size_t const size,
+                  QoS const qos, Client::PublishProperties const* properties,
+                  bool const offline, TopicAliases::Binding* binding = nullptr);
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a message on the topic name of a TopicBuffer.
+    //-------------------------------------------------------------------------
+    bool publishTo(std::string_view const topic, uint8_t const* payload,
+                   size_t const size, QoS const qos, bool const retain);
+
+    //-------------------------------------------------------------------------
+    //! \brief Read and send the next chunks of the stream while the window
+    //! allows, then call the completion callback once everything has been
+    //! acknowledged. Only one thread at a time pumps a stream: others return
+    //! at once, leaving the work to it.
+    //-------------------------------------------------------------------------
+    void pump(StreamSource& stream);
+
+    //-------------------------------------------------------------------------
+    //! \brief Copy a message in a free slot of the publish queue. Called by
+    //! any thread.
+    //! \return false if the queue is full.
+    //-------------------------------------------------------------------------
+    bool defer(Topic const& topic, uint8_t const* payload, size_t const size,
+               QoS const qos, Client::PublishProperties const* properties,
+               bool const offline, Client::AckCallback onAcknowledged);
+
+    //-------------------------------------------------------------------------
+    //! \brief Send the messages of the publish queue by priority and release
+    //! their slots. Called by a single thread.
+    //! \param[in] force send the messages exceeding the rate limits too.
+    //! \return the delay before messages delayed by the rate limits can be
+    //! sent, zero if none.
+    //-------------------------------------------------------------------------
+    std::chrono::nanoseconds flushOutbound(bool const force = false);
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a message of the publish queue and release its slot.
+    //-------------------------------------------------------------------------
+    void transmit(uint32_t const index);
+
+    //-------------------------------------------------------------------------
+    //! \brief Take the rate limit tokens of a message sent without the publish
+    //! queue, else set the last error.
+    //-------------------------------------------------------------------------
+    bool admit(Topic const& topic, size_t const size);
+
+    //-------------------------------------------------------------------------
+    //! \brief Body of the thread calling flushOutbound() (Loop::Threaded).
+    //-------------------------------------------------------------------------
+    void forward();
+
+    //-------------------------------------------------------------------------
+    //! \brief Shall publications go to the offline queue? Once messages are
+    //! queued, the next ones are also queued until all are sent, so they
+    //! keep their order.
+    //-------------------------------------------------------------------------
+    bool offlining() const
+    {
+        return (m_offline.queue != nullptr) &&
+               ((!m_offline.online.load(std::memory_order_acquire)) ||
+                m_offline.pending.load(std::memory_order_acquire));
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Append a message to the offline queue.
+    //-------------------------------------------------------------------------
+    bool store(Topic const& topic, uint8_t const* payload, size_t const size,
+               QoS const qos);
+
+    //-------------------------------------------------------------------------
+    //! \brief Body of the thread sending the offline queue once connected, by
+    //! batches and within the rate limit.
+    //-------------------------------------------------------------------------
+    void replay();
+
+    //-------------------------------------------------------------------------
+    //! \brief Send a message, compressed if enabled, with a topic alias if
+    //! possible, and track it if its QoS is greater than 0.
+    //! \return the mosquitto error code.
+    //-------------------------------------------------------------------------
+    int send(Topic& topic, uint8_t const* payload, size_t const size,
+             QoS const qos, Client::PublishProperties const* properties = nullptr,
+             TopicAliases::Binding* binding = nullptr);
+
+    //-------------------------------------------------------------------------
+    //! \brief Send SUBSCRIBE packets (or UNSUBSCRIBE if subscribe is false) for
+    //! the given topic filters, splitting them at the maximum packet size of
+    //! the broker.
+    //! \param[out] mids the message id of the packet of each sent filter.
+    //! \param[in] onSent if not null, called with the id and the epoch of each
+    //! sent packet for registering its acknowledgement with expect().
+    //! \return the code of the first packet not sent.
+    //-------------------------------------------------------------------------
+    int sendMultiple(bool const subscribe, char* const* filters, size_t const count,
+                     int const qos, int const flags, std::vector<int>& mids,
+                     std::function<void(int mid, uint64_t epoch)> const& onSent);
+
+    //-------------------------------------------------------------------------
+    //! \brief Subscribe again to all topics (Reconnection::Managed).
+    //-------------------------------------------------------------------------
+    void resubscribe();
+
+    //-------------------------------------------------------------------------
+    //! \brief Draw a new delay between reconnections (Reconnection::Managed).
+    //-------------------------------------------------------------------------
+    void jitterReconnectDelay();
+
+    //-------------------------------------------------------------------------
+    //! \brief Body of the network thread replacing the one of the mosquitto
+    //! lib when the connection asks for pinning, scheduling or busy polling.
+    //! Reconnects like mosquitto_loop_forever().
+    //-------------------------------------------------------------------------
+    void run();
+
+    //-------------------------------------------------------------------------
+    //! \brief Pin the thread and set its scheduling policy, updating the last
+    //! error.
+    //-------------------------------------------------------------------------
+    bool tune(std::thread& thread, Connection const& settings);
+
+    //-------------------------------------------------------------------------
+    //! \brief Configure the TLS of the next connections, updating the last
+    //! error.
+    //-------------------------------------------------------------------------
+    bool secure(Tls const& tls);
+
+    //-------------------------------------------------------------------------
+    //! \brief Push the received message in the queue of its lane.
+    //-------------------------------------------------------------------------
+    void enqueue(Message const& message,
+                 std::shared_ptr<Client::ReceptionCallback const> const& callback = nullptr);
+
+    //-------------------------------------------------------------------------
+    //! \brief Body of threads draining the given lane.
+    //-------------------------------------------------------------------------
+    void consume(Lane& lane);
+
+    //-------------------------------------------------------------------------
+    //! \brief Sleep until a consumer thread pops a message from the given
+    //! full lane, the consumers stop, or the timeout elapses.
+    //-------------------------------------------------------------------------
+    void awaitRoom(Lane& lane, std::chrono::milliseconds const timeout);
+
+    //-------------------------------------------------------------------------
+    //! \brief Stop consumer threads and unblock the network thread.
+    //-------------------------------------------------------------------------
+    void stopConsumers();
+
     static void on_message_received_wrapper(
-        struct mosquitto*, void *, const struct mosquitto_message *);
-    static void on_connected_wrapper(struct mosquitto*, void*, int);
+        struct mosquitto*, void *, const struct mosquitto_message *,
+        mosquitto_property const*);
+    static void on_connected_wrapper(struct mosquitto*, void*, int, int,
+                                     mosquitto_property const*);
     static void on_disconnected_wrapper(struct mosquitto*, void*, int);
 
     static void on_published_wrapper(struct mosquitto*, void* userdata, int mid)
     {
         Client* client = static_cast<Client*>(userdata);
         assert((client != nullptr) && "null pointer passed as param");
+        if (client->deferred(mid))
+            return ;
+        client->m_inflight.close(mid);
         client->onPublished(mid);
+        client->acknowledge(mid, MOSQ_ERR_SUCCESS);
     }
 
+    //-------------------------------------------------------------------------
+    //! \brief Keep the acknowledgement of a message published by the calling
+    //! thread while send() holds the lock of topic aliases, for calling its
+    //! callbacks once the lock is released.
+    //! \return true if the acknowledgement has been kept.
+    //-------------------------------------------------------------------------
+    bool deferred(int const mid);
+
     static void on_subscribed_wrapper(struct mosquitto*, void *userdata, int mid,
         int qos_count, const int *granted_qos)
     {
         Client* client = static_cast<Client*>(userdata);
         assert((client != nullptr) && "null pointer passed as param");
         client->onSubscribed(mid, qos_count, granted_qos);
+        client->acknowledge(mid, (qos_count > 0)
+            ? *std::max_element(granted_qos, granted_qos + qos_count) : 0x80);
     }
 
     static void on_unsubscribed_wrapper(struct mosquitto*, void *userdata, int mid)
@@ -457,17 +1811,70 @@ private:
         Client* client = static_cast<Client*>(userdata);
         assert((client != nullptr) && "null pointer passed as param");
         client->onUnsubscribed(mid);
+        client->acknowledge(mid, MOSQ_ERR_SUCCESS);
     }
 
     //-------------------------------------------------------------------------
-    //! \brief Return the reference to the number of users using MQTT.
-    //! This internal counter is needed for init the C library for the first
-    //! user and clean it when the last user no longer used it.
+    //! \brief To be called before sending a request with a callback: keep the
+    //! acknowledgements received until expect() or withdraw().
+    //! \return the epoch of the request, to be given to expect().
+    //-------------------------------------------------------------------------
+    uint64_t announce();
+
+    //-------------------------------------------------------------------------
+    //! \brief The announced request could not be sent.
+    //-------------------------------------------------------------------------
+    void withdraw();
+
+    //-------------------------------------------------------------------------
+    //! \brief Register the callback to be called when the request identified
+    //! by mid is acknowledged. Call it at once if the acknowledgement has
+    //! been received since the request was announced.
+    //-------------------------------------------------------------------------
+    void expect(int const mid, uint64_t const epoch,
+                Client::AckCallback&& onAcknowledged);
+
+    //-------------------------------------------------------------------------
+    //! \brief Call the callback registered for the acknowledged request.
+    //-------------------------------------------------------------------------
+    void acknowledge(int const mid, int const rc);
+
+    //-------------------------------------------------------------------------
+    //! \brief Call all registered callbacks with the given code (ie when the
+    //! connection is lost).
+    //-------------------------------------------------------------------------
+    void acknowledgeAll(int const rc);
+
+    //-------------------------------------------------------------------------
+    //! \brief Set the error of the calling thread and the last error.
     //-------------------------------------------------------------------------
-    static size_t& libMosquittoCountInstances()
+    void setError(std::error_code const& error);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return a number identifying the client for the errors of the
+    //! threads: unlike addresses, never reused by a later client.
+    //-------------------------------------------------------------------------
+    static uint64_t nextGeneration();
+
+    //-------------------------------------------------------------------------
+    //! \brief Number of users using MQTT, needed for init the C library for
+    //! the first user and clean it when the last user no longer used it. The
+    //! mutex makes clients created and destroyed by several threads at once
+    //! wait for the initialization of the C library.
+    //-------------------------------------------------------------------------
+    struct LibMosquitto
+    {
+        std::mutex mutex;
+        size_t instances = 0u;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the counter of users shared by all clients.
+    //-------------------------------------------------------------------------
+    static LibMosquitto& libMosquitto()
     {
-        static size_t counter = 0u;
-        return counter;
+        static LibMosquitto lib;
+        return lib;
     }
 
     //-------------------------------------------------------------------------
@@ -489,17 +1896,217 @@ private:
     Version m_version;
     //! \brief Store reactions
     struct {
-        //! \brief Callback when a message has been received on the given
-        //! topic.
-        std::map<std::string, Client::ReceptionCallback> reception;
+        //! \brief Callbacks when a message has been received on a topic
+        //! matching the subscribed topic filter. Held by shared pointers so
+        //! they can be called without holding the lock.
+        TopicTree<std::shared_ptr<Client::ReceptionCallback const>> reception;
+        //! \brief QoS and options of subscribed topic filters, for
+        //! subscribing them again (Reconnection::Managed).
+        std::unordered_map<std::string, std::pair<int, int>> subscriptions;
+        //! \brief Subscriptions with a delivery policy.
+        TopicTree<std::shared_ptr<Filtered>> filtered;
+        //! \brief The ones conflating messages, for flushConflated().
+        std::vector<std::shared_ptr<Filtered>> conflated;
+        //! \brief Number of subscriptions with a delivery policy. Checked
+        //! without the lock.
+        std::atomic<size_t> filters{0u};
+        //! \brief Protect reception and subscriptions against concurrent
+        //! dispatch and subscription.
+        mutable std::shared_mutex mutex;
         //! \brief Callback when the client has been connected to the broker.
         ConnectionCallback connection = nullptr;
         //! \brief Callback when the client has been disconnected from the
         //! broker.
         ConnectionCallback disconnection = nullptr;
     } m_callbacks;
-    //! \brief Hold the last error.
-    std::error_code m_error;
+    //! \brief Delivery of conflated messages.
+    struct {
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable signal;
+        //! \brief Shortest period of conflating subscriptions.
+        std::chrono::nanoseconds period{0};
+        bool stopping = false;
+    } m_conflation;
+    //! \brief Reconnection settings.
+    struct {
+        Reconnection mode = Reconnection::Manual;
+        std::chrono::seconds delay{1};
+        std::chrono::seconds delay_max{60};
+    } m_reconnection;
+    //! \brief Queues of received messages.
+    struct {
+        //! \brief One lane for Delivery::Queued, one per worker thread for
+        //! Delivery::Ordered, none for Delivery::Direct.
+        std::vector<std::unique_ptr<Lane>> lanes;
+        //! \brief Behavior when a queue is full.
+        Backpressure backpressure = Backpressure::Block;
+        //! \brief Key of messages for Delivery::Ordered.
+        OrderingKey ordering_key = nullptr;
+        //! \brief Set when stopping consumer threads.
+        std::atomic<bool> stopping{false};
+        //! \brief Number of dropped messages.
+        std::atomic<size_t> dropped{0u};
+    } m_inbound;
+    //! \brief Callbacks waiting for acknowledgements of the broker.
+    struct {
+        //! \brief Protect members.
+        std::mutex mutex;
+        //! \brief Callbacks indexed by message id.
+        std::unordered_map<int, Client::AckCallback> acks;
+        //! \brief Callback waiting for CONNACK.
+        Client::AckCallback connection = nullptr;
+        //! \brief Acknowledgement received before its callback has been
+        //! registered (the request was acknowledged before the function sending
+        //! it returned).
+        struct Early
+        {
+            int mid;
+            int rc;
+            //! \brief Value of epoch when received.
+            uint64_t epoch;
+        };
+        //! \brief Unmatched acknowledgements received while requests are
+        //! being sent. Cleared when no request is being sent, so it only
+        //! holds the acknowledgements received during these windows.
+        std::vector<Early> early;
+        //! \brief Incremented for each acknowledgement kept in early.
+        uint64_t epoch = 0u;
+        //! \brief Number of requests between announce() and expect().
+        size_t sending = 0u;
+        //! \brief Number of requests sent with a callback still waiting for
+        //! their acknowledgement. Acknowledgements are ignored while null.
+        std::atomic<size_t> expecting{0u};
+    } m_pending;
+    //! \brief QoS 1 and QoS 2 messages waiting for their acknowledgement.
+    InFlightTable m_inflight;
+    //! \brief Runtime counters.
+    Metrics m_metrics;
+    //! \brief Compression of payloads.
+    Compressor m_compressor;
+    //! \brief Latest payload of received topics.
+    TopicCache m_cache;
+    //! \brief Log of received messages, if capturing.
+    std::atomic<CaptureLog*> m_capture{nullptr};
+    //! \brief MQTT v5 settings and state of the connection.
+    struct {
+        //! \brief Protect capabilities and aliases.
+        mutable std::mutex mutex;
+        //! \brief Limits of the broker.
+        Client::Capabilities capabilities;
+        //! \brief Topic aliases of the connection.
+        TopicAliases aliases;
+        //! \brief Are aliases in use? Checked without the lock.
+        std::atomic<bool> aliasing{false};
+        //! \brief Settings.
+        Protocol protocol = Protocol::V5;
+        uint32_t maximum_packet_size = 0u;
+        uint16_t topic_aliases = 0u;
+    } m_v5;
+    //! \brief Messages published while not connected.
+    struct {
+        //! \brief Persistent queue, null if disabled.
+        std::unique_ptr<OfflineQueue> queue;
+        //! \brief Protect the queue.
+        mutable std::mutex mutex;
+        //! \brief Wake up the replay thread.
+        std::condition_variable signal;
+        std::thread thread;
+        //! \brief Connected and accepted by the broker.
+        std::atomic<bool> online{false};
+        //! \brief Are messages waiting in the queue? Checked without the lock.
+        std::atomic<bool> pending{false};
+        //! \brief Set when stopping the replay thread.
+        bool stopping = false;
+        //! \brief Settings.
+        size_t batch = 100u;
+        size_t rate = 1000u;
+    } m_offline;
+    //-------------------------------------------------------------------------
+    //! \brief Message of the publish queue. Slots are allocated once and
+    //! recycled, keeping the capacity of their buffers.
+    //-------------------------------------------------------------------------
+    struct Outgoing
+    {
+        Topic topic;
+        std::vector<uint8_t> payload;
+        QoS qos = QoS::QoS0;
+        bool offline = true;
+        bool has_properties = false;
+        Client::PublishProperties properties;
+        Client::AckCallback callback = nullptr;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Priority lane of the publish queue.
+    //-------------------------------------------------------------------------
+    struct OutboundLane
+    {
+        OutboundLane(size_t const capacity, size_t const weight_)
+            : ready(capacity), weight(weight_)
+        {}
+
+        //! \brief Indexes of messages to send.
+        RingBuffer<uint32_t> ready;
+        //! \brief Messages sent per round, 0 for a strict priority.
+        size_t weight;
+        //! \brief Message taken from ready but delayed by a rate limit, sent
+        //! first. Only used by the thread sending the queue.
+        uint32_t held = 0u;
+        bool holding = false;
+    };
+
+    //! \brief Thread-safe publications (Settings::publish_queue).
+    struct {
+        //! \brief Preallocated messages. A slot belongs to its producer from
+        //! popping its index from free until pushing it in a lane.
+        std::vector<Outgoing> slots;
+        //! \brief Indexes of free slots. Null if the publish queue is
+        //! disabled.
+        std::unique_ptr<RingBuffer<uint32_t>> free;
+        //! \brief Messages to send, by priority. Empty if the publish queue is
+        //! disabled.
+        std::vector<std::unique_ptr<OutboundLane>> lanes;
+        //! \brief Number of messages pushed in lanes, and its value when the
+        //! lanes were last flushed.
+        std::atomic<uint64_t> posted{0u};
+        std::atomic<uint64_t> flushed{0u};
+        //! \brief Time (steady clock) when the messages delayed by the rate
+        //! limits can be sent, for wantWrite().
+        std::atomic<int64_t> resume{0};
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable signal;
+        //! \brief Is the thread about to sleep? Producers only take the lock
+        //! for waking it up.
+        std::atomic<bool> waiting{false};
+        bool stopping = false;
+    } m_outbound;
+    //! \brief Rate limits of publications, null if none.
+    std::unique_ptr<RateLimiter> m_limiter;
+    //! \brief Network thread of the client (see run()).
+    struct {
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable signal;
+        //! \brief Connected by connect() and not disconnected by disconnect().
+        bool wanted = false;
+        std::atomic<bool> stopping{false};
+        std::atomic<bool> busy_poll{false};
+    } m_network;
+    //! \brief Who runs the network loop.
+    Loop m_loop = Loop::Threaded;
+    //! \brief Short-circuit of published messages.
+    Loopback m_loopback = Loopback::Broker;
+    //! \brief Context given to the mosquitto lib, kept for its callbacks.
+    std::shared_ptr<TlsContext> m_tls;
+    //! \brief Key of the errors of this client in the table of each thread
+    //! (see setError()).
+    uint64_t const m_generation = nextGeneration();
+    //! \brief Last error of any thread: its category (0 for none, 1 for
+    //! mosquittoCategory(), 2 for clientCategory()) in the upper 32 bits and
+    //! its value in the lower ones.
+    std::atomic<uint64_t> m_last_error{0u};
     //! \brief Hold the connection status.
     std::atomic<Client::Status> m_status{Client::Status::Disconnected};
 };
@@ -0,0 +1,209 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_METRICS_HPP
+#  define ASYNC_MQTT_METRICS_HPP
+
+#  include "MQTT/RingBuffer.hpp"
+#  include <algorithm>
+#  include <array>
+#  include <atomic>
+#  include <chrono>
+#  include <cstddef>
+#  include <cstdint>
+#  include <string>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Runtime counters of a client, cheap enough to be updated on the
+//! hot path.
+//!
+//! Counters are split into shards, each of them on its own cache lines, and a
+//! thread always updates the same shard with relaxed atomic operations: threads
+//! updating counters at once do not share cache lines and never wait. Reading
+//! counters (snapshot()) sums the shards.
+// ****************************************************************************
+class Metrics
+{
+public:
+
+    //! \brief Number of mosquitto error codes counted separately. Greater codes
+    //! are counted together with the last one.
+    static constexpr size_t ERROR_CODES = 32u;
+
+    // ************************************************************************
+    //! \brief Values of the counters at a given time.
+    // ************************************************************************
+    struct Snapshot
+    {
+        //! \brief Received messages and payload bytes, indexed by QoS.
+        std::array<uint64_t, 3> messages_in{};
+        std::array<uint64_t, 3> bytes_in{};
+        //! \brief Published messages and payload bytes, indexed by QoS.
+        std::array<uint64_t, 3> messages_out{};
+        std::array<uint64_t, 3> bytes_out{};
+        //! \brief Received messages matching no subscription with callback
+        //! (given to Client::onMessageReceived()).
+        uint64_t dispatch_misses = 0u;
+        //! \brief Number of received messages given to callbacks and total
+        //! time spent in these callbacks.
+        uint64_t callbacks = 0u;
+        std::chrono::nanoseconds callback_time{0};
+        //! \brief Number of successful connections after the first one.
+        uint64_t reconnects = 0u;
+        //! \brief Failed publications indexed by mosquitto error code.
+        std::array<uint64_t, ERROR_CODES> publish_failures{};
+        //! \brief Publications refused by the rate limits.
+        uint64_t rate_limited = 0u;
+        //! \brief Number of received messages waiting in queues (gauge).
+        size_t queue_depth = 0u;
+        //! \brief Number of messages waiting for their acknowledgement (gauge).
+        size_t inflight = 0u;
+
+        //---------------------------------------------------------------------
+        //! \brief Format the snapshot in the Prometheus text exposition format.
+        //! \param[in] prefix the prefix of metric names.
+        //! \param[in] labels optional labels added to every metric, for
+        //! example "client=\"sensor-1\"".
+        //---------------------------------------------------------------------
+        std::string prometheus(std::string const& prefix = "mqtt",
+                               std::string const& labels = "") const;
+
+        //---------------------------------------------------------------------
+        //! \brief Format the snapshot as StatsD lines (counters are given as
+        //! gauges of their total value, to be sent as they are).
+        //! \param[in] prefix the prefix of metric names.
+        //---------------------------------------------------------------------
+        std::string statsd(std::string const& prefix = "mqtt") const;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief A message of the given QoS has been received.
+    //-------------------------------------------------------------------------
+    void received(int const qos, size_t const bytes)
+    {
+        Shard& s = shard();
+        add(s.messages_in[index(qos)], 1u);
+        add(s.bytes_in[index(qos)], bytes);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief A message of the given QoS has been published.
+    //-------------------------------------------------------------------------
+    void sent(int const qos, size_t const bytes)
+    {
+        Shard& s = shard();
+        add(s.messages_out[index(qos)], 1u);
+        add(s.bytes_out[index(qos)], bytes);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief A publication failed with the given mosquitto error code.
+    //-------------------------------------------------------------------------
+    void failed(int const rc)
+    {
+        size_t const code = (rc < 0) ? ERROR_CODES - 1u
+                          : std::min(size_t(rc), ERROR_CODES - 1u);
+        add(shard().publish_failures[code], 1u);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief A publication has been refused by the rate limits.
+    //-------------------------------------------------------------------------
+    void limited() { add(shard().rate_limited, 1u); }
+
+    //-------------------------------------------------------------------------
+    //! \brief A received message matched no subscription with callback.
+    //-------------------------------------------------------------------------
+    void missed() { add(shard().dispatch_misses, 1u); }
+
+    //-------------------------------------------------------------------------
+    //! \brief Callbacks took the given time to process a received message.
+    //-------------------------------------------------------------------------
+    void called(std::chrono::nanoseconds const duration)
+    {
+        Shard& s = shard();
+        add(s.callbacks, 1u);
+        add(s.callback_time, uint64_t(duration.count()));
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief The client has been connected to the broker.
+    //-------------------------------------------------------------------------
+    void connected() { add(shard().connections, 1u); }
+
+    //-------------------------------------------------------------------------
+    //! \brief Sum the shards. Gauges are left to 0.
+    //-------------------------------------------------------------------------
+    Snapshot snapshot() const;
+
+private:
+
+    //! \brief Number of shards. Threads beyond it share shards.
+    static constexpr size_t SHARDS = 16u;
+
+    using Counter = std::atomic<uint64_t>;
+
+    struct alignas(CACHE_LINE_SIZE) Shard
+    {
+        std::array<Counter, 3> messages_in{};
+        std::array<Counter, 3> bytes_in{};
+        std::array<Counter, 3> messages_out{};
+        std::array<Counter, 3> bytes_out{};
+        Counter dispatch_misses{0u};
+        Counter callbacks{0u};
+        Counter callback_time{0u};
+        Counter connections{0u};
+        std::array<Counter, ERROR_CODES> publish_failures{};
+        Counter rate_limited{0u};
+    };
+
+    static size_t index(int const qos) { return size_t(qos) % 3u; }
+
+    static void add(Counter& counter, uint64_t const value)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the shard of the calling thread. Shards are given to
+    //! threads in turn, the first time they update counters.
+    //-------------------------------------------------------------------------
+    Shard& shard()
+    {
+        static std::atomic<size_t> next{0u};
+        thread_local size_t const mine =
+            next.fetch_add(1u, std::memory_order_relaxed) % SHARDS;
+        return m_shards[mine];
+    }
+
+    std::array<Shard, SHARDS> m_shards;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_METRICS_HPP
@@ -0,0 +1,170 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_OFFLINE_QUEUE_HPP
+#  define ASYNC_MQTT_OFFLINE_QUEUE_HPP
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <deque>
+#  include <string>
+#  include <string_view>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Persistent queue of messages published while the client is not
+//! connected, stored in a directory as an append-only log of memory-mapped
+//! segment files of fixed size.
+//!
+//! Each segment starts with a header holding the offsets of its first
+//! unsent record and of its end, so reopening the queue after a restart
+//! only reads the segment headers. Records are checked by a checksum when
+//! read. Fully sent segments are deleted. When the queue reaches its
+//! capacity, the oldest segment is dropped for making room to new messages.
+//!
+//! The memory used does not depend on the number of queued messages: only
+//! segments are mapped, the records being read in place. Data survive a crash
+//! of the process (the kernel owns the mapped pages) but messages written
+//! just before a power loss may be lost. Not thread safe.
+// ****************************************************************************
+class OfflineQueue
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief Queued message. Views on the mapped segment, valid until pop().
+    //-------------------------------------------------------------------------
+    struct Record
+    {
+        std::string_view topic;
+        uint8_t const* payload = nullptr;
+        size_t size = 0u;
+        int qos = 0;
+        bool retain = false;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Do not open the directory yet.
+    //! \param[in] directory the existing directory of segment files.
+    //! \param[in] segment_size the size of segment files in bytes.
+    //! \param[in] capacity the maximum size of all segments in bytes (at least
+    //! two segments).
+    //-------------------------------------------------------------------------
+    OfflineQueue(std::string directory, size_t const segment_size,
+                 size_t const capacity);
+
+    //-------------------------------------------------------------------------
+    //! \brief Unmap segments. Queued messages are kept on disk.
+    //-------------------------------------------------------------------------
+    ~OfflineQueue();
+
+    OfflineQueue(OfflineQueue const&) = delete;
+    OfflineQueue& operator=(OfflineQueue const&) = delete;
+
+    //-------------------------------------------------------------------------
+    //! \brief Map the segments found in the directory, if any.
+    //! \return false on a system error (see errno).
+    //-------------------------------------------------------------------------
+    bool open();
+
+    //-------------------------------------------------------------------------
+    //! \brief Append a message.
+    //! \return false on a system error (see errno) or if the message does not
+    //! fit in a segment (errno is EMSGSIZE).
+    //-------------------------------------------------------------------------
+    bool push(std::string_view const topic, uint8_t const* payload,
+              size_t const size, int const qos, bool const retain);
+
+    //-------------------------------------------------------------------------
+    //! \brief Give the oldest message without removing it. Corrupted records
+    //! (ie. torn by a power loss) are skipped and counted as dropped.
+    //! \return false if the queue is empty.
+    //-------------------------------------------------------------------------
+    bool front(Record& record);
+
+    //-------------------------------------------------------------------------
+    //! \brief Remove the message given by front().
+    //-------------------------------------------------------------------------
+    void pop();
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of queued messages.
+    //-------------------------------------------------------------------------
+    size_t size() const { return m_size; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return true if no message is queued.
+    //-------------------------------------------------------------------------
+    bool empty() const { return m_size == 0u; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of messages dropped because the queue was
+    //! full or their record was corrupted.
+    //-------------------------------------------------------------------------
+    size_t dropped() const { return m_dropped; }
+
+private:
+
+    //! \brief Header of segment files.
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        //! \brief Offset of the first unsent record.
+        uint32_t head;
+        //! \brief Offset after the last record.
+        uint32_t tail;
+        //! \brief Number of records written and sent.
+        uint32_t written;
+        uint32_t sent;
+    };
+
+    struct Segment
+    {
+        uint64_t sequence = 0u;
+        size_t size = 0u;
+        uint8_t* base = nullptr;
+        Header* header = nullptr;
+    };
+
+    bool map(Segment& segment, bool const create);
+    void unmap(Segment& segment, bool const remove);
+    std::string path(uint64_t const sequence) const;
+    bool roll();
+
+    std::string m_directory;
+    size_t m_segment_size;
+    size_t m_max_segments;
+    //! \brief Oldest segment first, the last one is being written.
+    std::deque<Segment> m_segments;
+    size_t m_size = 0u;
+    size_t m_dropped = 0u;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_OFFLINE_QUEUE_HPP
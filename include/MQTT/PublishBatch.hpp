@@ -0,0 +1,159 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_PUBLISH_BATCH_HPP
+#  define ASYNC_MQTT_PUBLISH_BATCH_HPP
+
+#  include "MQTT/MQTT.hpp"
+#  include <memory>
+#  include <vector>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Set of messages to be sent at once by Client::publish(PublishBatch&).
+//!
+//! Payloads are copied into a pool of fixed size slabs owned by the batch, so
+//! the caller does not have to keep its buffers alive until the batch is sent.
+//! Slabs are kept when the batch is cleared: once warmed up, filling the batch
+//! again does not allocate memory. Payloads larger than a slab get their own
+//! buffer which is released by clear().
+//!
+//! Example:
+//! \code
+//!   PublishBatch batch;
+//!   for (auto const& sample: samples)
+//!       batch.add(topic, sample.data(), sample.size(), QoS::QoS0);
+//!   if (!client.publish(batch))
+//!       std::cerr << client.error().message() << std::endl;
+//! \endcode
+// ****************************************************************************
+class PublishBatch
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief A message of the batch.
+    //-------------------------------------------------------------------------
+    struct Entry
+    {
+        //! \brief The topic to send the message on. Its id is updated with
+        //! the message id once sent.
+        Topic* topic;
+        //! \brief Copy of the payload owned by the batch.
+        uint8_t const* payload;
+        //! \brief Number of bytes of the payload.
+        size_t size;
+        //! \brief Quality of service.
+        QoS qos;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Create an empty batch.
+    //! \param[in] capacity the expected number of messages per batch.
+    //! \param[in] slab_size the number of bytes of each slab of the pool.
+    //-------------------------------------------------------------------------
+    PublishBatch(size_t const capacity = 64u, size_t const slab_size = 16u * 1024u);
+
+    //-------------------------------------------------------------------------
+    //! \brief Append a message. The payload is copied into the pool.
+    //! \param[in] topic the desired topic to send this message on. Shall be
+    //! alive until the batch is sent.
+    //! \param[in] payload the message content as pointer of char array to send.
+    //! \param[in] size the number of bytes of the payload.
+    //! \param[in] qos the desired quality of service.
+    //-------------------------------------------------------------------------
+    void add(Topic& topic, uint8_t const* payload, size_t const size, QoS const qos);
+
+    //-------------------------------------------------------------------------
+    //! \brief Append a message holding a vector of bytes.
+    //-------------------------------------------------------------------------
+    void add(Topic& topic, std::vector<uint8_t> const& payload, QoS const qos)
+    {
+        add(topic, payload.data(), payload.size(), qos);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Append a message holding a string. As for Client::publish() the
+    //! terminating null character is sent.
+    //-------------------------------------------------------------------------
+    void add(Topic& topic, std::string const& payload, QoS const qos)
+    {
+        add(topic, reinterpret_cast<uint8_t const*>(payload.c_str()),
+            payload.size() + 1u, qos);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Remove all messages. Slabs are kept for the next batch.
+    //-------------------------------------------------------------------------
+    void clear();
+
+    //-------------------------------------------------------------------------
+    //! \brief Remove the n first messages (already sent).
+    //-------------------------------------------------------------------------
+    void drop(size_t const n);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the messages of the batch.
+    //-------------------------------------------------------------------------
+    std::vector<Entry> const& entries() const { return m_entries; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of messages.
+    //-------------------------------------------------------------------------
+    size_t size() const { return m_entries.size(); }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return true if the batch has no message.
+    //-------------------------------------------------------------------------
+    bool empty() const { return m_entries.empty(); }
+
+private:
+
+    //-------------------------------------------------------------------------
+    //! \brief Return memory from the pool for a payload of the given size.
+    //-------------------------------------------------------------------------
+    uint8_t* allocate(size_t const size);
+
+private:
+
+    //! \brief The messages.
+    std::vector<Entry> m_entries;
+    //! \brief Pool of fixed size slabs.
+    std::vector<std::unique_ptr<uint8_t[]>> m_slabs;
+    //! \brief Buffers of payloads larger than a slab.
+    std::vector<std::unique_ptr<uint8_t[]>> m_large;
+    //! \brief Number of bytes of each slab.
+    size_t m_slab_size;
+    //! \brief Index of the slab currently filled.
+    size_t m_slab = 0u;
+    //! \brief Number of bytes used in the current slab.
+    size_t m_offset = 0u;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_PUBLISH_BATCH_HPP
@@ -0,0 +1,184 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_RATE_LIMITER_HPP
+#  define ASYNC_MQTT_RATE_LIMITER_HPP
+
+#  include <chrono>
+#  include <cstddef>
+#  include <cstdint>
+#  include <mutex>
+#  include <string>
+#  include <string_view>
+#  include <vector>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Maximum rate of publications. All limits are disabled by default.
+// ****************************************************************************
+struct RateLimit
+{
+    //! \brief Messages per second, 0 for no limit.
+    double messages = 0.0;
+    //! \brief Bytes of payload per second, 0 for no limit.
+    double bytes = 0.0;
+    //! \brief Duration of the burst allowed above the rates: messages are
+    //! not delayed while the rates over this duration are not exceeded.
+    std::chrono::milliseconds burst{100};
+
+    bool enabled() const { return (messages > 0.0) || (bytes > 0.0); }
+};
+
+// ****************************************************************************
+//! \brief Lane of the publish queue and rate limit of the topics starting with
+//! a prefix. The longest matching prefix applies.
+// ****************************************************************************
+struct PublishRule
+{
+    //! \brief Prefix of the topic names, empty for all topics.
+    std::string prefix;
+    //! \brief Lane of the publish queue, 0 being the most urgent.
+    size_t lane = 0u;
+    //! \brief Rate limit shared by the topics of the rule.
+    RateLimit limit;
+};
+
+// ****************************************************************************
+//! \brief Token bucket, implemented as a virtual scheduling time (GCRA): a
+//! message conforms if the time at which the bucket would be empty is not
+//! after now plus the burst. Not thread safe.
+// ****************************************************************************
+class TokenBucket
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    TokenBucket() = default;
+
+    //-------------------------------------------------------------------------
+    //! \param[in] rate the tokens per second, 0 for no limit.
+    //! \param[in] burst the duration of the allowed burst.
+    //-------------------------------------------------------------------------
+    TokenBucket(double const rate, Clock::duration const burst);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the delay before the tokens can be taken, zero if now.
+    //-------------------------------------------------------------------------
+    Clock::duration delay(Clock::time_point const now) const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Take the tokens, even if not conforming.
+    //-------------------------------------------------------------------------
+    void take(double const tokens, Clock::time_point const now);
+
+private:
+
+    //! \brief Nanoseconds per token, 0 for no limit.
+    double m_cost = 0.0;
+    Clock::duration m_burst{0};
+    //! \brief Time at which the bucket is full again.
+    Clock::time_point m_full{};
+};
+
+// ****************************************************************************
+//! \brief Rate limits of the publications of a client: a limit for all its
+//! messages and one per PublishRule. A message is sent when all its limits
+//! conform. Rules are fixed at construction, so finding the rule of a topic
+//! does not lock. Thread safe.
+// ****************************************************************************
+class RateLimiter
+{
+public:
+
+    using Clock = TokenBucket::Clock;
+
+    //-------------------------------------------------------------------------
+    //! \param[in] limit the limit of all messages.
+    //! \param[in] rules the lanes and limits of topics by prefix.
+    //! \param[in] lanes the number of lanes: greater lanes of rules are
+    //! reduced to the last one.
+    //-------------------------------------------------------------------------
+    RateLimiter(RateLimit const& limit, std::vector<PublishRule> const& rules,
+                size_t const lanes);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the lane of the topic, 0 if no rule matches.
+    //-------------------------------------------------------------------------
+    size_t lane(std::string_view const topic) const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Take the tokens of a message if it conforms.
+    //! \return the delay before the message conforms, zero if taken.
+    //-------------------------------------------------------------------------
+    Clock::duration acquire(std::string_view const topic, size_t const size,
+                            Clock::time_point const now);
+
+    //-------------------------------------------------------------------------
+    //! \brief Same as acquire() without taking the tokens.
+    //-------------------------------------------------------------------------
+    Clock::duration delay(std::string_view const topic,
+                          Clock::time_point const now) const;
+
+private:
+
+    //! \brief Buckets of messages and of bytes of a limit.
+    struct Buckets
+    {
+        Buckets(RateLimit const& limit);
+        Clock::duration delay(Clock::time_point const now) const;
+        void take(size_t const size, Clock::time_point const now);
+
+        bool enabled;
+        TokenBucket messages;
+        TokenBucket bytes;
+    };
+
+    //! \brief A rule and its buckets.
+    struct Rule
+    {
+        std::string prefix;
+        size_t lane;
+        Buckets buckets;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the index of the rule of the topic, NONE if none.
+    //-------------------------------------------------------------------------
+    size_t find(std::string_view const topic) const;
+
+    static constexpr size_t NONE = size_t(-1);
+
+    //! \brief Longest prefixes first.
+    std::vector<Rule> m_rules;
+    Buckets m_client;
+    mutable std::mutex m_mutex;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_RATE_LIMITER_HPP
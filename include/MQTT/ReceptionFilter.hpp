@@ -0,0 +1,166 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_RECEPTION_FILTER_HPP
+#  define ASYNC_MQTT_RECEPTION_FILTER_HPP
+
+#  include <chrono>
+#  include <cstddef>
+#  include <cstdint>
+#  include <mutex>
+#  include <string>
+#  include <string_view>
+#  include <unordered_map>
+#  include <vector>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Delivery policy of a subscription, applied to each topic matching
+//! its filter. All policies are disabled by default.
+// ****************************************************************************
+struct ReceptionPolicy
+{
+    //! \brief Minimum duration between two messages delivered on a topic: the
+    //! messages received meanwhile are dropped. 0 for no limit.
+    std::chrono::nanoseconds interval{0};
+    //! \brief Drop messages whose payload is the same as the previous message
+    //! of their topic (compared by a 64-bit hash).
+    bool deduplicate = false;
+    //! \brief Keep only the latest message of each topic, delivered once per
+    //! period. 0 for delivering messages when received. Takes precedence over
+    //! interval.
+    std::chrono::nanoseconds conflation{0};
+};
+
+// ****************************************************************************
+//! \brief State of a ReceptionPolicy: the time and payload hash of the last
+//! message of each topic, and the latest messages held for conflation. The
+//! buffers of held messages are reused, so a topic does not allocate memory
+//! once seen. Thread safe.
+// ****************************************************************************
+class ReceptionFilter
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    //-------------------------------------------------------------------------
+    //! \brief What to do with a received message.
+    //-------------------------------------------------------------------------
+    enum class Verdict
+    {
+        //! \brief Give it to the callback now.
+        Deliver,
+        //! \brief Ignore it.
+        Drop,
+        //! \brief Kept by the filter and given by flush().
+        Held
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief A message held for conflation.
+    //-------------------------------------------------------------------------
+    struct Held
+    {
+        std::string topic;
+        std::vector<uint8_t> payload;
+        int qos = 0;
+        bool retain = false;
+    };
+
+    explicit ReceptionFilter(ReceptionPolicy const& policy);
+
+    //-------------------------------------------------------------------------
+    //! \brief Apply the policy to a received message, holding a copy of it
+    //! for conflation.
+    //-------------------------------------------------------------------------
+    Verdict admit(std::string_view const topic, uint8_t const* payload,
+                  size_t const size, int const qos, bool const retain,
+                  Clock::time_point const now);
+
+    //-------------------------------------------------------------------------
+    //! \brief Once per conflation period, give the latest message of each topic
+    //! received since the previous period to deliver(Held const&). Called
+    //! without holding the lock: the filter keeps receiving meanwhile. Does
+    //! nothing if another thread is flushing.
+    //! \return the number of delivered messages.
+    //-------------------------------------------------------------------------
+    template<class Deliver>
+    size_t flush(Clock::time_point const now, Deliver&& deliver)
+    {
+        std::unique_lock<std::mutex> flushing(m_flushing, std::try_to_lock);
+        if (!flushing.owns_lock())
+            return 0u;
+
+        size_t const count = collect(now);
+        for (size_t i = 0u; i < count; ++i)
+        {
+            deliver(static_cast<Held const&>(m_ready[i]));
+        }
+        return count;
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the policy.
+    //-------------------------------------------------------------------------
+    ReceptionPolicy const& policy() const { return m_policy; }
+
+private:
+
+    //! \brief State of a topic.
+    struct State
+    {
+        Held held;
+        Clock::time_point last;
+        uint64_t hash = 0u;
+        bool seen = false;
+        bool pending = false;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Move held messages to m_ready if the period elapsed.
+    //! \return their number.
+    //-------------------------------------------------------------------------
+    size_t collect(Clock::time_point const now);
+
+    ReceptionPolicy const m_policy;
+    //! \brief Protect m_topics and m_pending.
+    std::mutex m_mutex;
+    //! \brief Topics by the hash of their name.
+    std::unordered_map<uint64_t, State> m_topics;
+    //! \brief Topics holding a message not yet flushed.
+    std::vector<uint64_t> m_pending;
+    Clock::time_point m_next;
+    //! \brief Held messages being flushed. Their buffers are exchanged with
+    //! the ones of the topics.
+    std::mutex m_flushing;
+    std::vector<Held> m_ready;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_RECEPTION_FILTER_HPP
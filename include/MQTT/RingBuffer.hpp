@@ -0,0 +1,184 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_RING_BUFFER_HPP
+#  define ASYNC_MQTT_RING_BUFFER_HPP
+
+#  include <atomic>
+#  include <cstddef>
+#  include <cstdint>
+#  include <memory>
+#  include <utility>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+//! \brief Size of a cache line, used for avoiding false sharing.
+//-----------------------------------------------------------------------------
+constexpr size_t CACHE_LINE_SIZE = 64u;
+
+// ****************************************************************************
+//! \brief Bounded lock-free queue for many producers and many consumers (D.
+//! Vyukov's algorithm). Each cell holds a sequence number telling producers
+//! and consumers whether the cell is free or filled for their turn, so push()
+//! and pop() only cost one compare-and-swap when there is no contention.
+//! It also serves as a SPSC or MPSC queue.
+// ****************************************************************************
+template<class T>
+class RingBuffer
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief Create the queue.
+    //! \param[in] capacity the maximum number of elements. Rounded up to the
+    //! next power of two.
+    //-------------------------------------------------------------------------
+    explicit RingBuffer(size_t const capacity)
+    {
+        size_t size = 2u;
+        while (size < capacity)
+        {
+            size *= 2u;
+        }
+        m_mask = size - 1u;
+        m_cells.reset(new Cell[size]);
+        for (size_t i = 0u; i < size; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Insert an element at the end of the queue.
+    //! \return false if the queue is full (the element is not moved).
+    //-------------------------------------------------------------------------
+    bool push(T&& value)
+    {
+        size_t position = m_tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = m_cells[position & m_mask];
+            size_t const sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t const diff = intptr_t(sequence) - intptr_t(position);
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(position, position + 1u,
+                                                 std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1u, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Extract the element at the front of the queue.
+    //! \return false if the queue is empty.
+    //-------------------------------------------------------------------------
+    bool pop(T& value)
+    {
+        size_t position = m_head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = m_cells[position & m_mask];
+            size_t const sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t const diff = intptr_t(sequence) - intptr_t(position + 1u);
+            if (diff == 0)
+            {
+                if (m_head.compare_exchange_weak(position, position + 1u,
+                                                 std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.value = T{};
+                    cell.sequence.store(position + m_mask + 1u,
+                                        std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the approximative number of elements (exact when no
+    //! thread is pushing or popping).
+    //-------------------------------------------------------------------------
+    size_t size() const
+    {
+        size_t const tail = m_tail.load(std::memory_order_relaxed);
+        size_t const head = m_head.load(std::memory_order_relaxed);
+        return (tail > head) ? (tail - head) : 0u;
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return true if the queue seems empty.
+    //-------------------------------------------------------------------------
+    bool empty() const { return size() == 0u; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the maximum number of elements.
+    //-------------------------------------------------------------------------
+    size_t capacity() const { return m_mask + 1u; }
+
+private:
+
+    struct alignas(CACHE_LINE_SIZE) Cell
+    {
+        std::atomic<size_t> sequence;
+        T value{};
+    };
+
+    //! \brief The cells (power of two).
+    std::unique_ptr<Cell[]> m_cells;
+    //! \brief Number of cells minus one.
+    size_t m_mask;
+    //! \brief Next position to pop.
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head{0u};
+    //! \brief Next position to push.
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail{0u};
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_RING_BUFFER_HPP
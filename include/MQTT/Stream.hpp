@@ -0,0 +1,278 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_STREAM_HPP
+#  define ASYNC_MQTT_STREAM_HPP
+
+#  include "MQTT/MQTT.hpp"
+#  include <functional>
+#  include <iterator>
+#  include <mutex>
+#  include <string>
+#  include <vector>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+//! \brief Sizes of the chunks of a stream.
+//-----------------------------------------------------------------------------
+struct StreamSettings
+{
+    //! \brief Bytes of payload per chunk, header excluded.
+    size_t chunk_size = 64u * 1024u;
+    //! \brief Maximum number of chunks sent and not yet acknowledged.
+    size_t window = 16u;
+};
+
+// ****************************************************************************
+//! \brief Large payload sent by Client::publish(Topic&, StreamSource&, ...) as
+//! a sequence of chunks on the sub-topic "<topic>/chunk", read from a file
+//! descriptor, a buffer or iterators while previous chunks are acknowledged.
+//! At most StreamSettings::window chunks are in flight, so the memory used
+//! depends on the window, not on the payload size.
+//!
+//! Each chunk starts with a header of HEADER_SIZE bytes in little endian:
+//! magic "MQTS" (4), version (2), reserved (2), stream id (8), payload size
+//! (8), offset of the chunk (8), chunk index (4), number of chunks (4).
+//! StreamReceiver reassembles them.
+//!
+//! \code
+//!   StreamSource firmware(fd, size);
+//!   client.publish(topic, firmware, QoS::QoS1, [](int rc) { ... });
+//! \endcode
+//!
+//! The source shall be kept alive until the completion callback is called.
+// ****************************************************************************
+class StreamSource
+{
+public:
+
+    //! \brief Bytes of the header of each chunk.
+    static constexpr size_t HEADER_SIZE = 40u;
+
+    //-------------------------------------------------------------------------
+    //! \brief Fill the buffer with exactly the given number of bytes, the next
+    //! ones of the payload. Return false on error.
+    //-------------------------------------------------------------------------
+    using Reader = std::function<bool(uint8_t* buffer, size_t size)>;
+
+    //-------------------------------------------------------------------------
+    //! \brief Payload given by a reader.
+    //-------------------------------------------------------------------------
+    StreamSource(uint64_t const size, Reader reader,
+                 StreamSettings const& settings = StreamSettings());
+
+    //-------------------------------------------------------------------------
+    //! \brief Payload of the given size read from a file descriptor, from
+    //! its current position. The descriptor is not closed.
+    //-------------------------------------------------------------------------
+    StreamSource(int const fd, uint64_t const size,
+                 StreamSettings const& settings = StreamSettings());
+
+    //-------------------------------------------------------------------------
+    //! \brief Payload in memory, not copied: the buffer shall be kept alive
+    //! until the stream is completed.
+    //-------------------------------------------------------------------------
+    StreamSource(uint8_t const* data, size_t const size,
+                 StreamSettings const& settings = StreamSettings());
+
+    //-------------------------------------------------------------------------
+    //! \brief Payload given by forward iterators on bytes.
+    //-------------------------------------------------------------------------
+    template<class Iterator, class = typename std::iterator_traits<Iterator>::iterator_category>
+    StreamSource(Iterator first, Iterator last,
+                 StreamSettings const& settings = StreamSettings())
+        : StreamSource(uint64_t(std::distance(first, last)),
+                       [first](uint8_t* buffer, size_t size) mutable
+          {
+              for (; size > 0u; --size, ++first)
+              {
+                  *buffer++ = uint8_t(*first);
+              }
+              return true;
+          }, settings)
+    {}
+
+    StreamSource(StreamSource const&) = delete;
+    StreamSource& operator=(StreamSource const&) = delete;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the identifier of the stream, carried by its chunks.
+    //-------------------------------------------------------------------------
+    uint64_t id() const { return m_id; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of bytes of the payload.
+    //-------------------------------------------------------------------------
+    uint64_t size() const { return m_size; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of chunks (at least one).
+    //-------------------------------------------------------------------------
+    uint64_t chunks() const { return m_count; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of chunks acknowledged.
+    //-------------------------------------------------------------------------
+    uint64_t acknowledged() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_acked;
+    }
+
+private:
+
+    friend class Client;
+
+    //-------------------------------------------------------------------------
+    //! \brief Read the next chunk in the buffer, after its header. Chunks
+    //! shall be read in order.
+    //! \return the number of bytes of the chunk, 0 if it cannot be read.
+    //-------------------------------------------------------------------------
+    size_t fill(uint64_t const index);
+
+private:
+
+    Reader m_reader;
+    uint64_t m_size;
+    size_t m_chunk_size;
+    size_t m_window;
+    uint64_t m_id;
+    uint64_t m_count;
+    //! \brief Header and payload of the chunk being sent.
+    std::vector<uint8_t> m_buffer;
+    //! \brief Set by Client::publish().
+    Topic m_topic;
+    QoS m_qos = QoS::QoS1;
+    Client::AckCallback m_completed;
+    //! \brief Progress, protected by the mutex.
+    mutable std::mutex m_mutex;
+    uint64_t m_next = 0u;
+    uint64_t m_inflight = 0u;
+    uint64_t m_acked = 0u;
+    int m_rc = MOSQ_ERR_SUCCESS;
+    bool m_started = false;
+    bool m_completing = false;
+    //! \brief Is a thread reading and sending chunks?
+    bool m_pumping = false;
+};
+
+// ****************************************************************************
+//! \brief Reassemble streams sent by StreamSource into a buffer given by the
+//! caller or into a file mapped in memory. Give it the messages of the
+//! sub-topic "<topic>/chunk":
+//!
+//! \code
+//!   StreamReceiver receiver("/tmp/firmware.bin",
+//!       [](uint64_t id, uint8_t const* data, uint64_t size, int rc) { ... });
+//!   Topic chunks{"firmware/chunk"};
+//!   client.subscribe(chunks, QoS::QoS1, [&receiver](Message const& message) {
+//!       receiver.feed(message);
+//!   });
+//! \endcode
+//!
+//! One stream is reassembled at a time: the chunk of a new stream abandons
+//! the incomplete one. Chunks can arrive in any order; duplicates are
+//! ignored. Not thread safe: to be fed by a single thread at a time.
+// ****************************************************************************
+class StreamReceiver
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief Called once per stream when completed (rc is MOSQ_ERR_SUCCESS)
+    //! or failed: MOSQ_ERR_PAYLOAD_SIZE when the payload does not fit the
+    //! buffer, MOSQ_ERR_ERRNO when the file cannot be mapped, MOSQ_ERR_PROTOCOL
+    //! when abandoned for a new stream. Data are valid during the call only
+    //! for files, until the next stream for buffers.
+    //-------------------------------------------------------------------------
+    using Callback = std::function<void(uint64_t id, uint8_t const* data,
+                                        uint64_t size, int rc)>;
+
+    //-------------------------------------------------------------------------
+    //! \brief Reassemble streams into the buffer of the caller.
+    //-------------------------------------------------------------------------
+    StreamReceiver(uint8_t* buffer, size_t const capacity, Callback callback);
+
+    //-------------------------------------------------------------------------
+    //! \brief Reassemble each stream into the file, truncated to the size of
+    //! the payload and mapped in memory.
+    //-------------------------------------------------------------------------
+    StreamReceiver(std::string const& path, Callback callback);
+
+    ~StreamReceiver();
+
+    StreamReceiver(StreamReceiver const&) = delete;
+    StreamReceiver& operator=(StreamReceiver const&) = delete;
+
+    //-------------------------------------------------------------------------
+    //! \brief Store a chunk.
+    //! \return false if the message is not a valid chunk.
+    //-------------------------------------------------------------------------
+    bool feed(Message const& message);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of chunks received of the current stream.
+    //-------------------------------------------------------------------------
+    uint64_t received() const { return m_received; }
+
+private:
+
+    //-------------------------------------------------------------------------
+    //! \brief Allocate the storage of a new stream.
+    //! \return the error code.
+    //-------------------------------------------------------------------------
+    int open(uint64_t const size);
+
+    //-------------------------------------------------------------------------
+    //! \brief Release the storage of the stream and call the callback.
+    //-------------------------------------------------------------------------
+    void close(int const rc);
+
+private:
+
+    uint8_t* m_buffer = nullptr;
+    size_t m_capacity = 0u;
+    std::string m_path;
+    Callback m_callback;
+    //! \brief Current stream.
+    uint64_t m_id = 0u;
+    uint64_t m_size = 0u;
+    uint64_t m_count = 0u;
+    uint64_t m_received = 0u;
+    bool m_active = false;
+    //! \brief Failed stream, whose next chunks are ignored.
+    bool m_failed = false;
+    //! \brief Chunks received, one bit each.
+    std::vector<uint64_t> m_chunks;
+    //! \brief Mapped file.
+    int m_fd = -1;
+    uint8_t* m_map = nullptr;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_STREAM_HPP
@@ -0,0 +1,181 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_TLS_HPP
+#  define ASYNC_MQTT_TLS_HPP
+
+#  include <atomic>
+#  include <cstddef>
+#  include <memory>
+#  include <mutex>
+#  include <string>
+#  include <unordered_map>
+
+namespace mqtt {
+
+class TlsContext;
+
+// ****************************************************************************
+//! \brief TLS settings of a connection. TLS is enabled by giving the
+//! certificate authorities trusted for the broker, a pre-shared key or a
+//! context. Brokers usually listen to TLS connections on the port 8883.
+// ****************************************************************************
+struct Tls
+{
+    //! \brief PEM file of the trusted certificate authorities.
+    std::string cafile;
+    //! \brief Directory of trusted certificate authorities (see c_rehash).
+    std::string capath;
+    //! \brief Trust the certificate authorities of the system.
+    bool os_certificates = false;
+    //! \brief PEM certificate and private key of the client, for brokers
+    //! authenticating their clients by certificate.
+    std::string certfile;
+    std::string keyfile;
+    //! \brief Do not check that the certificate of the broker matches its
+    //! address. For tests only.
+    bool insecure = false;
+    //! \brief Minimum version: "tlsv1.3", "tlsv1.2" or "tlsv1.1". Empty for the
+    //! default of OpenSSL.
+    std::string version;
+    //! \brief OpenSSL list of ciphers of TLS 1.2, empty for the default.
+    std::string ciphers;
+    //! \brief Pre-shared key in hexadecimal and its identity, instead of
+    //! certificates.
+    std::string psk;
+    std::string identity;
+    //! \brief Resume the session of the previous connection instead of a full
+    //! handshake (needs MQTT_WITH_OPENSSL).
+    bool resumption = true;
+    //! \brief Let the kernel encrypt and decrypt the records (kTLS): needs
+    //! MQTT_WITH_OPENSSL, OpenSSL 3 built with enable-ktls and the tls kernel
+    //! module, else records are encrypted by OpenSSL as usual.
+    bool kernel_offload = false;
+    //! \brief Context shared by the clients of a same broker, created from
+    //! these settings, for resuming sessions across clients. When null, each
+    //! connect() creates the context of the client.
+    std::shared_ptr<TlsContext> context;
+
+    bool enabled() const
+    {
+        return (!cafile.empty()) || (!capath.empty()) || os_certificates ||
+               (!psk.empty()) || (context != nullptr);
+    }
+};
+
+// ****************************************************************************
+//! \brief OpenSSL context given to the mosquitto lib instead of the one it
+//! creates for each connection (available when the library is compiled with
+//! -DMQTT_WITH_OPENSSL, link with -lssl -lcrypto).
+//!
+//! Certificates are loaded once, and the session received from the broker
+//! (session ticket) is kept by name of broker: the next handshakes, for
+//! reconnecting or by other clients sharing the context, resume it instead
+//! of negotiating a new session. This saves the certificate exchange and its
+//! asymmetric cryptography, which dominates the cost of reconnect storms.
+//!
+//! Thread safe: the context can be shared by clients of several threads.
+// ****************************************************************************
+class TlsContext
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief Create the OpenSSL context and load the certificates.
+    //! \note Check valid() before using the context.
+    //-------------------------------------------------------------------------
+    explicit TlsContext(Tls const& tls);
+
+    //-------------------------------------------------------------------------
+    //! \brief Release the context and the kept sessions.
+    //-------------------------------------------------------------------------
+    ~TlsContext();
+
+    TlsContext(TlsContext const&) = delete;
+    TlsContext& operator=(TlsContext const&) = delete;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return true if the library has been compiled with OpenSSL.
+    //-------------------------------------------------------------------------
+    static bool supported();
+
+    //-------------------------------------------------------------------------
+    //! \brief Has the context been created? If not, see the OpenSSL error
+    //! queue (ERR_get_error()).
+    //-------------------------------------------------------------------------
+    bool valid() const { return m_context != nullptr; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the SSL_CTX, for MOSQ_OPT_SSL_CTX.
+    //-------------------------------------------------------------------------
+    void* native() const { return m_context; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return true if the context asks for the kernel offload.
+    //-------------------------------------------------------------------------
+    bool kernelOffload() const { return m_kernel_offload; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return true if the kernel encrypts the records sent by the
+    //! given connection (SSL, see mosquitto_ssl_get()).
+    //-------------------------------------------------------------------------
+    static bool offloaded(void* ssl);
+
+    //-------------------------------------------------------------------------
+    //! \brief Number of completed handshakes and of those resuming a session.
+    //-------------------------------------------------------------------------
+    size_t handshakes() const { return m_handshakes.load(); }
+    size_t resumed() const { return m_resumed.load(); }
+
+    //-------------------------------------------------------------------------
+    //! \brief Drop the kept sessions, for instance when the broker changed of
+    //! certificate.
+    //-------------------------------------------------------------------------
+    void forget();
+
+private:
+
+    //! \brief OpenSSL callbacks.
+    struct Callbacks;
+    friend struct Callbacks;
+
+    void* m_context = nullptr;
+    bool m_insecure;
+    bool m_resumption;
+    bool m_kernel_offload = false;
+    //! \brief Pre-shared key, decoded, and its identity.
+    std::string m_psk;
+    std::string m_identity;
+    //! \brief Last session (SSL_SESSION) received by name of broker.
+    std::mutex m_mutex;
+    std::unordered_map<std::string, void*> m_sessions;
+    std::atomic<size_t> m_handshakes{0u};
+    std::atomic<size_t> m_resumed{0u};
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_TLS_HPP
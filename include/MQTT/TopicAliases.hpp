@@ -0,0 +1,141 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_TOPIC_ALIASES_HPP
+#  define ASYNC_MQTT_TOPIC_ALIASES_HPP
+
+#  include <mosquitto.h>
+#  include <atomic>
+#  include <cstddef>
+#  include <cstdint>
+#  include <string>
+#  include <string_view>
+#  include <unordered_map>
+#  include <vector>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief MQTT v5 topic aliases of the outgoing messages of a connection,
+//! replacing topic names by 2-byte numbers.
+//!
+//! The first message published on a topic carries both its name and a new
+//! alias; the next ones only carry the alias. When all the aliases allowed by
+//! the broker (TOPIC_ALIAS_MAXIMUM of CONNACK) are used, the alias of the least
+//! recently used topic is given to the new topic. Aliases only live for the
+//! connection: the table is reset on each connection.
+//!
+//! Each alias keeps its property list, so publishing with an alias known by
+//! the broker does not allocate memory. Not thread safe.
+// ****************************************************************************
+class TopicAliases
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief Alias remembered by a caller (see TopicHandle) for skipping the
+    //! lookup of the topic name while the alias is still given to the topic.
+    //-------------------------------------------------------------------------
+    struct Binding
+    {
+        TopicAliases const* owner = nullptr;
+        uint16_t alias = 0u;
+        uint64_t stamp = 0u;
+    };
+
+    ~TopicAliases();
+
+    //-------------------------------------------------------------------------
+    //! \brief Forget all aliases, for a new connection.
+    //! \param[in] capacity the number of aliases allowed. 0 disables aliases.
+    //-------------------------------------------------------------------------
+    void reset(size_t const capacity);
+
+    //-------------------------------------------------------------------------
+    //! \brief Give the alias of the topic, assigning one if needed.
+    //! \param[in] topic the topic name.
+    //! \param[out] known true if the broker already knows the alias: the
+    //! topic name can be omitted.
+    //! \param[inout] binding if not null, the alias previously given to the
+    //! topic, checked before looking the topic up, and updated.
+    //! \return the alias, 0 if aliases are disabled.
+    //-------------------------------------------------------------------------
+    uint16_t alias(std::string_view const topic, bool& known,
+                   Binding* binding = nullptr);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the property list holding the given alias.
+    //-------------------------------------------------------------------------
+    mosquitto_property const* properties(uint16_t const alias) const
+    {
+        return m_entries[alias - 1u].properties;
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Forget the alias of the topic (the message giving it to the
+    //! broker has not been sent).
+    //-------------------------------------------------------------------------
+    void forget(std::string_view const topic);
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of assigned aliases.
+    //-------------------------------------------------------------------------
+    size_t size() const { return m_index.size(); }
+
+private:
+
+    struct Entry
+    {
+        std::string topic;
+        mosquitto_property* properties = nullptr;
+        //! \brief Unique number of the assignment of the alias to the topic,
+        //! 0 when not assigned.
+        uint64_t stamp = 0u;
+        //! \brief Least recently used list.
+        uint16_t previous = NONE;
+        uint16_t next = NONE;
+    };
+
+    static constexpr uint16_t NONE = 0xFFFFu;
+
+    void unlink(uint16_t const i);
+    void pushFront(uint16_t const i);
+
+    //! \brief Entry i holds the alias i + 1. Never reallocated once reserved,
+    //! since m_index refers to the topic names of entries.
+    std::vector<Entry> m_entries;
+    size_t m_capacity = 0u;
+    std::unordered_map<std::string_view, uint16_t> m_index;
+    uint16_t m_head = NONE;
+    uint16_t m_tail = NONE;
+    //! \brief Stamps are unique among all tables, so a binding never matches
+    //! an alias given after a reset or by another table.
+    static std::atomic<uint64_t> s_stamps;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_TOPIC_ALIASES_HPP
@@ -0,0 +1,152 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_TOPIC_CACHE_HPP
+#  define ASYNC_MQTT_TOPIC_CACHE_HPP
+
+#  include <atomic>
+#  include <cstddef>
+#  include <cstdint>
+#  include <memory>
+#  include <mutex>
+#  include <string>
+#  include <string_view>
+#  include <vector>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Latest payload of each topic, written under a mutex (by the network
+//! thread of the client, and by publishing threads for messages delivered
+//! locally) and read by any thread without lock.
+//!
+//! Each entry is protected by a sequence lock: the writer makes the sequence
+//! odd while updating the entry, readers copy the payload and try again if the
+//! sequence changed meanwhile. Payloads are stored as 64-bit atomic words, so
+//! concurrent reads and writes are not data races.
+//!
+//! Topics are indexed by an open addressing table of fixed capacity: once the
+//! capacity is reached, new topics are not cached. Payloads live in an arena of
+//! blocks sized by powers of two, recycled by the writer and never given back
+//! to the system, so a reader lagging behind still reads valid memory.
+// ****************************************************************************
+class TopicCache
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief Allocate the index.
+    //! \param[in] capacity the maximum number of topics. 0 disables the cache.
+    //! \param[in] max_payload the size of the biggest payload kept, in bytes.
+    //-------------------------------------------------------------------------
+    explicit TopicCache(size_t const capacity = 0u,
+                        size_t const max_payload = 65536u);
+
+    TopicCache(TopicCache const&) = delete;
+    TopicCache& operator=(TopicCache const&) = delete;
+
+    //-------------------------------------------------------------------------
+    //! \brief Replace the payload of the topic. Thread safe: writers are
+    //! serialized by a mutex, uncontended when a single thread writes.
+    //! \return false if the topic is not cached (too many topics, payload too
+    //! big).
+    //-------------------------------------------------------------------------
+    bool store(std::string_view const topic, uint8_t const* payload,
+               size_t const size);
+
+    //-------------------------------------------------------------------------
+    //! \brief Copy the latest payload of the topic. Lock-free, from any thread.
+    //! \param[out] payload the buffer, resized to the payload.
+    //! \return false if the topic has not been received.
+    //-------------------------------------------------------------------------
+    bool get(std::string_view const topic, std::vector<uint8_t>& payload) const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Same as get() but with a string.
+    //-------------------------------------------------------------------------
+    bool get(std::string_view const topic, std::string& payload) const;
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of cached topics.
+    //-------------------------------------------------------------------------
+    size_t size() const { return m_size.load(std::memory_order_acquire); }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the maximum number of topics.
+    //-------------------------------------------------------------------------
+    size_t capacity() const { return m_capacity; }
+
+private:
+
+    using Word = std::atomic<uint64_t>;
+
+    struct Entry
+    {
+        //! \brief Odd while the writer updates the entry.
+        std::atomic<uint32_t> sequence{0u};
+        std::atomic<uint32_t> size{0u};
+        //! \brief Block of the payload. Its first word holds the number of
+        //! bytes of the block.
+        std::atomic<Word*> block{nullptr};
+        //! \brief Set before the entry is published in the index.
+        std::string topic;
+        uint64_t hash = 0u;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Blocks of a size class.
+    //-------------------------------------------------------------------------
+    struct SizeClass
+    {
+        std::vector<std::unique_ptr<Word[]>> slabs;
+        std::vector<Word*> free;
+    };
+
+    Entry const* find(std::string_view const topic, uint64_t const hash) const;
+    Entry* insert(std::string_view const topic, uint64_t const hash);
+    Word* allocate(size_t const cls);
+    void release(Word* block);
+
+    template<class Buffer>
+    bool read(std::string_view const topic, Buffer& payload) const;
+
+    size_t m_capacity;
+    size_t m_max_payload;
+    std::unique_ptr<Entry[]> m_entries;
+    //! \brief Index of entries plus one, 0 for empty slots.
+    std::unique_ptr<std::atomic<uint32_t>[]> m_slots;
+    size_t m_mask = 0u;
+    std::atomic<size_t> m_size{0u};
+    //! \brief Serializes the writers: the index, the size classes and the
+    //! sequences of entries are only modified under it.
+    std::mutex m_writer;
+    //! \brief Written by the writer only.
+    std::vector<SizeClass> m_classes;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_TOPIC_CACHE_HPP
@@ -0,0 +1,228 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_TOPIC_PATTERN_HPP
+#  define ASYNC_MQTT_TOPIC_PATTERN_HPP
+
+#  include <charconv>
+#  include <cstddef>
+#  include <cstring>
+#  include <string_view>
+#  include <type_traits>
+
+namespace mqtt {
+
+// ****************************************************************************
+//! \brief Topic name formatted in a fixed buffer of N bytes (including the
+//! terminating null character), usually on the stack: building a topic does
+//! not allocate memory.
+// ****************************************************************************
+template<size_t N>
+class TopicBuffer
+{
+    static_assert(N > 1u, "TopicBuffer shall hold at least one character");
+
+public:
+
+    TopicBuffer() { m_data[0] = '\0'; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the null terminated name.
+    //-------------------------------------------------------------------------
+    char const* c_str() const { return m_data; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return a view on the name.
+    //-------------------------------------------------------------------------
+    std::string_view str() const { return { m_data, m_size }; }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0u; }
+    static constexpr size_t capacity() { return N - 1u; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Clear the name.
+    //-------------------------------------------------------------------------
+    void clear()
+    {
+        m_size = 0u;
+        m_data[0] = '\0';
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Append text to the name.
+    //! \return false if the buffer is too small (the name is unchanged).
+    //-------------------------------------------------------------------------
+    bool append(std::string_view const text)
+    {
+        if (text.size() > capacity() - m_size)
+            return false;
+
+        std::memcpy(m_data + m_size, text.data(), text.size());
+        m_size += text.size();
+        m_data[m_size] = '\0';
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Append the decimal representation of an integer to the name.
+    //! \return false if the buffer is too small (the name is unchanged).
+    //-------------------------------------------------------------------------
+    template<class T, class = std::enable_if_t<std::is_integral<T>::value>>
+    bool append(T const value)
+    {
+        // Keep room for the terminating null character.
+        auto const result = std::to_chars(m_data + m_size, m_data + N - 1u,
+            std::conditional_t<std::is_same<T, bool>::value, int, T>(value));
+        if (result.ec != std::errc())
+        {
+            m_data[m_size] = '\0';
+            return false;
+        }
+        m_size = size_t(result.ptr - m_data);
+        m_data[m_size] = '\0';
+        return true;
+    }
+
+private:
+
+    char m_data[N];
+    size_t m_size = 0u;
+};
+
+// ****************************************************************************
+//! \brief Topic name where each "{}" is replaced by a parameter: a string
+//! or an integer. The pattern is parsed at compile time when constexpr:
+//!
+//! \code
+//!   constexpr TopicPattern METRIC("site/{}/metric/{}");
+//!   static_assert(METRIC.valid() && (METRIC.arity() == 2u));
+//!
+//!   TopicBuffer<64> topic;
+//!   if (METRIC.format(topic, site, 42))
+//!       client.publish(topic, payload, size, QoS::QoS0);
+//! \endcode
+//!
+//! Parameters shall not hold the wildcards '+' and '#'.
+// ****************************************************************************
+class TopicPattern
+{
+public:
+
+    constexpr explicit TopicPattern(std::string_view const pattern)
+        : m_pattern(pattern), m_arity(count(pattern)),
+          m_valid(check(pattern))
+    {}
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of parameters.
+    //-------------------------------------------------------------------------
+    constexpr size_t arity() const { return m_arity; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Is the pattern a valid topic name: not empty, no wildcards?
+    //-------------------------------------------------------------------------
+    constexpr bool valid() const { return m_valid; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the pattern.
+    //-------------------------------------------------------------------------
+    constexpr std::string_view str() const { return m_pattern; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Replace the buffer by the pattern formatted with the parameters.
+    //! \return false if the pattern is invalid, the number of parameters
+    //! differs from arity(), a parameter holds a wildcard or the buffer is
+    //! too small. The buffer is then cleared.
+    //-------------------------------------------------------------------------
+    template<size_t N, class... Args>
+    bool format(TopicBuffer<N>& buffer, Args const&... args) const
+    {
+        buffer.clear();
+        size_t position = 0u;
+        bool const ok = m_valid && (sizeof...(Args) == m_arity) &&
+            (parameter(buffer, position, args) && ...) &&
+            buffer.append(m_pattern.substr(position));
+        if (!ok)
+        {
+            buffer.clear();
+        }
+        return ok;
+    }
+
+private:
+
+    //-------------------------------------------------------------------------
+    //! \brief Append the text up to the next "{}" then the parameter.
+    //-------------------------------------------------------------------------
+    template<size_t N, class T>
+    bool parameter(TopicBuffer<N>& buffer, size_t& position, T const& value) const
+    {
+        size_t const next = m_pattern.find("{}", position);
+        if (!buffer.append(m_pattern.substr(position, next - position)))
+            return false;
+
+        position = next + 2u;
+        if constexpr (std::is_integral<T>::value)
+        {
+            return buffer.append(value);
+        }
+        else
+        {
+            std::string_view const text(value);
+            return (text.find_first_of("+#", 0u, 2u) == std::string_view::npos) &&
+                   (text.find('\0') == std::string_view::npos) &&
+                   buffer.append(text);
+        }
+    }
+
+    static constexpr size_t count(std::string_view const pattern)
+    {
+        size_t n = 0u;
+        for (size_t i = pattern.find("{}"); i != std::string_view::npos;
+             i = pattern.find("{}", i + 2u))
+        {
+            ++n;
+        }
+        return n;
+    }
+
+    static constexpr bool check(std::string_view const pattern)
+    {
+        return (!pattern.empty()) &&
+               (pattern.find_first_of("+#") == std::string_view::npos);
+    }
+
+private:
+
+    std::string_view m_pattern;
+    size_t m_arity;
+    bool m_valid;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_TOPIC_PATTERN_HPP
@@ -0,0 +1,514 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef ASYNC_MQTT_TOPIC_TREE_HPP
+#  define ASYNC_MQTT_TOPIC_TREE_HPP
+
+#  include <string>
+#  include <string_view>
+#  include <cstdint>
+#  include <memory>
+#  include <vector>
+#  include <unordered_map>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+//! \brief FNV-1a hash of a topic name or a topic level.
+//-----------------------------------------------------------------------------
+inline uint64_t topicHash(std::string_view const topic)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (char const c: topic)
+    {
+        h ^= uint64_t(uint8_t(c));
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// ****************************************************************************
+//! \brief Tree of MQTT topic filters, one node per topic level, used for
+//! dispatching incoming messages to the callbacks of their subscriptions.
+//!
+//! Filters may hold the MQTT wildcards '+' (exactly one level) and '#' (any
+//! number of levels, including the parent one, shall be the last level).
+//! Looking up a topic costs O(topic depth) whatever the number of filters and
+//! all filters matching the topic are visited, so overlapping subscriptions
+//! such as "sensors/+/temp" and "sensors/#" both receive the message.
+//!
+//! Level names are interned: each distinct name is stored once, with its
+//! hash, and nodes are indexed by the interned identifier. match() works on
+//! views of the topic and never allocates memory: it can be called from the
+//! mosquitto network thread for each received message.
+//!
+//! As required by the MQTT specification, topics starting by '$' (such as
+//! "$SYS/...") are not matched by filters starting by a wildcard.
+// ****************************************************************************
+template<class T>
+class TopicTree
+{
+public:
+
+    //-------------------------------------------------------------------------
+    //! \brief Add the filter or replace the value of an existing filter.
+    //! \param[in] filter the topic filter (ie "sensors/+/temp").
+    //! \param[in] value the value associated to the filter.
+    //-------------------------------------------------------------------------
+    void insert(std::string_view const filter, T value)
+    {
+        Node* node = &m_root;
+        forEachLevel(filter, [&](std::string_view const level)
+        {
+            std::unique_ptr<Node>* child = &node->plus;
+            if (isWildcard(level, '#'))
+            {
+                child = &node->hash;
+            }
+            else if (!isWildcard(level, '+'))
+            {
+                uint64_t const h = hash(level);
+                auto it = node->children.find(m_symbols.find(level, h));
+                if (it == node->children.end())
+                {
+                    uint32_t const symbol = m_symbols.acquire(level, h);
+                    child = &node->children[symbol];
+                    child->reset(new Node);
+                    (*child)->symbol = symbol;
+                }
+                else
+                {
+                    child = &it->second;
+                }
+            }
+            if (*child == nullptr)
+            {
+                child->reset(new Node);
+            }
+            node = child->get();
+        });
+
+        if (!node->used)
+        {
+            node->used = true;
+            ++m_size;
+        }
+        node->value = std::move(value);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Remove the filter. Nodes no longer used are released.
+    //! \param[in] filter the topic filter given to insert().
+    //! \return true if the filter was present.
+    //-------------------------------------------------------------------------
+    bool erase(std::string_view const filter)
+    {
+        if (!erase(m_root, filter))
+            return false;
+        --m_size;
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Visit the value of every filter matching the given topic.
+    //! This method does not allocate memory.
+    //! \param[in] topic the topic of the message (shall not have wildcards).
+    //! \param[in] visitor callable taking a T const& as parameter.
+    //! \return the number of visited filters.
+    //-------------------------------------------------------------------------
+    template<class Visitor>
+    size_t match(std::string_view const topic, Visitor&& visitor) const
+    {
+        bool const dollar = (!topic.empty()) && (topic[0] == '$');
+        return match(m_root, topic, dollar, visitor);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Remove all filters.
+    //-------------------------------------------------------------------------
+    void clear()
+    {
+        m_root.children.clear();
+        m_root.plus.reset();
+        m_root.hash.reset();
+        m_symbols.clear();
+        m_size = 0u;
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return the number of filters.
+    //-------------------------------------------------------------------------
+    size_t size() const { return m_size; }
+
+    //-------------------------------------------------------------------------
+    //! \brief Return true if there is no filter.
+    //-------------------------------------------------------------------------
+    bool empty() const { return m_size == 0u; }
+
+private:
+
+    //-------------------------------------------------------------------------
+    static uint64_t hash(std::string_view const level)
+    {
+        return topicHash(level);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief A topic level.
+    //-------------------------------------------------------------------------
+    struct Node
+    {
+        //! \brief Interned identifier of the level name (0 for wildcards).
+        uint32_t symbol = 0u;
+        //! \brief Sub-levels indexed by their interned name.
+        std::unordered_map<uint32_t, std::unique_ptr<Node>> children;
+        //! \brief Sub-level '+'.
+        std::unique_ptr<Node> plus;
+        //! \brief Sub-level '#'.
+        std::unique_ptr<Node> hash;
+        //! \brief Is a filter ending on this level?
+        bool used = false;
+        //! \brief Value of the filter ending on this level.
+        T value{};
+
+        bool useless() const
+        {
+            return !used && children.empty() && (plus == nullptr) &&
+                   (hash == nullptr);
+        }
+    };
+
+    // ************************************************************************
+    //! \brief Open addressing table of interned level names. Lookups take the
+    //! precomputed hash of the name and do not allocate memory.
+    // ************************************************************************
+    class Symbols
+    {
+    public:
+
+        //---------------------------------------------------------------------
+        //! \brief Return the identifier of the name or 0 if the name is not
+        //! interned. Since identifiers start from 1, an unknown name cannot
+        //! match a sub-level.
+        //---------------------------------------------------------------------
+        uint32_t find(std::string_view const name, uint64_t const h) const
+        {
+            if (m_slots.empty())
+                return 0u;
+
+            size_t const mask = m_slots.size() - 1u;
+            for (size_t i = size_t(h) & mask; ; i = (i + 1u) & mask)
+            {
+                Slot const& slot = m_slots[i];
+                if (slot.id == 0u)
+                    return 0u;
+                if ((slot.references != 0u) && (slot.hash == h) &&
+                    (slot.name == name))
+                    return slot.id;
+            }
+        }
+
+        //---------------------------------------------------------------------
+        //! \brief Intern the name (if needed) and increment its number of
+        //! references.
+        //---------------------------------------------------------------------
+        uint32_t acquire(std::string_view const name, uint64_t const h)
+        {
+            // Keep the load factor (tombstones included) under 1/2. Tombstones
+            // are dropped when rehashing.
+            if (2u * (m_used + 1u) > m_slots.size())
+            {
+                size_t capacity = 16u;
+                while (capacity < 4u * (m_live + 1u))
+                {
+                    capacity *= 2u;
+                }
+                rehash(capacity);
+            }
+
+            size_t const mask = m_slots.size() - 1u;
+            Slot* tombstone = nullptr;
+            for (size_t i = size_t(h) & mask; ; i = (i + 1u) & mask)
+            {
+                Slot& slot = m_slots[i];
+                if (slot.id == 0u)
+                {
+                    Slot& free = (tombstone != nullptr) ? *tombstone : slot;
+                    if (&free == &slot)
+                    {
+                        ++m_used;
+                    }
+                    free.id = m_next_id++;
+                    free.hash = h;
+                    free.name = name;
+                    free.references = 1u;
+                    ++m_live;
+                    return free.id;
+                }
+                if (slot.references == 0u)
+                {
+                    if (tombstone == nullptr)
+                    {
+                        tombstone = &slot;
+                    }
+                }
+                else if ((slot.hash == h) && (slot.name == name))
+                {
+                    ++slot.references;
+                    return slot.id;
+                }
+            }
+        }
+
+        //---------------------------------------------------------------------
+        //! \brief Decrement the number of references of the name. The slot
+        //! becomes a tombstone when the name is no longer used.
+        //---------------------------------------------------------------------
+        void release(uint32_t const id, std::string_view const name)
+        {
+            uint64_t const h = hash(name);
+            size_t const mask = m_slots.size() - 1u;
+            for (size_t i = size_t(h) & mask; m_slots[i].id != 0u; i = (i + 1u) & mask)
+            {
+                Slot& slot = m_slots[i];
+                if ((slot.id == id) && (slot.references != 0u))
+                {
+                    if (--slot.references == 0u)
+                    {
+                        slot.name.clear();
+                        --m_live;
+                    }
+                    return ;
+                }
+            }
+        }
+
+        //---------------------------------------------------------------------
+        void clear()
+        {
+            m_slots.clear();
+            m_used = 0u;
+            m_live = 0u;
+        }
+
+    private:
+
+        struct Slot
+        {
+            //! \brief Identifier (0: never used slot).
+            uint32_t id = 0u;
+            //! \brief Number of nodes using this name (0: tombstone).
+            uint32_t references = 0u;
+            //! \brief Precomputed hash of the name.
+            uint64_t hash = 0u;
+            //! \brief The interned name.
+            std::string name;
+        };
+
+        void rehash(size_t const capacity)
+        {
+            std::vector<Slot> slots(capacity);
+            size_t const mask = capacity - 1u;
+            m_used = 0u;
+            for (Slot& slot: m_slots)
+            {
+                if (slot.references == 0u)
+                    continue;
+                size_t i = size_t(slot.hash) & mask;
+                while (slots[i].id != 0u)
+                {
+                    i = (i + 1u) & mask;
+                }
+                slots[i] = std::move(slot);
+                ++m_used;
+            }
+            m_slots.swap(slots);
+        }
+
+    private:
+
+        //! \brief Power of two number of slots.
+        std::vector<Slot> m_slots;
+        //! \brief Number of slots holding a name or a tombstone.
+        size_t m_used = 0u;
+        //! \brief Number of slots holding a name.
+        size_t m_live = 0u;
+        //! \brief Next identifier (0 is reserved).
+        uint32_t m_next_id = 1u;
+    };
+
+    //-------------------------------------------------------------------------
+    //! \brief Call the functor on each level of the topic (the separator '/'
+    //! is not included). Empty levels are valid MQTT levels.
+    //-------------------------------------------------------------------------
+    template<class F>
+    static void forEachLevel(std::string_view topic, F&& f)
+    {
+        while (true)
+        {
+            size_t const end = topic.find('/');
+            f(topic.substr(0u, end));
+            if (end == std::string_view::npos)
+                return ;
+            topic.remove_prefix(end + 1u);
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    static bool isWildcard(std::string_view const level, char const wildcard)
+    {
+        return (level.size() == 1u) && (level[0] == wildcard);
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Recursive removal of the filter starting at the given level.
+    //! Prune the nodes becoming useless when unwinding.
+    //-------------------------------------------------------------------------
+    bool erase(Node& node, std::string_view const filter)
+    {
+        size_t const end = filter.find('/');
+        std::string_view const level = filter.substr(0u, end);
+        std::unique_ptr<Node>* child;
+        if (isWildcard(level, '+'))
+        {
+            child = &node.plus;
+        }
+        else if (isWildcard(level, '#'))
+        {
+            child = &node.hash;
+        }
+        else
+        {
+            auto it = node.children.find(m_symbols.find(level, hash(level)));
+            if (it == node.children.end())
+                return false;
+            child = &it->second;
+        }
+
+        if (*child == nullptr)
+            return false;
+
+        if (end == std::string_view::npos)
+        {
+            if (!(*child)->used)
+                return false;
+            (*child)->used = false;
+            (*child)->value = T{};
+        }
+        else if (!erase(**child, filter.substr(end + 1u)))
+        {
+            return false;
+        }
+
+        if ((*child)->useless())
+        {
+            uint32_t const symbol = (*child)->symbol;
+            child->reset();
+            if (symbol != 0u)
+            {
+                node.children.erase(symbol);
+                m_symbols.release(symbol, level);
+            }
+        }
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Recursive lookup of the topic starting at the given level.
+    //! \param[in] dollar true when wildcards shall not match this level
+    //! because the topic is starting by '$'.
+    //-------------------------------------------------------------------------
+    template<class Visitor>
+    size_t match(Node const& node, std::string_view const topic, bool const dollar,
+                 Visitor& visitor) const
+    {
+        size_t count = 0u;
+
+        // '#' also matches the parent level: "a/#" matches "a".
+        if ((node.hash != nullptr) && (!dollar) && (node.hash->used))
+        {
+            visitor(node.hash->value);
+            ++count;
+        }
+
+        size_t const end = topic.find('/');
+        std::string_view const level = topic.substr(0u, end);
+        std::string_view const next = (end == std::string_view::npos)
+            ? std::string_view() : topic.substr(end + 1u);
+        bool const last = (end == std::string_view::npos);
+
+        if (!node.children.empty())
+        {
+            auto it = node.children.find(m_symbols.find(level, hash(level)));
+            if (it != node.children.end())
+            {
+                count += matchChild(*it->second, next, last, visitor);
+            }
+        }
+
+        if ((node.plus != nullptr) && (!dollar))
+        {
+            count += matchChild(*node.plus, next, last, visitor);
+        }
+
+        return count;
+    }
+
+    //-------------------------------------------------------------------------
+    template<class Visitor>
+    size_t matchChild(Node const& child, std::string_view const next,
+                      bool const last, Visitor& visitor) const
+    {
+        if (!last)
+            return match(child, next, false, visitor);
+
+        size_t count = 0u;
+        if (child.used)
+        {
+            visitor(child.value);
+            ++count;
+        }
+        if ((child.hash != nullptr) && (child.hash->used))
+        {
+            visitor(child.hash->value);
+            ++count;
+        }
+        return count;
+    }
+
+private:
+
+    //! \brief The root level (not part of the topic).
+    Node m_root;
+    //! \brief Interned level names.
+    Symbols m_symbols;
+    //! \brief Number of filters.
+    size_t m_size = 0u;
+};
+
+} // namespace mqtt
+
+#endif // ASYNC_MQTT_TOPIC_TREE_HPP
@@ -0,0 +1,392 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/Capture.hpp"
+#include "MQTT/TopicTree.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mqtt {
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x4354514Du; // "MQTC"
+constexpr uint32_t VERSION = 1u;
+//! \brief Offset of the first record, after the file header.
+constexpr size_t DATA = 64u;
+
+//! \brief Kinds of records.
+constexpr uint8_t TOPIC = 1u;
+constexpr uint8_t MESSAGE = 2u;
+
+//-----------------------------------------------------------------------------
+//! \brief Header of the file, updated after each record.
+//-----------------------------------------------------------------------------
+struct FileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    //! \brief Offset after the last record.
+    uint64_t tail;
+    //! \brief Number of messages and of topics.
+    uint64_t messages;
+    uint64_t topics;
+};
+
+//-----------------------------------------------------------------------------
+//! \brief Header of records, followed by the topic name (TOPIC) or the
+//! payload (MESSAGE). Records are aligned on 8 bytes.
+//-----------------------------------------------------------------------------
+struct RecordHeader
+{
+    uint64_t timestamp;
+    //! \brief Size of the name or of the payload.
+    uint32_t size;
+    //! \brief Number of the topic.
+    uint32_t topic;
+    uint8_t kind;
+    uint8_t qos;
+    uint8_t retain;
+    uint8_t reserved[5];
+};
+
+static_assert(sizeof(RecordHeader) == 24u, "Unexpected padding");
+
+constexpr size_t align(size_t const n)
+{
+    return (n + 7u) & ~size_t(7u);
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+CaptureLog::CaptureLog(std::string path, size_t const growth)
+    : m_path(std::move(path)),
+      m_growth(std::max<size_t>(align(growth), 4096u))
+{}
+
+//-----------------------------------------------------------------------------
+CaptureLog::~CaptureLog()
+{
+    close();
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureLog::open()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_fd >= 0)
+        return true;
+
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0)
+        return false;
+
+    m_tail = DATA;
+    m_messages = 0u;
+    m_topics.clear();
+    m_names.clear();
+    if (!reserve(0u))
+    {
+        int const error = errno;
+        ::close(m_fd);
+        m_fd = -1;
+        errno = error;
+        return false;
+    }
+
+    FileHeader header{};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.tail = m_tail;
+    std::memcpy(m_base, &header, sizeof(header));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureLog::reserve(size_t const length)
+{
+    if ((m_base != nullptr) && (m_tail + length <= m_capacity))
+        return true;
+
+    // Grow by steps for not remapping the file on each record.
+    size_t const capacity = ((m_tail + length) / m_growth + 1u) * m_growth;
+    if (::ftruncate(m_fd, off_t(capacity)) != 0)
+        return false;
+
+    void* address = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, m_fd, 0);
+    if (address == MAP_FAILED)
+        return false;
+
+    if (m_base != nullptr)
+    {
+        ::munmap(m_base, m_capacity);
+    }
+    m_base = static_cast<uint8_t*>(address);
+    m_capacity = capacity;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+uint8_t* CaptureLog::write(uint8_t const kind, uint64_t const timestamp,
+                           uint32_t const topic, size_t const size)
+{
+    size_t const length = align(sizeof(RecordHeader) + size);
+    if (!reserve(length))
+        return nullptr;
+
+    RecordHeader record{};
+    record.timestamp = timestamp;
+    record.size = uint32_t(size);
+    record.topic = topic;
+    record.kind = kind;
+    uint8_t* data = m_base + m_tail;
+    std::memcpy(data, &record, sizeof(record));
+    m_tail += length;
+    return data;
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureLog::append(uint64_t const timestamp, std::string_view const topic,
+                        uint8_t const* payload, size_t const size,
+                        int const qos, bool const retain)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_fd < 0)
+    {
+        errno = EBADF;
+        ++m_lost;
+        return false;
+    }
+    if (size > 0xFFFFFFFFu)
+    {
+        errno = EMSGSIZE;
+        ++m_lost;
+        return false;
+    }
+
+    // Define the topic on its first message.
+    uint64_t const hash = topicHash(topic);
+    uint32_t number = uint32_t(m_names.size());
+    auto const range = m_topics.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (m_names[it->second] == topic)
+        {
+            number = it->second;
+            break;
+        }
+    }
+    if (number == m_names.size())
+    {
+        uint8_t* record = write(TOPIC, timestamp, number, topic.size());
+        if (record == nullptr)
+        {
+            ++m_lost;
+            return false;
+        }
+        std::memcpy(record + sizeof(RecordHeader), topic.data(), topic.size());
+        m_topics.emplace(hash, number);
+        m_names.emplace_back(topic);
+    }
+
+    uint8_t* record = write(MESSAGE, timestamp, number, size);
+    if (record == nullptr)
+    {
+        ++m_lost;
+        return false;
+    }
+    record[offsetof(RecordHeader, qos)] = uint8_t(qos);
+    record[offsetof(RecordHeader, retain)] = retain ? 1u : 0u;
+    if (size != 0u)
+    {
+        std::memcpy(record + sizeof(RecordHeader), payload, size);
+    }
+    ++m_messages;
+
+    // Publish the records once written.
+    FileHeader& header = *reinterpret_cast<FileHeader*>(m_base);
+    header.messages = m_messages;
+    header.topics = m_names.size();
+    header.tail = m_tail;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void CaptureLog::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_base != nullptr)
+    {
+        ::munmap(m_base, m_capacity);
+        m_base = nullptr;
+        m_capacity = 0u;
+    }
+    if (m_fd >= 0)
+    {
+        // Drop the room reserved for the next records. On failure, readers
+        // stop at the tail given by the header anyway.
+        int const truncated = ::ftruncate(m_fd, off_t(m_tail));
+        (void) truncated;
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+size_t CaptureLog::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_messages;
+}
+
+//-----------------------------------------------------------------------------
+size_t CaptureLog::lost() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lost;
+}
+
+//-----------------------------------------------------------------------------
+CaptureReader::~CaptureReader()
+{
+    close();
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureReader::open(std::string const& path)
+{
+    close();
+
+    int const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat status;
+    if (::fstat(fd, &status) != 0)
+    {
+        int const error = errno;
+        ::close(fd);
+        errno = error;
+        return false;
+    }
+
+    void* address = MAP_FAILED;
+    size_t const size = size_t(status.st_size);
+    if (size >= DATA)
+    {
+        address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    else
+    {
+        errno = EINVAL;
+    }
+    int const error = errno;
+    ::close(fd);
+    if (address == MAP_FAILED)
+    {
+        errno = error;
+        return false;
+    }
+
+    FileHeader header;
+    std::memcpy(&header, address, sizeof(header));
+    if ((header.magic != MAGIC) || (header.version != VERSION) ||
+        (header.tail < DATA) || (header.tail > size))
+    {
+        ::munmap(address, size);
+        errno = EINVAL;
+        return false;
+    }
+
+    // Records are read once, in order.
+    ::madvise(address, size, MADV_SEQUENTIAL);
+    m_base = static_cast<uint8_t const*>(address);
+    m_size = size;
+    m_first = m_head = DATA;
+    m_tail = size_t(header.tail);
+    m_messages = size_t(header.messages);
+    m_topics.reserve(size_t(std::min<uint64_t>(header.topics, m_tail / DATA)));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void CaptureReader::close()
+{
+    if (m_base != nullptr)
+    {
+        ::munmap(const_cast<uint8_t*>(m_base), m_size);
+        m_base = nullptr;
+    }
+    m_size = m_first = m_head = m_tail = m_messages = 0u;
+    m_topics.clear();
+}
+
+//-----------------------------------------------------------------------------
+bool CaptureReader::next(Record& record)
+{
+    while (m_head + sizeof(RecordHeader) <= m_tail)
+    {
+        RecordHeader entry;
+        std::memcpy(&entry, m_base + m_head, sizeof(entry));
+        size_t const length = align(sizeof(RecordHeader) + entry.size);
+        if (m_head + length > m_tail)
+            return false;
+
+        uint8_t const* data = m_base + m_head + sizeof(RecordHeader);
+        m_head += length;
+        if (entry.kind == TOPIC)
+        {
+            // Already known when read again after rewind().
+            if (entry.topic == m_topics.size())
+            {
+                m_topics.emplace_back(reinterpret_cast<char const*>(data),
+                                      entry.size);
+            }
+            continue;
+        }
+        if ((entry.kind != MESSAGE) || (entry.topic >= m_topics.size()))
+            return false;
+
+        record.timestamp = entry.timestamp;
+        record.topic = entry.topic;
+        record.name = m_topics[entry.topic];
+        record.payload = data;
+        record.size = entry.size;
+        record.qos = entry.qos;
+        record.retain = (entry.retain != 0u);
+        return true;
+    }
+    return false;
+}
+
+} // namespace mqtt
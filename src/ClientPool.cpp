@@ -0,0 +1,134 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/ClientPool.hpp"
+#include <algorithm>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+ClientPool::ClientPool(size_t const size, Client::Settings const& settings,
+                       Routing const routing)
+    : m_routing(routing)
+{
+    size_t const count = std::max<size_t>(1u, size);
+    m_clients.reserve(count);
+    for (size_t i = 0u; i < count; ++i)
+    {
+        Client::Settings member = settings;
+        if (!settings.client_id.empty())
+        {
+            member.client_id += "-" + std::to_string(i);
+        }
+        m_clients.emplace_back(new Client(member));
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool ClientPool::check(Client const& client, bool const result)
+{
+    if (!result)
+    {
+        std::error_code const error = client.error();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = error;
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+bool ClientPool::connect(Client::Connection const& settings,
+                         Client::ConnectionCallback onConnected,
+                         Client::ConnectionCallback onDisconnected)
+{
+    bool res = true;
+    for (auto& client: m_clients)
+    {
+        res &= check(*client, client->connect(settings, onConnected, onDisconnected));
+    }
+    return res;
+}
+
+//-----------------------------------------------------------------------------
+bool ClientPool::disconnect()
+{
+    bool res = true;
+    for (auto& client: m_clients)
+    {
+        res &= check(*client, client->disconnect());
+    }
+    return res;
+}
+
+//-----------------------------------------------------------------------------
+Client& ClientPool::route(Topic const& topic)
+{
+    size_t const index = (m_routing == Routing::RoundRobin)
+        ? m_next.fetch_add(1u, std::memory_order_relaxed)
+        : size_t(topicHash(topic.name));
+    return *m_clients[index % m_clients.size()];
+}
+
+//-----------------------------------------------------------------------------
+bool ClientPool::publish(Topic& topic, uint8_t const* payload, size_t const size,
+                         QoS const qos)
+{
+    Client& client = route(topic);
+    return check(client, client.publish(topic, payload, size, qos));
+}
+
+//-----------------------------------------------------------------------------
+Client::Status ClientPool::status() const
+{
+    bool all = true;
+    for (auto const& client: m_clients)
+    {
+        Client::Status const status = client->status();
+        if (status == Client::Status::InDefect)
+            return Client::Status::InDefect;
+        all &= (status == Client::Status::Connected);
+    }
+    return all ? Client::Status::Connected : Client::Status::Disconnected;
+}
+
+//-----------------------------------------------------------------------------
+size_t ClientPool::connected() const
+{
+    return size_t(std::count_if(m_clients.begin(), m_clients.end(),
+        [](std::unique_ptr<Client> const& client)
+    {
+        return client->status() == Client::Status::Connected;
+    }));
+}
+
+//-----------------------------------------------------------------------------
+std::error_code ClientPool::error() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_error;
+}
+
+} // namespace mqtt
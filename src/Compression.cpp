@@ -0,0 +1,406 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/Compression.hpp"
+#include <cstdlib>
+#include <cstring>
+
+#ifdef MQTT_WITH_ZSTD
+#  include <zstd.h>
+#endif
+#ifdef MQTT_WITH_LZ4
+#  include <lz4frame.h>
+#endif
+
+namespace mqtt {
+
+namespace {
+
+//-----------------------------------------------------------------------------
+//! \brief Buffers of the thread for compressed and decompressed payloads.
+//-----------------------------------------------------------------------------
+std::vector<uint8_t>& compressionBuffer()
+{
+    thread_local std::vector<uint8_t> buffer;
+    return buffer;
+}
+
+#if defined(MQTT_WITH_ZSTD) || defined(MQTT_WITH_LZ4)
+std::vector<uint8_t>& decompressionBuffer()
+{
+    thread_local std::vector<uint8_t> buffer;
+    return buffer;
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Does the payload start with the given frame magic number (stored in
+//! little endian)?
+//-----------------------------------------------------------------------------
+bool hasMagic(uint8_t const* data, size_t const size, uint32_t const magic)
+{
+    return (size >= 4u) &&
+           (data[0] == uint8_t(magic)) && (data[1] == uint8_t(magic >> 8)) &&
+           (data[2] == uint8_t(magic >> 16)) && (data[3] == uint8_t(magic >> 24));
+}
+
+constexpr uint32_t ZSTD_FRAME_MAGIC = 0xFD2FB528u;
+constexpr uint32_t LZ4_FRAME_MAGIC = 0x184D2204u;
+#endif
+
+#ifdef MQTT_WITH_ZSTD
+//-----------------------------------------------------------------------------
+//! \brief zstd contexts of the thread.
+//-----------------------------------------------------------------------------
+struct ZstdContexts
+{
+    ~ZstdContexts()
+    {
+        ZSTD_freeCCtx(compression);
+        ZSTD_freeDCtx(decompression);
+    }
+
+    ZSTD_CCtx* compression = ZSTD_createCCtx();
+    ZSTD_DCtx* decompression = ZSTD_createDCtx();
+};
+
+ZstdContexts& zstd()
+{
+    thread_local ZstdContexts contexts;
+    return contexts;
+}
+#endif
+
+#ifdef MQTT_WITH_LZ4
+//-----------------------------------------------------------------------------
+//! \brief LZ4 decompression context of the thread.
+//-----------------------------------------------------------------------------
+struct Lz4Context
+{
+    Lz4Context()
+    {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&decompression, LZ4F_VERSION)))
+            decompression = nullptr;
+    }
+
+    ~Lz4Context()
+    {
+        if (decompression != nullptr)
+            LZ4F_freeDecompressionContext(decompression);
+    }
+
+    LZ4F_dctx* decompression = nullptr;
+};
+
+LZ4F_dctx* lz4()
+{
+    thread_local Lz4Context context;
+    return context.decompression;
+}
+#endif
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+Compressor::Compressor(Compression const algorithm, size_t const threshold,
+                       int const level, bool const v5, bool const sniff)
+    : m_algorithm(supported(algorithm) ? algorithm : Compression::None),
+      m_threshold(threshold), m_level(level), m_v5(v5), m_sniff(sniff)
+{
+    if (v5 && (m_algorithm != Compression::None))
+    {
+        mosquitto_property_add_string_pair(
+            &m_properties, MQTT_PROP_USER_PROPERTY, "content-encoding",
+            (m_algorithm == Compression::Zstd) ? "zstd" : "lz4");
+    }
+}
+
+//-----------------------------------------------------------------------------
+Compressor::~Compressor()
+{
+#ifdef MQTT_WITH_ZSTD
+    for (auto& dictionary: m_dictionaries)
+    {
+        ZSTD_freeCDict(static_cast<ZSTD_CDict*>(dictionary.compression));
+        ZSTD_freeDDict(static_cast<ZSTD_DDict*>(dictionary.decompression));
+    }
+#endif
+    mosquitto_property_free_all(&m_properties);
+}
+
+//-----------------------------------------------------------------------------
+bool Compressor::supported(Compression const algorithm)
+{
+    switch (algorithm)
+    {
+    case Compression::None:
+        return true;
+    case Compression::LZ4:
+#ifdef MQTT_WITH_LZ4
+        return true;
+#else
+        return false;
+#endif
+    case Compression::Zstd:
+#ifdef MQTT_WITH_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+bool Compressor::addDictionary(std::string const& prefix,
+                               uint8_t const* dictionary, size_t const size)
+{
+#ifdef MQTT_WITH_ZSTD
+    unsigned const id = ZSTD_getDictID_fromDict(dictionary, size);
+    if (id == 0u)
+        return false;
+
+    int const level = (m_level == 0) ? ZSTD_CLEVEL_DEFAULT : m_level;
+    ZSTD_CDict* cdict = ZSTD_createCDict(dictionary, size, level);
+    ZSTD_DDict* ddict = ZSTD_createDDict(dictionary, size);
+    if ((cdict == nullptr) || (ddict == nullptr))
+    {
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+        return false;
+    }
+    m_dictionaries.push_back({prefix, id, cdict, ddict});
+    return true;
+#else
+    (void) prefix; (void) dictionary; (void) size;
+    return false;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+Compressor::Dictionary const*
+Compressor::dictionaryOf(std::string_view const topic) const
+{
+    Dictionary const* found = nullptr;
+    for (auto const& dictionary: m_dictionaries)
+    {
+        if ((topic.compare(0u, dictionary.prefix.size(), dictionary.prefix) == 0) &&
+            ((found == nullptr) || (dictionary.prefix.size() > found->prefix.size())))
+        {
+            found = &dictionary;
+        }
+    }
+    return found;
+}
+
+//-----------------------------------------------------------------------------
+bool Compressor::compress(std::string_view const topic, uint8_t const* data,
+                          size_t const size, uint8_t const*& out,
+                          size_t& out_size) const
+{
+    if ((m_algorithm == Compression::None) || (size < m_threshold))
+        return false;
+
+    std::vector<uint8_t>& buffer = compressionBuffer();
+    size_t compressed = 0u;
+#ifdef MQTT_WITH_ZSTD
+    if (m_algorithm == Compression::Zstd)
+    {
+        buffer.resize(ZSTD_compressBound(size));
+        Dictionary const* dictionary = dictionaryOf(topic);
+        compressed = (dictionary != nullptr)
+            ? ZSTD_compress_usingCDict(zstd().compression, buffer.data(),
+                  buffer.size(), data, size,
+                  static_cast<ZSTD_CDict const*>(dictionary->compression))
+            : ZSTD_compressCCtx(zstd().compression, buffer.data(), buffer.size(),
+                  data, size, (m_level == 0) ? ZSTD_CLEVEL_DEFAULT : m_level);
+        if (ZSTD_isError(compressed))
+            return false;
+    }
+#endif
+#ifdef MQTT_WITH_LZ4
+    if (m_algorithm == Compression::LZ4)
+    {
+        LZ4F_preferences_t preferences;
+        std::memset(&preferences, 0, sizeof(preferences));
+        preferences.frameInfo.contentSize = size;
+        preferences.compressionLevel = m_level;
+        buffer.resize(LZ4F_compressFrameBound(size, &preferences));
+        compressed = LZ4F_compressFrame(buffer.data(), buffer.size(), data,
+                                        size, &preferences);
+        if (LZ4F_isError(compressed))
+            return false;
+    }
+#endif
+    (void) topic; (void) data;
+
+    // Not worth it: send the payload as it is.
+    if ((compressed == 0u) || (compressed >= size))
+        return false;
+
+    out = buffer.data();
+    out_size = compressed;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+Compression Compressor::encodingOf(mosquitto_property const* properties,
+                                   uint8_t const* data, size_t const size) const
+{
+    if (m_v5)
+    {
+        // Look for the user property marking compressed messages. Strings are
+        // allocated by the mosquitto lib: only messages with user properties
+        // pay it.
+        Compression encoding = Compression::None;
+        char* name = nullptr;
+        char* value = nullptr;
+        for (bool skip = false;
+             (properties = mosquitto_property_read_string_pair(
+                  properties, MQTT_PROP_USER_PROPERTY, &name, &value, skip)) != nullptr;
+             skip = true)
+        {
+            if (strcmp(name, "content-encoding") == 0)
+            {
+                if (strcmp(value, "zstd") == 0)
+                    encoding = Compression::Zstd;
+                else if (strcmp(value, "lz4") == 0)
+                    encoding = Compression::LZ4;
+            }
+            free(name);
+            free(value);
+        }
+        return encoding;
+    }
+
+#if defined(MQTT_WITH_ZSTD) || defined(MQTT_WITH_LZ4)
+    if (m_sniff)
+    {
+#  ifdef MQTT_WITH_ZSTD
+        if (hasMagic(data, size, ZSTD_FRAME_MAGIC))
+            return Compression::Zstd;
+#  endif
+#  ifdef MQTT_WITH_LZ4
+        if (hasMagic(data, size, LZ4_FRAME_MAGIC))
+            return Compression::LZ4;
+#  endif
+    }
+#endif
+    (void) data; (void) size;
+    return Compression::None;
+}
+
+//-----------------------------------------------------------------------------
+bool Compressor::decompress(mosquitto_property const* properties,
+                            uint8_t const* data, size_t const size,
+                            uint8_t const*& out, size_t& out_size) const
+{
+    Compression const encoding = encodingOf(properties, data, size);
+    if (encoding == Compression::None)
+        return false;
+
+#ifdef MQTT_WITH_ZSTD
+    if ((encoding == Compression::Zstd) && hasMagic(data, size, ZSTD_FRAME_MAGIC))
+    {
+        std::vector<uint8_t>& buffer = decompressionBuffer();
+        unsigned long long const length = ZSTD_getFrameContentSize(data, size);
+        if ((length == ZSTD_CONTENTSIZE_UNKNOWN) ||
+            (length == ZSTD_CONTENTSIZE_ERROR) || (length > MAX_PAYLOAD_SIZE))
+            return false;
+
+        ZSTD_DDict const* ddict = nullptr;
+        unsigned const id = ZSTD_getDictID_fromFrame(data, size);
+        if (id != 0u)
+        {
+            for (auto const& dictionary: m_dictionaries)
+            {
+                if (dictionary.id == id)
+                    ddict = static_cast<ZSTD_DDict const*>(dictionary.decompression);
+            }
+            if (ddict == nullptr)
+                return false;
+        }
+
+        buffer.resize(size_t(length));
+        size_t const decompressed = (ddict != nullptr)
+            ? ZSTD_decompress_usingDDict(zstd().decompression, buffer.data(),
+                  buffer.size(), data, size, ddict)
+            : ZSTD_decompressDCtx(zstd().decompression, buffer.data(),
+                  buffer.size(), data, size);
+        if (ZSTD_isError(decompressed) || (decompressed != length))
+            return false;
+
+        out = buffer.data();
+        out_size = decompressed;
+        return true;
+    }
+#endif
+#ifdef MQTT_WITH_LZ4
+    if ((encoding == Compression::LZ4) && hasMagic(data, size, LZ4_FRAME_MAGIC))
+    {
+        LZ4F_dctx* context = lz4();
+        if (context == nullptr)
+            return false;
+        std::vector<uint8_t>& buffer = decompressionBuffer();
+
+        LZ4F_frameInfo_t info;
+        size_t consumed = size;
+        size_t rc = LZ4F_getFrameInfo(context, &info, data, &consumed);
+        if (LZ4F_isError(rc) || (info.contentSize == 0u) ||
+            (info.contentSize > MAX_PAYLOAD_SIZE))
+        {
+            LZ4F_resetDecompressionContext(context);
+            return false;
+        }
+
+        buffer.resize(size_t(info.contentSize));
+        size_t produced = 0u;
+        while ((rc != 0u) && (consumed < size) && (produced < buffer.size()))
+        {
+            size_t capacity = buffer.size() - produced;
+            size_t available = size - consumed;
+            rc = LZ4F_decompress(context, buffer.data() + produced, &capacity,
+                                 data + consumed, &available, nullptr);
+            if (LZ4F_isError(rc))
+                break;
+            produced += capacity;
+            consumed += available;
+        }
+        if (LZ4F_isError(rc) || (rc != 0u) || (produced != buffer.size()))
+        {
+            LZ4F_resetDecompressionContext(context);
+            return false;
+        }
+
+        out = buffer.data();
+        out_size = produced;
+        return true;
+    }
+#endif
+    (void) data; (void) size; (void) out; (void) out_size;
+    return false;
+}
+
+} // namespace mqtt
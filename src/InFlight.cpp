@@ -0,0 +1,246 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/InFlight.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+size_t LatencyHistogram::indexOf(uint64_t const value)
+{
+    if (value < SUB_COUNT)
+        return size_t(value);
+
+    // Magnitude of the value, then its linear position inside the magnitude.
+    unsigned const magnitude = 63u - unsigned(__builtin_clzll(value));
+    uint64_t const sub = (value >> (magnitude - SUB_BITS)) - SUB_COUNT;
+    return size_t((magnitude - SUB_BITS + 1u) * SUB_COUNT + sub);
+}
+
+//-----------------------------------------------------------------------------
+uint64_t LatencyHistogram::highestOf(size_t const index)
+{
+    if (index < SUB_COUNT)
+        return uint64_t(index);
+
+    unsigned const shift = unsigned(index / SUB_COUNT) - 1u;
+    uint64_t const sub = uint64_t(index % SUB_COUNT) + SUB_COUNT;
+    return (sub << shift) + (uint64_t(1) << shift) - 1u;
+}
+
+//-----------------------------------------------------------------------------
+void LatencyHistogram::record(std::chrono::nanoseconds const duration)
+{
+    constexpr uint64_t highest = (uint64_t(1) << MAX_BITS) - 1u;
+    uint64_t const value = std::min<uint64_t>(
+        uint64_t(std::max<std::chrono::nanoseconds::rep>(0, duration.count())),
+        highest);
+
+    m_buckets[indexOf(value)].fetch_add(1u, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+    // Single writer: no need for a compare-and-swap loop.
+    if (value < m_min.load(std::memory_order_relaxed))
+        m_min.store(value, std::memory_order_relaxed);
+    if (value > m_max.load(std::memory_order_relaxed))
+        m_max.store(value, std::memory_order_relaxed);
+    m_count.fetch_add(1u, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+std::chrono::nanoseconds LatencyHistogram::min() const
+{
+    if (count() == 0u)
+        return std::chrono::nanoseconds(0);
+    return std::chrono::nanoseconds(m_min.load(std::memory_order_relaxed));
+}
+
+//-----------------------------------------------------------------------------
+std::chrono::nanoseconds LatencyHistogram::max() const
+{
+    return std::chrono::nanoseconds(m_max.load(std::memory_order_relaxed));
+}
+
+//-----------------------------------------------------------------------------
+std::chrono::nanoseconds LatencyHistogram::mean() const
+{
+    uint64_t const n = count();
+    if (n == 0u)
+        return std::chrono::nanoseconds(0);
+    return std::chrono::nanoseconds(m_sum.load(std::memory_order_relaxed) / n);
+}
+
+//-----------------------------------------------------------------------------
+std::chrono::nanoseconds LatencyHistogram::percentile(double const quantile) const
+{
+    uint64_t const n = count();
+    if (n == 0u)
+        return std::chrono::nanoseconds(0);
+
+    double const q = std::min(1.0, std::max(0.0, quantile));
+    uint64_t const rank = std::max<uint64_t>(1u, uint64_t(std::ceil(q * double(n))));
+    uint64_t const highest = m_max.load(std::memory_order_relaxed);
+    uint64_t seen = 0u;
+    for (size_t i = 0u; i < BUCKETS; ++i)
+    {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return std::chrono::nanoseconds(std::min(highestOf(i), highest));
+    }
+    return std::chrono::nanoseconds(highest);
+}
+
+//-----------------------------------------------------------------------------
+void LatencyHistogram::reset()
+{
+    for (auto& bucket: m_buckets)
+    {
+        bucket.store(0u, std::memory_order_relaxed);
+    }
+    m_count.store(0u, std::memory_order_relaxed);
+    m_sum.store(0u, std::memory_order_relaxed);
+    m_min.store(UINT64_MAX, std::memory_order_relaxed);
+    m_max.store(0u, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+InFlightTable::InFlightTable(size_t const capacity)
+{
+    // Keep the load factor under one half.
+    size_t slots = 16u;
+    while (slots < 2u * capacity)
+    {
+        slots <<= 1u;
+    }
+    m_entries.resize(slots);
+}
+
+//-----------------------------------------------------------------------------
+size_t InFlightTable::slotOf(int const mid) const
+{
+    // Message ids are consecutive: they already spread over the slots.
+    return size_t(unsigned(mid)) & (m_entries.size() - 1u);
+}
+
+//-----------------------------------------------------------------------------
+void InFlightTable::grow()
+{
+    std::vector<Entry> entries(m_entries.size() * 2u);
+    entries.swap(m_entries);
+    for (auto const& entry: entries)
+    {
+        if (entry.mid == 0)
+            continue;
+
+        size_t slot = slotOf(entry.mid);
+        while (m_entries[slot].mid != 0)
+        {
+            slot = (slot + 1u) & (m_entries.size() - 1u);
+        }
+        m_entries[slot] = entry;
+    }
+}
+
+//-----------------------------------------------------------------------------
+void InFlightTable::open(int const mid, int const qos, Clock::time_point const sent)
+{
+    if (2u * (m_size.load(std::memory_order_relaxed) + 1u) > m_entries.size())
+    {
+        grow();
+    }
+
+    size_t slot = slotOf(mid);
+    while ((m_entries[slot].mid != 0) && (m_entries[slot].mid != mid))
+    {
+        slot = (slot + 1u) & (m_entries.size() - 1u);
+    }
+    if (m_entries[slot].mid == 0)
+    {
+        m_size.fetch_add(1u, std::memory_order_relaxed);
+    }
+    m_entries[slot].mid = mid;
+    m_entries[slot].qos = qos;
+    m_entries[slot].sent = sent;
+}
+
+//-----------------------------------------------------------------------------
+bool InFlightTable::close(int const mid)
+{
+    Clock::time_point const now = Clock::now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t const mask = m_entries.size() - 1u;
+    size_t hole = slotOf(mid);
+    while (m_entries[hole].mid != mid)
+    {
+        if (m_entries[hole].mid == 0)
+            return false;
+        hole = (hole + 1u) & mask;
+    }
+
+    Entry const& entry = m_entries[hole];
+    m_latencies[size_t(entry.qos) % m_latencies.size()].record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - entry.sent));
+
+    // Backward shift deletion: move up the following entries of the cluster
+    // which would no longer be reachable from their home slot.
+    size_t next = hole;
+    while (true)
+    {
+        next = (next + 1u) & mask;
+        if (m_entries[next].mid == 0)
+            break;
+
+        size_t const home = slotOf(m_entries[next].mid);
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            m_entries[hole] = m_entries[next];
+            hole = next;
+        }
+    }
+    m_entries[hole].mid = 0;
+    m_size.fetch_sub(1u, std::memory_order_relaxed);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+std::chrono::nanoseconds InFlightTable::oldest() const
+{
+    Clock::time_point const now = Clock::now();
+    Clock::time_point oldest = now;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto const& entry: m_entries)
+    {
+        if ((entry.mid != 0) && (entry.sent < oldest))
+        {
+            oldest = entry.sent;
+        }
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now - oldest);
+}
+
+} // namespace mqtt
@@ -25,28 +25,131 @@
 //*****************************************************************************
 
 #include "MQTT/MQTT.hpp"
+#include "MQTT/PublishBatch.hpp"
+#include "MQTT/Stream.hpp"
+#include "MQTT/Capture.hpp"
+#include <algorithm>
+#include <cerrno>
 #include <iostream>
+#include <map>
+#include <random>
+#include <netdb.h>
+#if defined(__linux__)
+#  include <pthread.h>
+#  include <sched.h>
+#endif
 
 namespace mqtt {
 
 // *************************************************************************
-//! \brief std::error_code instead of throw() or errno.
+//! \brief std::error_code instead of throw() or errno. Errors of the
+//! mosquitto lib.
 // *************************************************************************
 struct MQTTErrorCategory : std::error_category
 {
     virtual const char* name() const noexcept override { return "MQTT"; }
     virtual std::string message(int ec) const override
     {
-        if (!custom_message.empty())
-            return custom_message;
         return mosquitto_strerror(ec);
     }
+};
+
+// *************************************************************************
+//! \brief Errors detected by the wrapper (see Error).
+// *************************************************************************
+struct ClientErrorCategory : std::error_category
+{
+    virtual const char* name() const noexcept override { return "MQTT client"; }
+    virtual std::string message(int ec) const override;
+    virtual std::error_condition default_error_condition(int ec) const noexcept override;
+};
+
+// -----------------------------------------------------------------------------
+static MQTTErrorCategory const s_mqtt_error_category;
+static ClientErrorCategory const s_client_error_category;
 
-    std::string custom_message;
+// -----------------------------------------------------------------------------
+//! \brief Message and code of the mosquitto lib of each Error.
+// -----------------------------------------------------------------------------
+struct ClientError
+{
+    Error error;
+    int code;
+    char const* message;
+};
+
+static constexpr ClientError s_client_errors[] = {
+    { Error::EmptyTopic, MOSQ_ERR_INVAL, "topic name shall not be empty" },
+    { Error::InvalidPayload, MOSQ_ERR_INVAL, "invalid payload content or payload size" },
+    { Error::InvalidTopicHandle, MOSQ_ERR_INVAL, "invalid topic handle" },
+    { Error::MalformedTopicFilter, MOSQ_ERR_INVAL, "malformed topic filter" },
+    { Error::PolicyWithoutCallback, MOSQ_ERR_INVAL, "a delivery policy needs a callback" },
+    { Error::InvalidDictionary, MOSQ_ERR_INVAL, "invalid zstd dictionary" },
+    { Error::TooManyChunks, MOSQ_ERR_INVAL, "too many chunks" },
+    { Error::StreamAlreadyPublished, MOSQ_ERR_INVAL, "stream already published" },
+    { Error::InvalidCpu, MOSQ_ERR_INVAL, "invalid cpu number" },
+    { Error::PublishQueueFull, MOSQ_ERR_NOMEM, "publish queue full" },
+    { Error::PublishRateExceeded, MOSQ_ERR_NOMEM, "publish rate exceeded" },
+    { Error::CompressionNotCompiled, MOSQ_ERR_NOT_SUPPORTED,
+      "compression algorithm not compiled: payloads sent uncompressed" },
+    { Error::OptionsNeedV5, MOSQ_ERR_NOT_SUPPORTED, "subscription options need MQTT v5" },
+    { Error::TuningNeedsLinux, MOSQ_ERR_NOT_SUPPORTED,
+      "pinning and scheduling the network thread need Linux" },
+    { Error::TlsNeedsOpenSSL, MOSQ_ERR_NOT_SUPPORTED,
+      "TLS kernel offload needs MQTT_WITH_OPENSSL" },
+    { Error::OfflineQueueOpen, MOSQ_ERR_ERRNO, "cannot open the offline queue" },
+    { Error::OfflineQueueWrite, MOSQ_ERR_ERRNO, "cannot write in the offline queue" },
+    { Error::StreamRead, MOSQ_ERR_ERRNO, "cannot read the stream" },
+    { Error::CannotPinThread, MOSQ_ERR_ERRNO, "cannot pin the network thread" },
+    { Error::CannotScheduleThread, MOSQ_ERR_ERRNO, "cannot schedule the network thread" },
+    { Error::OfflineMessageTooBig, MOSQ_ERR_PAYLOAD_SIZE,
+      "message too big for the offline queue" },
+    { Error::InvalidTlsSettings, MOSQ_ERR_TLS, "invalid TLS settings or certificates" },
 };
 
 // -----------------------------------------------------------------------------
-static MQTTErrorCategory s_mqtt_error_category;
+//! \brief The table is indexed by the errors.
+// -----------------------------------------------------------------------------
+static constexpr bool indexed()
+{
+    for (size_t i = 0u; i < sizeof(s_client_errors) / sizeof(s_client_errors[0]); ++i)
+    {
+        if (int(s_client_errors[i].error) != int(i) + 1)
+            return false;
+    }
+    return true;
+}
+static_assert(indexed(), "s_client_errors shall follow the order of Error");
+
+// -----------------------------------------------------------------------------
+std::string ClientErrorCategory::message(int ec) const
+{
+    size_t const index = size_t(ec) - 1u;
+    if (index < (sizeof(s_client_errors) / sizeof(s_client_errors[0])))
+        return s_client_errors[index].message;
+    return "unknown error";
+}
+
+// -----------------------------------------------------------------------------
+std::error_condition ClientErrorCategory::default_error_condition(int ec) const noexcept
+{
+    size_t const index = size_t(ec) - 1u;
+    if (index < (sizeof(s_client_errors) / sizeof(s_client_errors[0])))
+        return { s_client_errors[index].code, s_mqtt_error_category };
+    return { MOSQ_ERR_UNKNOWN, s_mqtt_error_category };
+}
+
+// -----------------------------------------------------------------------------
+std::error_category const& mosquittoCategory() noexcept
+{
+    return s_mqtt_error_category;
+}
+
+// -----------------------------------------------------------------------------
+std::error_category const& clientCategory() noexcept
+{
+    return s_client_error_category;
+}
 
 // -----------------------------------------------------------------------------
 static std::error_code make_error_code(int ec)
@@ -55,27 +158,244 @@ static std::error_code make_error_code(int ec)
 }
 
 // -----------------------------------------------------------------------------
-static std::error_code make_error_code(int ec, std::string const& message)
+
+namespace {
+
+//-----------------------------------------------------------------------------
+//! \brief Acknowledgements of the packets of a request sent in several
+//! packets. The callback is called once with the greatest code, when all
+//! packets are acknowledged and the sender released its own reference.
+//-----------------------------------------------------------------------------
+struct Acknowledgements
 {
-    s_mqtt_error_category.custom_message = message;
-    return { ec, s_mqtt_error_category };
+    explicit Acknowledgements(Client::AckCallback&& callback_)
+        : callback(std::move(callback_))
+    {}
+
+    void acknowledge(int const rc)
+    {
+        int worst = code.load();
+        while ((rc > worst) && !code.compare_exchange_weak(worst, rc))
+        {}
+        if ((remaining.fetch_sub(1u) == 1u) && (!cancelled))
+        {
+            callback(code.load());
+        }
+    }
+
+    //! \brief Packets not yet acknowledged, plus one for the sender.
+    std::atomic<size_t> remaining{1u};
+    std::atomic<int> code{0};
+    //! \brief The request failed: do not call the callback.
+    std::atomic<bool> cancelled{false};
+    Client::AckCallback callback;
+};
+
+//-----------------------------------------------------------------------------
+//! \brief Packets needed for sending the topic filters, within the maximum
+//! packet size: call send(first, count) for each packet.
+//! \param[in] options the number of bytes following each filter.
+//-----------------------------------------------------------------------------
+template<class Send>
+int splitPackets(char* const* filters, size_t const count, size_t const options,
+                 uint32_t const maximum_packet_size, Send&& send)
+{
+    // Fixed header, packet id and length of MQTT v5 properties, at most.
+    constexpr size_t header = 5u + 2u + 4u;
+    size_t const limit = (maximum_packet_size == 0u)
+        ? size_t(268435455u) + 5u : size_t(maximum_packet_size);
+    size_t first = 0u;
+    size_t bytes = header;
+    for (size_t i = 0u; i < count; ++i)
+    {
+        size_t const entry = 2u + std::strlen(filters[i]) + options;
+        if ((i > first) && (bytes + entry > limit))
+        {
+            int const rc = send(filters + first, i - first);
+            if (rc != MOSQ_ERR_SUCCESS)
+                return rc;
+            first = i;
+            bytes = header;
+        }
+        bytes += entry;
+    }
+    return (count > first) ? send(filters + first, count - first)
+                           : MOSQ_ERR_SUCCESS;
 }
 
 //-----------------------------------------------------------------------------
-bool Client::libMosquittoInit(Protocol protocol)
+//! \brief Draw a reconnection delay in [delay, 2 * delay], capped at
+//! delay_max, so clients losing their connection at once do not reconnect in
+//! lock-step.
+//-----------------------------------------------------------------------------
+std::chrono::milliseconds jittered(std::chrono::milliseconds const delay,
+                                   std::chrono::milliseconds const delay_max)
 {
-    size_t& counter = libMosquittoCountInstances();
-    if (++counter > 1u)
-        return true;
+    thread_local std::minstd_rand random(std::random_device{}());
+    std::uniform_int_distribution<std::chrono::milliseconds::rep> draw(
+        delay.count(), 2 * delay.count());
+    return std::min(std::chrono::milliseconds(draw(random)),
+                    std::max(delay, delay_max));
+}
 
-    //std::cout << "Call mosquitto_lib_init" << std::endl;
-    int rc = mosquitto_lib_init();
-    if (rc != MOSQ_ERR_SUCCESS)
+//-----------------------------------------------------------------------------
+//! \brief Acknowledgements of QoS 0 messages raised while send() holds the
+//! lock of topic aliases: with Loop::Manual, the mosquitto lib writes them at
+//! once and calls on_published_wrapper() from mosquitto_publish().
+//-----------------------------------------------------------------------------
+struct Publishing
+{
+    //! \brief Client whose send() holds the lock on this thread.
+    void const* client = nullptr;
+    //! \brief Message ids, kept with their capacity.
+    std::vector<int> acknowledged;
+};
+
+thread_local Publishing s_publishing;
+
+//-----------------------------------------------------------------------------
+//! \brief Resolve the address of the broker into its numerical form, for
+//! not resolving it again for each client.
+//! \return the address as it is when it cannot be resolved.
+//-----------------------------------------------------------------------------
+std::string resolve(std::string const& address)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results = nullptr;
+    if (::getaddrinfo(address.c_str(), nullptr, &hints, &results) != 0)
+        return address;
+
+    char host[NI_MAXHOST];
+    bool const resolved = (::getnameinfo(results->ai_addr, results->ai_addrlen,
+        host, sizeof(host), nullptr, 0, NI_NUMERICHOST) == 0);
+    ::freeaddrinfo(results);
+    return resolved ? std::string(host) : address;
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+SharedMessage Message::share() const
+{
+    Message* copy = new Message();
+    if (mosquitto_message_copy(copy, this) != MOSQ_ERR_SUCCESS)
     {
-        m_mosquitto = nullptr;
-        m_status = Client::Status::InDefect;
-        m_error = make_error_code(rc);
-        return false;
+        delete copy;
+        return nullptr;
+    }
+
+    return SharedMessage(copy, [](Message const* message)
+    {
+        mosquitto_message_free_contents(const_cast<Message*>(message));
+        delete message;
+    });
+}
+
+//-----------------------------------------------------------------------------
+TopicHandle::TopicHandle(std::string_view const name, bool const retain)
+    : m_hash(topicHash(name))
+{
+    m_topic.name.assign(name.data(), name.size());
+    m_topic.retain = retain;
+    m_valid = (!name.empty()) && (name.size() <= 65535u) &&
+              (name.find_first_of(std::string_view("+#\0", 3u)) == std::string_view::npos);
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Errors of the calling thread on the last clients it failed on,
+//! keyed by the generation of the clients. Nothing to release when a client
+//! or a thread is destroyed.
+//-----------------------------------------------------------------------------
+struct ThreadErrors
+{
+    struct Entry
+    {
+        uint64_t generation = 0u;
+        std::error_code code;
+    } entries[Client::THREAD_CLIENTS];
+    //! \brief The entry replaced by the next client.
+    size_t next = 0u;
+};
+static thread_local ThreadErrors t_errors;
+
+//-----------------------------------------------------------------------------
+uint64_t Client::nextGeneration()
+{
+    static std::atomic<uint64_t> generations{0u};
+    return generations.fetch_add(1u, std::memory_order_relaxed) + 1u;
+}
+
+//-----------------------------------------------------------------------------
+void Client::setError(std::error_code const& error)
+{
+    ThreadErrors::Entry* entry = nullptr;
+    for (auto& candidate: t_errors.entries)
+    {
+        if (candidate.generation == m_generation)
+        {
+            entry = &candidate;
+            break;
+        }
+    }
+    if (entry == nullptr)
+    {
+        entry = &t_errors.entries[t_errors.next];
+        t_errors.next = (t_errors.next + 1u) % THREAD_CLIENTS;
+        entry->generation = m_generation;
+    }
+    entry->code = error;
+
+    uint64_t const category = (error.category() == s_mqtt_error_category) ? 1u
+                            : (error.category() == s_client_error_category) ? 2u : 0u;
+    m_last_error.store((category << 32) | uint32_t(error.value()),
+                       std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+std::error_code Client::error() const
+{
+    for (auto const& entry: t_errors.entries)
+    {
+        if (entry.generation == m_generation)
+            return entry.code;
+    }
+    return std::error_code();
+}
+
+//-----------------------------------------------------------------------------
+std::error_code Client::lastError() const
+{
+    uint64_t const last = m_last_error.load(std::memory_order_relaxed);
+    int const value = int(uint32_t(last));
+    switch (last >> 32)
+    {
+    case 1u:
+        return { value, s_mqtt_error_category };
+    case 2u:
+        return { value, s_client_error_category };
+    default:
+        return std::error_code();
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool Client::libMosquittoInit(Protocol protocol)
+{
+    LibMosquitto& lib = libMosquitto();
+    std::lock_guard<std::mutex> lock(lib.mutex);
+    if (++lib.instances == 1u)
+    {
+        //std::cout << "Call mosquitto_lib_init" << std::endl;
+        int rc = mosquitto_lib_init();
+        if (rc != MOSQ_ERR_SUCCESS)
+        {
+            m_mosquitto = nullptr;
+            m_status = Client::Status::InDefect;
+            setError(make_error_code(rc));
+            return false;
+        }
     }
 
     mosquitto_lib_version(&m_version.mosquitto[0],
@@ -99,8 +419,6 @@ bool Client::libMosquittoInit(Protocol protocol)
         m_version.protocol[2] = 0;
         break;
     }
-
-    mosquitto_int_option(m_mosquitto, MOSQ_OPT_PROTOCOL_VERSION, int(protocol));
     return true;
 }
 
@@ -111,25 +429,25 @@ bool Client::instantiate(char const* client_id, const bool clean_session)
     if (m_mosquitto == nullptr)
     {
         m_status = Client::Status::InDefect;
-        m_error = make_error_code(
-            MOSQ_ERR_NOMEM, "MQTT Error: cannot malloc mosquitto");
+        setError(make_error_code(MOSQ_ERR_NOMEM));
         return false;
     }
 
-    mosquitto_connect_callback_set(m_mosquitto, on_connected_wrapper);
+    mosquitto_connect_v5_callback_set(m_mosquitto, on_connected_wrapper);
     mosquitto_disconnect_callback_set(m_mosquitto, on_disconnected_wrapper);
     mosquitto_publish_callback_set(m_mosquitto, on_published_wrapper);
     mosquitto_subscribe_callback_set(m_mosquitto, on_subscribed_wrapper);
     mosquitto_unsubscribe_callback_set(m_mosquitto, on_unsubscribed_wrapper);
-    mosquitto_message_callback_set(m_mosquitto, on_message_received_wrapper);
+    mosquitto_message_v5_callback_set(m_mosquitto, on_message_received_wrapper);
     return true;
 }
 
 //-----------------------------------------------------------------------------
 void Client::libMosquittoCleanUp()
 {
-    size_t& counter = libMosquittoCountInstances();
-    if (--counter == 0u)
+    LibMosquitto& lib = libMosquitto();
+    std::lock_guard<std::mutex> lock(lib.mutex);
+    if (--lib.instances == 0u)
     {
         //std::cout << "Call mosquitto_lib_cleanup" << std::endl;
         mosquitto_lib_cleanup();
@@ -138,18 +456,168 @@ void Client::libMosquittoCleanUp()
 
 //-----------------------------------------------------------------------------
 Client::Client(Client::Settings const& settings)
+    : m_inflight(settings.max_inflight_messages),
+      m_compressor(settings.compression, settings.compression_threshold,
+                   settings.compression_level,
+                   settings.protocol == Protocol::V5,
+                   settings.compression_sniffing),
+      m_cache(settings.cache_topics, settings.cache_max_payload)
 {
+    m_reconnection.mode = settings.reconnection;
+    m_reconnection.delay = settings.reconnect_delay;
+    m_reconnection.delay_max = settings.reconnect_delay_max;
+    m_v5.protocol = settings.protocol;
+    m_v5.maximum_packet_size = settings.maximum_packet_size;
+    m_v5.topic_aliases = settings.topic_aliases;
+    if (m_compressor.algorithm() != settings.compression)
+    {
+        setError(make_error_code(Error::CompressionNotCompiled));
+    }
+
+    if (!settings.offline_directory.empty())
+    {
+        m_offline.batch = std::max<size_t>(1u, settings.offline_batch);
+        m_offline.rate = settings.offline_rate;
+        m_offline.queue.reset(new OfflineQueue(settings.offline_directory,
+            settings.offline_segment_size, settings.offline_capacity));
+        if (m_offline.queue->open())
+        {
+            // Messages kept from a previous run.
+            m_offline.pending = !m_offline.queue->empty();
+            m_offline.thread = std::thread(&Client::replay, this);
+        }
+        else
+        {
+            setError(make_error_code(Error::OfflineQueueOpen));
+            m_offline.queue.reset();
+        }
+    }
+
+    if (settings.publish_queue != 0u)
+    {
+        size_t const capacity = std::min<size_t>(settings.publish_queue, 0xFFFFFFFFu);
+        m_outbound.slots.resize(capacity);
+        m_outbound.free.reset(new RingBuffer<uint32_t>(capacity));
+        size_t const lanes = std::max<size_t>(1u, settings.publish_lanes);
+        for (size_t i = 0u; i < lanes; ++i)
+        {
+            size_t const weight = settings.publish_weights.empty() ? 0u
+                : std::max<size_t>(1u, (i < settings.publish_weights.size())
+                                   ? settings.publish_weights[i]
+                                   : settings.publish_weights.back());
+            m_outbound.lanes.emplace_back(new OutboundLane(capacity, weight));
+        }
+        for (uint32_t i = 0u; i < uint32_t(capacity); ++i)
+        {
+            m_outbound.slots[i].payload.reserve(settings.publish_slot_size);
+            m_outbound.free->push(uint32_t(i));
+        }
+    }
+
+    m_loopback = settings.loopback;
+    if (settings.publish_limit.enabled() || !settings.publish_rules.empty())
+    {
+        m_limiter.reset(new RateLimiter(settings.publish_limit,
+            settings.publish_rules, m_outbound.lanes.size()));
+    }
+    m_inbound.backpressure = settings.backpressure;
+    m_inbound.ordering_key = settings.ordering_key;
+    if (settings.delivery == Client::Delivery::Queued)
+    {
+        m_inbound.lanes.emplace_back(new Lane(settings.queue_capacity));
+        Lane& lane = *m_inbound.lanes.back();
+        for (size_t i = 0u; i < settings.consumer_threads; ++i)
+        {
+            lane.threads.emplace_back(&Client::consume, this, std::ref(lane));
+        }
+    }
+    else if (settings.delivery == Client::Delivery::Ordered)
+    {
+        size_t const workers = std::max<size_t>(1u, settings.consumer_threads);
+        for (size_t i = 0u; i < workers; ++i)
+        {
+            m_inbound.lanes.emplace_back(new Lane(settings.queue_capacity));
+            Lane& lane = *m_inbound.lanes.back();
+            lane.threads.emplace_back(&Client::consume, this, std::ref(lane));
+        }
+    }
+
     if (libMosquittoInit(settings.protocol))
     {
-        instantiate(settings.client_id.size() == 0u ? nullptr :
-                    settings.client_id.c_str(),
-                    settings.session == Client::Session::Cleanup);
+        if (instantiate(settings.client_id.size() == 0u ? nullptr :
+                        settings.client_id.c_str(),
+                        settings.session == Client::Session::Cleanup))
+        {
+            // The protocol shall be set before connecting.
+            mosquitto_int_option(m_mosquitto, MOSQ_OPT_PROTOCOL_VERSION,
+                                 int(settings.protocol));
+            mosquitto_max_inflight_messages_set(
+                m_mosquitto, unsigned(settings.max_inflight_messages));
+            if ((settings.protocol == Protocol::V5) &&
+                (settings.receive_maximum != 0u))
+            {
+                mosquitto_int_option(m_mosquitto, MOSQ_OPT_RECEIVE_MAXIMUM,
+                                     int(settings.receive_maximum));
+            }
+            if (m_reconnection.mode == Client::Reconnection::Managed)
+            {
+                jitterReconnectDelay();
+            }
+        }
     }
 }
 
+//-----------------------------------------------------------------------------
+Client::Client()
+    : Client(Client::Settings())
+{}
+
 //-----------------------------------------------------------------------------
 Client::~Client()
 {
+    if (m_outbound.thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_outbound.mutex);
+            m_outbound.stopping = true;
+        }
+        m_outbound.signal.notify_all();
+        m_outbound.thread.join();
+    }
+    if (!m_outbound.lanes.empty())
+    {
+        flushOutbound(true);
+    }
+    if (m_conflation.thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_conflation.mutex);
+            m_conflation.stopping = true;
+        }
+        m_conflation.signal.notify_all();
+        m_conflation.thread.join();
+    }
+    stopConsumers();
+    if (m_offline.thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_offline.mutex);
+            m_offline.stopping = true;
+        }
+        m_offline.signal.notify_all();
+        m_offline.thread.join();
+    }
+    if (m_network.thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_network.mutex);
+            m_network.stopping = true;
+        }
+        m_network.signal.notify_all();
+        m_network.thread.join();
+        // Let mosquitto_disconnect() write the packet itself.
+        mosquitto_threaded_set(m_mosquitto, false);
+    }
     if (m_mosquitto != nullptr)
     {
         mosquitto_disconnect(m_mosquitto);
@@ -167,9 +635,13 @@ bool Client::disconnect()
     int rc = mosquitto_disconnect(m_mosquitto);
     if (rc != MOSQ_ERR_SUCCESS)
     {
-        m_error = make_error_code(rc);
+        setError(make_error_code(rc));
         return false;
     }
+
+    // The network thread still writes the DISCONNECT packet.
+    std::lock_guard<std::mutex> lock(m_network.mutex);
+    m_network.wanted = false;
     return true;
 }
 
@@ -186,19 +658,75 @@ bool Client::connect(
 
     m_callbacks.connection = onConnected;
     m_callbacks.disconnection = onDisconnected;
-    int rc = mosquitto_connect(
-        m_mosquitto, settings.address.c_str(), int(settings.port),
-        int(settings.timeout.count()));
+
+    if (settings.tcp_nodelay)
+    {
+        mosquitto_int_option(m_mosquitto, MOSQ_OPT_TCP_NODELAY, 1);
+    }
+
+    if (settings.tls.enabled() && (!secure(settings.tls)))
+        return false;
+
+    // MQTT v5: the mosquitto lib keeps CONNECT properties for reconnections.
+    mosquitto_property* properties = nullptr;
+    if ((m_v5.protocol == Protocol::V5) && (m_v5.maximum_packet_size != 0u))
+    {
+        mosquitto_property_add_int32(&properties, MQTT_PROP_MAXIMUM_PACKET_SIZE,
+                                     m_v5.maximum_packet_size);
+    }
+    // The asynchronous connection of the mosquitto lib takes no properties.
+    int rc;
+    if (settings.async && (settings.loop == Client::Loop::Threaded) &&
+        (properties == nullptr))
+    {
+        rc = mosquitto_connect_bind_async(
+            m_mosquitto, settings.address.c_str(), int(settings.port),
+            int(settings.timeout.count()), nullptr);
+    }
+    else
+    {
+        rc = mosquitto_connect_bind_v5(
+            m_mosquitto, settings.address.c_str(), int(settings.port),
+            int(settings.timeout.count()), nullptr, properties);
+    }
+    mosquitto_property_free_all(&properties);
     if (rc != MOSQ_ERR_SUCCESS)
     {
-        m_error = make_error_code(rc);
+        setError(make_error_code(rc));
         return false;
     }
 
+    m_loop = settings.loop;
+    if (m_loop == Client::Loop::Manual)
+        return true;
+
+    if ((!m_outbound.lanes.empty()) && (!m_outbound.thread.joinable()))
+    {
+        m_outbound.thread = std::thread(&Client::forward, this);
+    }
+
+    // Own network thread, since the one of the mosquitto lib cannot be tuned.
+    if ((settings.cpu >= 0) || settings.busy_poll ||
+        (settings.scheduling != Client::Scheduling::Default))
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_network.mutex);
+            m_network.wanted = true;
+            m_network.busy_poll = settings.busy_poll;
+        }
+        m_network.signal.notify_one();
+        if (!m_network.thread.joinable())
+        {
+            mosquitto_threaded_set(m_mosquitto, true);
+            m_network.thread = std::thread(&Client::run, this);
+        }
+        return tune(m_network.thread, settings);
+    }
+
     rc = mosquitto_loop_start(m_mosquitto);
     if (rc != MOSQ_ERR_SUCCESS)
     {
-        m_error = make_error_code(rc);
+        setError(make_error_code(rc));
         return false;
     }
 
@@ -206,136 +734,2265 @@ bool Client::connect(
 }
 
 //-----------------------------------------------------------------------------
-void Client::on_connected_wrapper(struct mosquitto*, void* userdata, int rc)
+size_t Client::connectAll(std::vector<Client*> const& clients,
+                          Connection const& settings, size_t const concurrency,
+                          std::chrono::milliseconds const timeout,
+                          Client::ConnectionCallback onConnected,
+                          Client::ConnectionCallback onDisconnected)
 {
-    Client* client = static_cast<Client*>(userdata);
-    assert((client != nullptr) && "NULL pointer passed as param");
-    client->m_status = Client::Status::Connected;
-    client->m_callbacks.reception.clear();
-    if (client->m_callbacks.connection != nullptr)
+    // Shared with the callbacks, which outlive this function.
+    struct Fleet
     {
-        client->m_callbacks.connection(rc);
+        std::mutex mutex;
+        std::condition_variable signal;
+        std::vector<bool> settled;
+        size_t pending = 0u;
+        size_t connected = 0u;
+    };
+    auto fleet = std::make_shared<Fleet>();
+    fleet->settled.resize(clients.size(), false);
+
+    // Called once per client, by the first of its callbacks.
+    auto settle = [fleet](size_t const i, bool const connected)
+    {
+        {
+            std::lock_guard<std::mutex> lock(fleet->mutex);
+            if (fleet->settled[i])
+                return;
+            fleet->settled[i] = true;
+            --fleet->pending;
+            fleet->connected += connected ? 1u : 0u;
+        }
+        fleet->signal.notify_all();
+    };
+
+    Connection connection = settings;
+    connection.async = true;
+    if (!connection.tls.enabled())
+    {
+        // TLS needs the name of the broker for checking its certificate.
+        connection.address = resolve(settings.address);
     }
-    else
+
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
+    size_t const slots = std::max<size_t>(1u, concurrency);
+    for (size_t i = 0u; i < clients.size(); ++i)
     {
-        client->onConnected(rc);
+        {
+            std::unique_lock<std::mutex> lock(fleet->mutex);
+            if (!fleet->signal.wait_until(lock, deadline, [&fleet, slots]()
+                { return fleet->pending < slots; }))
+                break;
+            ++fleet->pending;
+        }
+
+        Client* client = clients[i];
+        if (client->status() == Client::Status::Connected)
+        {
+            settle(i, true);
+            continue;
+        }
+        bool const started = client->connect(connection,
+            [settle, i, client, onConnected](int rc)
+        {
+            settle(i, rc == MOSQ_ERR_SUCCESS);
+            if (onConnected != nullptr)
+                onConnected(rc);
+            else
+                client->onConnected(rc);
+        },
+            [settle, i, client, onDisconnected](int rc)
+        {
+            settle(i, false);
+            if (onDisconnected != nullptr)
+                onDisconnected(rc);
+            else
+                client->onDisconnected(rc);
+        });
+        if (!started)
+        {
+            settle(i, false);
+        }
     }
+
+    std::unique_lock<std::mutex> lock(fleet->mutex);
+    fleet->signal.wait_until(lock, deadline, [&fleet]() { return fleet->pending == 0u; });
+    return fleet->connected;
 }
 
 //-----------------------------------------------------------------------------
-void Client::on_disconnected_wrapper(struct mosquitto*, void* userdata, int rc)
+bool Client::reconnect()
 {
-    Client* client = static_cast<Client*>(userdata);
-    assert((client != nullptr) && "NULL pointer passed as param");
-    client->m_status = Client::Status::Disconnected;
-    if (client->m_callbacks.disconnection != nullptr)
-    {
-        client->m_callbacks.disconnection(rc);
-    }
-    else
+    if (m_mosquitto == nullptr)
+        return false;
+
+    int rc = mosquitto_reconnect(m_mosquitto);
+    if (rc != MOSQ_ERR_SUCCESS)
     {
-        client->onDisconnected(rc);
+        setError(make_error_code(rc));
+        return false;
     }
-    client->m_callbacks.connection = nullptr;
-    client->m_callbacks.disconnection = nullptr;
-    client->m_callbacks.reception.clear();
+    return true;
 }
 
 //-----------------------------------------------------------------------------
-bool Client::publish(Topic& topic, const uint8_t* payload,
-    size_t const size, QoS const qos)
+bool Client::secure(Tls const& tls)
 {
-    if (topic.name.size() == 0u)
+    std::shared_ptr<TlsContext> context = tls.context;
+    if ((context == nullptr) && TlsContext::supported())
+    {
+        // Own context of the client: kept by the mosquitto lib for its
+        // reconnections, which resume the session.
+        context = std::make_shared<TlsContext>(tls);
+    }
+    else if ((context == nullptr) && tls.kernel_offload)
     {
-        m_error = make_error_code(
-            MOSQ_ERR_INVAL, "topic name shall not be empty");
+        setError(make_error_code(Error::TlsNeedsOpenSSL));
         return false;
     }
 
-    if ((payload == nullptr) && (size != 0u))
+    if (context != nullptr)
     {
-        m_error = make_error_code(
-            MOSQ_ERR_INVAL, "invalid payload content or payload size");
-        return false;
+        if (!context->valid())
+        {
+            setError(make_error_code(Error::InvalidTlsSettings));
+            return false;
+        }
+        if (context != m_tls)
+        {
+            // Without defaults, the mosquitto lib uses the context as it is
+            // instead of overriding its verification and its callbacks.
+            int rc = mosquitto_int_option(m_mosquitto, MOSQ_OPT_SSL_CTX_WITH_DEFAULTS, 0);
+            if (rc == MOSQ_ERR_SUCCESS)
+            {
+                rc = mosquitto_void_option(m_mosquitto, MOSQ_OPT_SSL_CTX,
+                                           context->native());
+            }
+            if (rc != MOSQ_ERR_SUCCESS)
+            {
+                setError(make_error_code(rc));
+                return false;
+            }
+            m_tls = context;
+        }
+        return true;
     }
 
-    int rc = mosquitto_publish(
-        m_mosquitto, &topic.id, topic.name.c_str(), int(size), payload,
-        int(qos), topic.retain);
+    // TLS of the mosquitto lib, without session resumption.
+    auto orNull = [](std::string const& s) { return s.empty() ? nullptr : s.c_str(); };
+    int rc = MOSQ_ERR_SUCCESS;
+    if (!tls.psk.empty())
+    {
+        rc = mosquitto_tls_psk_set(m_mosquitto, tls.psk.c_str(), tls.identity.c_str(),
+                                   orNull(tls.ciphers));
+    }
+    else
+    {
+        if (tls.os_certificates)
+        {
+            rc = mosquitto_int_option(m_mosquitto, MOSQ_OPT_TLS_USE_OS_CERTS, 1);
+        }
+        if ((rc == MOSQ_ERR_SUCCESS) && ((!tls.cafile.empty()) || (!tls.capath.empty())))
+        {
+            rc = mosquitto_tls_set(m_mosquitto, orNull(tls.cafile), orNull(tls.capath),
+                                   orNull(tls.certfile), orNull(tls.keyfile), nullptr);
+        }
+        if (rc == MOSQ_ERR_SUCCESS)
+        {
+            rc = mosquitto_tls_opts_set(m_mosquitto, 1, orNull(tls.version),
+                                        orNull(tls.ciphers));
+        }
+        if (rc == MOSQ_ERR_SUCCESS)
+        {
+            rc = mosquitto_tls_insecure_set(m_mosquitto, tls.insecure);
+        }
+    }
     if (rc != MOSQ_ERR_SUCCESS)
     {
-        m_error = make_error_code(rc);
+        setError(make_error_code(rc));
         return false;
     }
     return true;
 }
 
 //-----------------------------------------------------------------------------
-bool Client::publish(Topic& topic, std::vector<uint8_t> const& payload, QoS const qos)
+int Client::socket() const
 {
-    return publish(topic, payload.data(), payload.size(), qos);
+    return (m_mosquitto == nullptr) ? -1 : mosquitto_socket(m_mosquitto);
 }
 
 //-----------------------------------------------------------------------------
-bool Client::publish(Topic& topic, std::string const& payload, QoS const qos)
+bool Client::tlsOffloaded() const
 {
-    const uint8_t* p = reinterpret_cast<const uint8_t*>(&payload[0]);
-    return publish(topic, p, payload.size() + 1u, qos);
+    return (m_mosquitto != nullptr) && (m_tls != nullptr) &&
+           TlsContext::offloaded(mosquitto_ssl_get(m_mosquitto));
 }
 
 //-----------------------------------------------------------------------------
-bool Client::unsubscribe(Topic& topic)
+bool Client::wantWrite() const
 {
-    int rc = mosquitto_unsubscribe(m_mosquitto, &topic.id, topic.name.c_str());
-    if (rc != MOSQ_ERR_SUCCESS)
+    if (!m_outbound.lanes.empty())
     {
-        m_error = make_error_code(rc);
-        return false;
+        // New messages, or delayed ones whose rate limit allows them now.
+        if (m_outbound.posted.load() != m_outbound.flushed.load())
+            return true;
+        int64_t const resume = m_outbound.resume.load();
+        if ((resume != 0) &&
+            (std::chrono::steady_clock::now().time_since_epoch().count() >= resume))
+            return true;
     }
 
-    m_callbacks.reception.erase(topic.name);
+    return (m_mosquitto != nullptr) && mosquitto_want_write(m_mosquitto);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::wantRead() const
+{
+    if (m_inbound.backpressure != Client::Backpressure::Block)
+        return true;
+
+    for (auto const& lane: m_inbound.lanes)
+    {
+        if (lane->queue.size() >= lane->queue.capacity())
+            return false;
+    }
     return true;
 }
 
 //-----------------------------------------------------------------------------
-bool Client::subscribe(Topic& topic, QoS const qos,
-    Client::ReceptionCallback onMessageReceived)
+bool Client::onReadable()
 {
-    if (topic.name.size() == 0u)
+    int rc = mosquitto_loop_read(m_mosquitto, 1);
+    if (rc != MOSQ_ERR_SUCCESS)
     {
-        m_error = make_error_code(MOSQ_ERR_INVAL, "topic name shall not be empty");
+        setError(make_error_code(rc));
         return false;
     }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::onWritable()
+{
+    if (!m_outbound.lanes.empty())
+    {
+        flushOutbound();
+    }
 
-    int rc = mosquitto_subscribe(m_mosquitto, &topic.id, topic.name.c_str(), int(qos));
+    int rc = mosquitto_loop_write(m_mosquitto, 1);
     if (rc != MOSQ_ERR_SUCCESS)
     {
-        m_error = make_error_code(rc);
+        setError(make_error_code(rc));
         return false;
     }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::onTick()
+{
+    if (m_callbacks.filters.load(std::memory_order_relaxed) != 0u)
+    {
+        flushConflated();
+    }
+    if (!m_outbound.lanes.empty())
+    {
+        flushOutbound();
+    }
 
-    m_callbacks.reception[topic.name] = onMessageReceived;
+    int rc = mosquitto_loop_misc(m_mosquitto);
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+        setError(make_error_code(rc));
+        return false;
+    }
     return true;
 }
 
 //-----------------------------------------------------------------------------
-void Client::on_message_received_wrapper(
-    struct mosquitto*, void *userdata, const struct mosquitto_message *msg)
+void Client::on_connected_wrapper(struct mosquitto*, void* userdata, int rc,
+    int flags, mosquitto_property const* properties)
 {
     Client* client = static_cast<Client*>(userdata);
     assert((client != nullptr) && "NULL pointer passed as param");
-    Message const& message = *reinterpret_cast<const Message*>(msg);
 
-    auto const& callback = client->m_callbacks.reception.find(message.topic);
-    if ((callback != client->m_callbacks.reception.end()) &&
-        (callback->second != nullptr))
+    // Limits of the broker. Aliases only live for the connection.
+    if (rc == MOSQ_ERR_SUCCESS)
     {
-        callback->second(message);
+        Client::Capabilities capabilities;
+        if (properties != nullptr)
+        {
+            uint8_t byte;
+            mosquitto_property_read_int16(properties, MQTT_PROP_RECEIVE_MAXIMUM,
+                &capabilities.receive_maximum, false);
+            mosquitto_property_read_int32(properties, MQTT_PROP_MAXIMUM_PACKET_SIZE,
+                &capabilities.maximum_packet_size, false);
+            mosquitto_property_read_int16(properties, MQTT_PROP_TOPIC_ALIAS_MAXIMUM,
+                &capabilities.topic_alias_maximum, false);
+            mosquitto_property_read_byte(properties, MQTT_PROP_MAXIMUM_QOS,
+                &capabilities.maximum_qos, false);
+            if (mosquitto_property_read_byte(properties, MQTT_PROP_RETAIN_AVAILABLE,
+                    &byte, false) != nullptr)
+            {
+                capabilities.retain_available = (byte != 0u);
+            }
+        }
+
+        size_t const aliases = (client->m_v5.protocol == Protocol::V5)
+            ? std::min(capabilities.topic_alias_maximum, client->m_v5.topic_aliases)
+            : 0u;
+        std::lock_guard<std::mutex> lock(client->m_v5.mutex);
+        client->m_v5.capabilities = capabilities;
+        client->m_v5.aliases.reset(aliases);
+        client->m_v5.aliasing = (aliases != 0u);
     }
-    else
+
+    client->m_status = Client::Status::Connected;
+    if (rc == MOSQ_ERR_SUCCESS)
+    {
+        client->m_metrics.connected();
+    }
+    if (client->m_offline.queue != nullptr)
+    {
+        {
+            std::lock_guard<std::mutex> lock(client->m_offline.mutex);
+            client->m_offline.online = (rc == MOSQ_ERR_SUCCESS);
+        }
+        client->m_offline.signal.notify_all();
+    }
+    if (client->m_reconnection.mode == Client::Reconnection::Manual)
+    {
+        std::unique_lock<std::shared_mutex> lock(client->m_callbacks.mutex);
+        client->m_callbacks.reception.clear();
+        client->m_callbacks.subscriptions.clear();
+        client->m_callbacks.filtered.clear();
+        client->m_callbacks.conflated.clear();
+        client->m_callbacks.filters = 0u;
+    }
+    else if ((rc == MOSQ_ERR_SUCCESS) && ((flags & 0x01) == 0))
+    {
+        // The broker did not keep the session (session present flag).
+        client->resubscribe();
+    }
+    if (client->m_callbacks.connection != nullptr)
+    {
+        client->m_callbacks.connection(rc);
+    }
+    else
+    {
+        client->onConnected(rc);
+    }
+
+    Client::AckCallback pending;
+    {
+        std::lock_guard<std::mutex> lock(client->m_pending.mutex);
+        pending.swap(client->m_pending.connection);
+    }
+    if (pending != nullptr)
+    {
+        client->m_pending.expecting.fetch_sub(1u);
+        pending(rc);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void Client::on_disconnected_wrapper(struct mosquitto*, void* userdata, int rc)
+{
+    Client* client = static_cast<Client*>(userdata);
+    assert((client != nullptr) && "NULL pointer passed as param");
+    client->m_status = Client::Status::Disconnected;
+    // Without the lock: the mosquitto lib may call this function from a
+    // publication made by the replay thread.
+    client->m_offline.online = false;
+    {
+        // Do not use aliases until the broker gives them again.
+        std::lock_guard<std::mutex> lock(client->m_v5.mutex);
+        client->m_v5.aliasing = false;
+        client->m_v5.aliases.reset(0u);
+    }
+    if (client->m_callbacks.disconnection != nullptr)
+    {
+        client->m_callbacks.disconnection(rc);
+    }
+    else
+    {
+        client->onDisconnected(rc);
+    }
+    if (client->m_reconnection.mode == Client::Reconnection::Manual)
+    {
+        client->m_callbacks.connection = nullptr;
+        client->m_callbacks.disconnection = nullptr;
+        std::unique_lock<std::shared_mutex> lock(client->m_callbacks.mutex);
+        client->m_callbacks.reception.clear();
+        client->m_callbacks.subscriptions.clear();
+        client->m_callbacks.filtered.clear();
+        client->m_callbacks.conflated.clear();
+        client->m_callbacks.filters = 0u;
+    }
+    else
+    {
+        client->jitterReconnectDelay();
+    }
+    client->acknowledgeAll(MOSQ_ERR_CONN_LOST);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::publish(Topic& topic, const uint8_t* payload,
+    size_t const size, QoS const qos)
+{
+    return post(topic, payload, size, qos, nullptr);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::publish(Topic& topic, const uint8_t* payload, size_t const size,
+    QoS const qos, Client::PublishProperties const& properties)
+{
+    return post(topic, payload, size, qos, &properties);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::post(Topic& topic, const uint8_t* payload, size_t const size,
+    QoS const qos, Client::PublishProperties const* properties,
+    bool const offline, Client::AckCallback onAcknowledged)
+{
+    if (topic.name.size() == 0u)
+    {
+        m_metrics.failed(MOSQ_ERR_INVAL);
+        setError(make_error_code(Error::EmptyTopic));
+        return false;
+    }
+
+    if ((payload == nullptr) && (size != 0u))
+    {
+        m_metrics.failed(MOSQ_ERR_INVAL);
+        setError(make_error_code(Error::InvalidPayload));
+        return false;
+    }
+
+    if ((m_loopback != Client::Loopback::Broker) &&
+        loopback(topic, payload, size, qos) &&
+        (m_loopback == Client::Loopback::Local))
+    {
+        if (onAcknowledged != nullptr)
+            onAcknowledged(MOSQ_ERR_SUCCESS);
+        return true;
+    }
+
+    if (!m_outbound.lanes.empty())
+    {
+        return defer(topic, payload, size, qos, properties, offline,
+                     std::move(onAcknowledged));
+    }
+    if (!admit(topic, size))
+        return false;
+    if (onAcknowledged == nullptr)
+    {
+        return transmit(topic, payload, size, qos, properties, offline);
+    }
+
+    uint64_t const epoch = announce();
+    if (!transmit(topic, payload, size, qos, properties, offline))
+    {
+        withdraw();
+        return false;
+    }
+    expect(topic.id, epoch, std::move(onAcknowledged));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::transmit(Topic& topic, uint8_t const* payload, size_t const size,
+    QoS const qos, Client::PublishProperties const* properties,
+    bool const offline, TopicAliases::Binding* binding)
+{
+    if (offline && offlining())
+        return store(topic, payload, size, qos);
+
+    int rc = send(topic, payload, size, qos, properties, binding);
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+        m_metrics.failed(rc);
+        setError(make_error_code(rc));
+        return false;
+    }
+    m_metrics.sent(int(qos), size);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::publish(TopicHandle& topic, uint8_t const* payload,
+    size_t const size, QoS const qos)
+{
+    if (!topic.valid())
+    {
+        m_metrics.failed(MOSQ_ERR_INVAL);
+        setError(make_error_code(Error::InvalidTopicHandle));
+        return false;
+    }
+
+    if ((payload == nullptr) && (size != 0u))
+    {
+        m_metrics.failed(MOSQ_ERR_INVAL);
+        setError(make_error_code(Error::InvalidPayload));
+        return false;
+    }
+
+    if ((m_loopback != Client::Loopback::Broker) &&
+        loopback(topic.m_topic, payload, size, qos) &&
+        (m_loopback == Client::Loopback::Local))
+    {
+        return true;
+    }
+
+    if (!m_outbound.lanes.empty())
+    {
+        return defer(topic.m_topic, payload, size, qos, nullptr, true, nullptr);
+    }
+    if (!admit(topic.m_topic, size))
+        return false;
+    return transmit(topic.m_topic, payload, size, qos, nullptr, true,
+                    &topic.m_alias);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::publishTo(std::string_view const topic, uint8_t const* payload,
+    size_t const size, QoS const qos, bool const retain)
+{
+    // Keeps the capacity of the longest name published by the thread.
+    thread_local Topic name;
+    name.name.assign(topic.data(), topic.size());
+    name.retain = retain;
+    return post(name, payload, size, qos, nullptr);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::defer(Topic const& topic, uint8_t const* payload, size_t const size,
+    QoS const qos, Client::PublishProperties const* properties,
+    bool const offline, Client::AckCallback onAcknowledged)
+{
+    uint32_t index;
+    if (!m_outbound.free->pop(index))
+    {
+        m_metrics.failed(MOSQ_ERR_NOMEM);
+        setError(make_error_code(Error::PublishQueueFull));
+        return false;
+    }
+
+    Outgoing& message = m_outbound.slots[index];
+    message.topic.name.assign(topic.name);
+    message.topic.retain = topic.retain;
+    message.payload.assign(payload, payload + size);
+    message.qos = qos;
+    message.offline = offline;
+    message.has_properties = (properties != nullptr);
+    if (properties != nullptr)
+    {
+        message.properties = *properties;
+    }
+    message.callback = std::move(onAcknowledged);
+    size_t const lane = (m_limiter == nullptr) ? 0u : m_limiter->lane(topic.name);
+    m_outbound.lanes[lane]->ready.push(std::move(index));
+    m_outbound.posted.fetch_add(1u);
+
+    // Pairs with the fence of forward(): either the thread sees the message
+    // before sleeping, or the producer sees it waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_outbound.waiting.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(m_outbound.mutex);
+        m_outbound.signal.notify_one();
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::admit(Topic const& topic, size_t const size)
+{
+    if ((m_limiter == nullptr) ||
+        (m_limiter->acquire(topic.name, size, RateLimiter::Clock::now()) ==
+         RateLimiter::Clock::duration::zero()))
+    {
+        return true;
+    }
+
+    m_metrics.limited();
+    setError(make_error_code(Error::PublishRateExceeded));
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::wouldExceed(std::string_view const topic) const
+{
+    return (m_limiter != nullptr) &&
+        (m_limiter->delay(topic, RateLimiter::Clock::now()) !=
+         RateLimiter::Clock::duration::zero());
+}
+
+//-----------------------------------------------------------------------------
+void Client::transmit(uint32_t const index)
+{
+    Outgoing& message = m_outbound.slots[index];
+    Client::PublishProperties const* properties =
+        message.has_properties ? &message.properties : nullptr;
+    if (message.callback == nullptr)
+    {
+        transmit(message.topic, message.payload.data(), message.payload.size(),
+                 message.qos, properties, message.offline);
+    }
+    else
+    {
+        uint64_t const epoch = announce();
+        if (transmit(message.topic, message.payload.data(),
+                     message.payload.size(), message.qos, properties,
+                     message.offline))
+        {
+            expect(message.topic.id, epoch, std::move(message.callback));
+        }
+        else
+        {
+            withdraw();
+            message.callback(mosquittoError(error()));
+        }
+        message.callback = nullptr;
+    }
+    m_outbound.free->push(uint32_t(index));
+}
+
+//-----------------------------------------------------------------------------
+std::chrono::nanoseconds Client::flushOutbound(bool const force)
+{
+    m_outbound.flushed.store(m_outbound.posted.load());
+
+    // Strict priority restarts from the most urgent lane after each message.
+    // Weighted lanes send up to their weight per round. A lane whose next
+    // message exceeds its rate limit keeps it and lets the next lanes send.
+    auto const none = RateLimiter::Clock::duration::max();
+    auto delay = none;
+    bool sent = true;
+    while (sent)
+    {
+        sent = false;
+        delay = none;
+        for (auto& lane: m_outbound.lanes)
+        {
+            size_t quota = (lane->weight == 0u) ? 1u : lane->weight;
+            while (quota != 0u)
+            {
+                uint32_t index = lane->held;
+                if (!lane->holding && !lane->ready.pop(index))
+                    break;
+
+                if ((m_limiter != nullptr) && !force)
+                {
+                    Outgoing const& message = m_outbound.slots[index];
+                    auto const wait = m_limiter->acquire(message.topic.name,
+                        message.payload.size(), RateLimiter::Clock::now());
+                    if (wait != RateLimiter::Clock::duration::zero())
+                    {
+                        lane->held = index;
+                        lane->holding = true;
+                        delay = std::min(delay, wait);
+                        break;
+                    }
+                }
+                lane->holding = false;
+                transmit(index);
+                sent = true;
+                --quota;
+            }
+            if (sent && (lane->weight == 0u))
+                break;
+        }
+    }
+
+    if (delay == none)
+    {
+        m_outbound.resume.store(0);
+        return std::chrono::nanoseconds::zero();
+    }
+    m_outbound.resume.store((RateLimiter::Clock::now() + delay)
+                            .time_since_epoch().count());
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(delay);
+}
+
+//-----------------------------------------------------------------------------
+void Client::forward()
+{
+    std::chrono::nanoseconds delay{0};
+    std::unique_lock<std::mutex> lock(m_outbound.mutex);
+    while (!m_outbound.stopping)
+    {
+        m_outbound.waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto const wake = [this]() {
+            return m_outbound.stopping ||
+                (m_outbound.posted.load(std::memory_order_relaxed) !=
+                 m_outbound.flushed.load(std::memory_order_relaxed));
+        };
+        // Messages delayed by the rate limits are sent when allowed.
+        if (delay.count() == 0)
+            m_outbound.signal.wait(lock, wake);
+        else
+            m_outbound.signal.wait_for(lock, delay, wake);
+        m_outbound.waiting.store(false, std::memory_order_relaxed);
+        if (m_outbound.stopping)
+            return ;
+
+        lock.unlock();
+        delay = flushOutbound();
+        lock.lock();
+    }
+}
+
+//-----------------------------------------------------------------------------
+int Client::send(Topic& topic, uint8_t const* payload, size_t const size,
+                 QoS const qos, Client::PublishProperties const* properties,
+                 TopicAliases::Binding* binding)
+{
+    uint8_t const* data = payload;
+    size_t bytes = size;
+    mosquitto_property const* compression = nullptr;
+    if (m_compressor.compress(topic.name, payload, size, data, bytes))
+    {
+        compression = m_compressor.properties();
+    }
+
+    // Topic aliases are only used for QoS 0: the mosquitto lib may send again
+    // QoS 1 and QoS 2 messages on a new connection, where the alias would be
+    // unknown. The lock keeps the order between giving an alias to the broker
+    // and using it.
+    std::unique_lock<std::mutex> lock(m_v5.mutex, std::defer_lock);
+    uint16_t alias = 0u;
+    bool known = false;
+    if ((qos == QoS::QoS0) && m_v5.aliasing.load(std::memory_order_relaxed))
+    {
+        lock.lock();
+        alias = m_v5.aliases.alias(topic.name, known, binding);
+    }
+
+    // Use the prepared property lists when possible, else merge them.
+    mosquitto_property* merged = nullptr;
+    mosquitto_property const* list = nullptr;
+    if ((properties == nullptr) && ((compression == nullptr) || (alias == 0u)))
+    {
+        list = (alias != 0u) ? m_v5.aliases.properties(alias) : compression;
+    }
+    else
+    {
+        if (compression != nullptr)
+            mosquitto_property_copy_all(&merged, compression);
+        if (alias != 0u)
+            mosquitto_property_add_int16(&merged, MQTT_PROP_TOPIC_ALIAS, alias);
+        if ((properties != nullptr) && (properties->expiry.count() > 0))
+            mosquitto_property_add_int32(&merged, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL,
+                                         uint32_t(properties->expiry.count()));
+        if ((properties != nullptr) && (!properties->content_type.empty()))
+            mosquitto_property_add_string(&merged, MQTT_PROP_CONTENT_TYPE,
+                                          properties->content_type.c_str());
+        list = merged;
+    }
+
+    // The callbacks of acknowledgements may publish again: they are called
+    // once the lock is released.
+    Publishing& publishing = s_publishing;
+    size_t const first = publishing.acknowledged.size();
+    if (lock.owns_lock())
+    {
+        publishing.client = this;
+    }
+
+    // A topic known by its alias is not sent.
+    char const* name = known ? nullptr : topic.name.c_str();
+    int const rc = m_inflight.track(int(qos), topic.id, [&]() {
+        return (list == nullptr)
+            ? mosquitto_publish(m_mosquitto, &topic.id, name, int(bytes), data,
+                                int(qos), topic.retain)
+            : mosquitto_publish_v5(m_mosquitto, &topic.id, name, int(bytes), data,
+                                   int(qos), topic.retain, list);
+    });
+    publishing.client = nullptr;
+    if ((rc != MOSQ_ERR_SUCCESS) && (alias != 0u) && (!known))
+    {
+        m_v5.aliases.forget(topic.name);
+    }
+    mosquitto_property_free_all(&merged);
+
+    if (lock.owns_lock())
+    {
+        lock.unlock();
+        // Callbacks publishing again append their own acknowledgements and
+        // call them before returning.
+        for (size_t i = first; i < publishing.acknowledged.size(); ++i)
+        {
+            on_published_wrapper(m_mosquitto, this, publishing.acknowledged[i]);
+        }
+        publishing.acknowledged.resize(first);
+    }
+    return rc;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::deferred(int const mid)
+{
+    Publishing& publishing = s_publishing;
+    if (publishing.client != this)
+        return false;
+
+    publishing.acknowledged.push_back(mid);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::store(Topic const& topic, uint8_t const* payload, size_t const size,
+                   QoS const qos)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_offline.mutex);
+        if (!m_offline.queue->push(topic.name, payload, size, int(qos),
+                                   topic.retain))
+        {
+            int const rc = (errno == EMSGSIZE) ? MOSQ_ERR_PAYLOAD_SIZE
+                                               : MOSQ_ERR_ERRNO;
+            m_metrics.failed(rc);
+            setError(make_error_code((rc == MOSQ_ERR_ERRNO)
+                ? Error::OfflineQueueWrite : Error::OfflineMessageTooBig));
+            return false;
+        }
+        m_offline.pending.store(true, std::memory_order_release);
+    }
+    m_offline.signal.notify_one();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void Client::replay()
+{
+    using Clock = std::chrono::steady_clock;
+
+    Topic topic;
+    OfflineQueue::Record record;
+    Clock::time_point next = Clock::now();
+    std::unique_lock<std::mutex> lock(m_offline.mutex);
+    while (true)
+    {
+        m_offline.signal.wait(lock, [this]() {
+            return m_offline.stopping ||
+                   (m_offline.online && !m_offline.queue->empty());
+        });
+        m_offline.signal.wait_until(lock, next, [this]() {
+            return m_offline.stopping;
+        });
+        if (m_offline.stopping)
+            return;
+
+        // Publishers queuing new messages wait for the end of the batch.
+        Clock::time_point const start = Clock::now();
+        size_t sent = 0u;
+        int rc = MOSQ_ERR_SUCCESS;
+        while ((sent < m_offline.batch) && m_offline.online &&
+               m_offline.queue->front(record))
+        {
+            topic.name.assign(record.topic.data(), record.topic.size());
+            topic.retain = record.retain;
+            rc = send(topic, record.payload, record.size, QoS(record.qos));
+            if (rc == MOSQ_ERR_NO_CONN)
+                break; // Kept for the next connection.
+
+            // Other failures would not succeed later.
+            if (rc == MOSQ_ERR_SUCCESS)
+                m_metrics.sent(record.qos, record.size);
+            else
+                m_metrics.failed(rc);
+            m_offline.queue->pop();
+            ++sent;
+        }
+
+        if (m_offline.queue->empty())
+        {
+            m_offline.pending.store(false, std::memory_order_release);
+        }
+        next = start;
+        if (m_offline.rate != 0u)
+        {
+            next += std::chrono::nanoseconds(sent * 1000000000u / m_offline.rate);
+        }
+        if (rc == MOSQ_ERR_NO_CONN)
+        {
+            // Until the disconnection is notified.
+            next = Clock::now() + std::chrono::milliseconds(100);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+size_t Client::offline() const
+{
+    if (m_offline.queue == nullptr)
+        return 0u;
+
+    std::lock_guard<std::mutex> lock(m_offline.mutex);
+    return m_offline.queue->size();
+}
+
+//-----------------------------------------------------------------------------
+size_t Client::offlineDropped() const
+{
+    if (m_offline.queue == nullptr)
+        return 0u;
+
+    std::lock_guard<std::mutex> lock(m_offline.mutex);
+    return m_offline.queue->dropped();
+}
+
+//-----------------------------------------------------------------------------
+Client::Capabilities Client::capabilities() const
+{
+    std::lock_guard<std::mutex> lock(m_v5.mutex);
+    return m_v5.capabilities;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::addDictionary(std::string const& prefix,
+                           std::vector<uint8_t> const& dictionary)
+{
+    if (!m_compressor.addDictionary(prefix, dictionary.data(), dictionary.size()))
+    {
+        setError(make_error_code(Error::InvalidDictionary));
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::publish(PublishBatch& batch)
+{
+    for (auto const& entry: batch.entries())
+    {
+        if (entry.topic->name.size() == 0u)
+        {
+            m_metrics.failed(MOSQ_ERR_INVAL);
+            setError(make_error_code(Error::EmptyTopic));
+            return false;
+        }
+
+        if ((entry.payload == nullptr) && (entry.size != 0u))
+        {
+            m_metrics.failed(MOSQ_ERR_INVAL);
+            setError(make_error_code(Error::InvalidPayload));
+            return false;
+        }
+    }
+
+    // Looped back messages count as sent.
+    auto const local = [this](PublishBatch::Entry const& entry)
+    {
+        return (m_loopback != Client::Loopback::Broker) &&
+            loopback(*entry.topic, entry.payload, entry.size, entry.qos) &&
+            (m_loopback == Client::Loopback::Local);
+    };
+
+    size_t sent = 0u;
+    if (!m_outbound.lanes.empty())
+    {
+        // Like publish(): entries go through the lanes of the publish queue,
+        // after the messages already queued.
+        for (auto const& entry: batch.entries())
+        {
+            if (!local(entry) &&
+                !defer(*entry.topic, entry.payload, entry.size, entry.qos,
+                       nullptr, false, nullptr))
+            {
+                batch.drop(sent);
+                return false;
+            }
+            ++sent;
+        }
+        batch.clear();
+        return true;
+    }
+
+    if (offlining())
+    {
+        for (auto const& entry: batch.entries())
+        {
+            if (local(entry))
+            {
+                ++sent;
+                continue;
+            }
+            if (!store(*entry.topic, entry.payload, entry.size, entry.qos))
+            {
+                batch.drop(sent);
+                return false;
+            }
+            ++sent;
+        }
+        batch.clear();
+        return true;
+    }
+
+    for (auto const& entry: batch.entries())
+    {
+        if (local(entry))
+        {
+            ++sent;
+            continue;
+        }
+        if (!admit(*entry.topic, entry.size))
+        {
+            batch.drop(sent);
+            return false;
+        }
+        int rc = send(*entry.topic, entry.payload, entry.size, entry.qos);
+        if (rc != MOSQ_ERR_SUCCESS)
+        {
+            m_metrics.failed(rc);
+            setError(make_error_code(rc));
+            batch.drop(sent);
+            return false;
+        }
+        m_metrics.sent(int(entry.qos), entry.size);
+        ++sent;
+    }
+
+    batch.clear();
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::publish(Topic& topic, StreamSource& stream, QoS const qos,
+                     Client::AckCallback onCompleted)
+{
+    if (topic.name.size() == 0u)
+    {
+        m_metrics.failed(MOSQ_ERR_INVAL);
+        setError(make_error_code(Error::EmptyTopic));
+        return false;
+    }
+
+    if (stream.chunks() > 0xFFFFFFFFu)
+    {
+        setError(make_error_code(Error::TooManyChunks));
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stream.m_mutex);
+        if (stream.m_started)
+        {
+            setError(make_error_code(Error::StreamAlreadyPublished));
+            return false;
+        }
+        stream.m_started = true;
+    }
+
+    stream.m_topic.name = topic.name + "/chunk";
+    stream.m_qos = qos;
+    stream.m_completed = std::move(onCompleted);
+    pump(stream);
+
+    std::lock_guard<std::mutex> lock(stream.m_mutex);
+    if (stream.m_rc != MOSQ_ERR_SUCCESS)
+    {
+        setError(make_error_code(stream.m_rc));
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void Client::pump(StreamSource& stream)
+{
+    std::unique_lock<std::mutex> lock(stream.m_mutex);
+    if (stream.m_pumping)
+        return ;
+
+    stream.m_pumping = true;
+    while (true)
+    {
+        if ((stream.m_rc != MOSQ_ERR_SUCCESS) || (stream.m_next == stream.m_count) ||
+            (stream.m_inflight >= stream.m_window))
+        {
+            stream.m_pumping = false;
+            if ((stream.m_inflight != 0u) || stream.m_completing)
+                return ;
+
+            stream.m_completing = true;
+            int const rc = stream.m_rc;
+            Client::AckCallback callback = std::move(stream.m_completed);
+            lock.unlock();
+            if (callback != nullptr)
+            {
+                callback(rc);
+            }
+            return ;
+        }
+
+        // The mosquitto lib copies the chunk: the buffer is reused at once.
+        uint64_t const index = stream.m_next++;
+        ++stream.m_inflight;
+        lock.unlock();
+        size_t const bytes = stream.fill(index);
+        int rc = MOSQ_ERR_ERRNO;
+        if (bytes == 0u)
+        {
+            setError(make_error_code(Error::StreamRead));
+        }
+        else if (publish(stream.m_topic, stream.m_buffer.data(), bytes, stream.m_qos,
+                         [this, &stream](int const code)
+        {
+            {
+                std::lock_guard<std::mutex> guard(stream.m_mutex);
+                --stream.m_inflight;
+                if (code == MOSQ_ERR_SUCCESS)
+                    ++stream.m_acked;
+                else if (stream.m_rc == MOSQ_ERR_SUCCESS)
+                    stream.m_rc = code;
+            }
+            pump(stream);
+        }))
+        {
+            rc = MOSQ_ERR_SUCCESS;
+        }
+        else
+        {
+            rc = mosquittoError(error());
+        }
+
+        lock.lock();
+        if (rc != MOSQ_ERR_SUCCESS)
+        {
+            --stream.m_inflight;
+            if (stream.m_rc == MOSQ_ERR_SUCCESS)
+                stream.m_rc = rc;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool Client::publish(Topic& topic, std::vector<uint8_t> const& payload, QoS const qos)
+{
+    return publish(topic, payload.data(), payload.size(), qos);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::publish(Topic& topic, std::string const& payload, QoS const qos)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&payload[0]);
+    return publish(topic, p, payload.size() + 1u, qos);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::unsubscribe(Topic& topic)
+{
+    int rc = mosquitto_unsubscribe(m_mosquitto, &topic.id, topic.name.c_str());
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+        setError(make_error_code(rc));
+        return false;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_callbacks.mutex);
+    m_callbacks.reception.erase(topic.name);
+    m_callbacks.subscriptions.erase(topic.name);
+    dropFiltered(topic.name);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void Client::dropFiltered(std::string const& filter)
+{
+    if (m_callbacks.filtered.erase(filter))
+    {
+        auto& conflated = m_callbacks.conflated;
+        conflated.erase(std::remove_if(conflated.begin(), conflated.end(),
+            [&filter](std::shared_ptr<Filtered> const& f)
+            { return f->filter == filter; }), conflated.end());
+        m_callbacks.filters = m_callbacks.filtered.size();
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool Client::subscribe(Topic& topic, QoS const qos,
+    Client::ReceptionCallback onMessageReceived)
+{
+    return subscribe(topic, qos, Client::SubscriptionOptions(),
+                     std::move(onMessageReceived));
+}
+
+//-----------------------------------------------------------------------------
+bool Client::request(Topic& topic, QoS const qos, int const flags)
+{
+    if ((flags != 0) && (m_v5.protocol != Protocol::V5))
+    {
+        setError(make_error_code(Error::OptionsNeedV5));
+        return false;
+    }
+
+    if (topic.name.size() == 0u)
+    {
+        setError(make_error_code(Error::EmptyTopic));
+        return false;
+    }
+
+    if (mosquitto_sub_topic_check(topic.name.c_str()) != MOSQ_ERR_SUCCESS)
+    {
+        setError(make_error_code(Error::MalformedTopicFilter));
+        return false;
+    }
+
+    int rc = mosquitto_subscribe_v5(m_mosquitto, &topic.id, topic.name.c_str(),
+                                    int(qos), subscriptionFlags(flags), nullptr);
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+        setError(make_error_code(rc));
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+int Client::subscriptionFlags(int const flags) const
+{
+    if ((m_loopback == Client::Loopback::Both) && (m_v5.protocol == Protocol::V5))
+        return flags | MQTT_SUB_OPT_NO_LOCAL;
+    return flags;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::subscribe(Topic& topic, QoS const qos,
+    Client::SubscriptionOptions const& options,
+    Client::ReceptionCallback onMessageReceived)
+{
+    int const flags = (options.no_local ? MQTT_SUB_OPT_NO_LOCAL : 0) |
+        (options.retain_as_published ? MQTT_SUB_OPT_RETAIN_AS_PUBLISHED : 0) |
+        int(options.retain_handling);
+    if (!request(topic, qos, flags))
+        return false;
+
+    attach(topic.name, qos, flags, std::move(onMessageReceived));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void Client::attach(std::string const& filter, QoS const qos, int const flags,
+                    Client::ReceptionCallback&& onMessageReceived)
+{
+    // Subscribing again replaces the callback, with or without a policy.
+    std::unique_lock<std::shared_mutex> lock(m_callbacks.mutex);
+    dropFiltered(filter);
+    m_callbacks.reception.insert(filter, (onMessageReceived == nullptr)
+        ? nullptr : std::make_shared<Client::ReceptionCallback const>(
+            std::move(onMessageReceived)));
+    m_callbacks.subscriptions[filter] = std::make_pair(int(qos), flags);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::subscribe(Topic& topic, QoS const qos,
+    ReceptionPolicy const& policy, Client::ReceptionCallback onMessageReceived)
+{
+    if (onMessageReceived == nullptr)
+    {
+        setError(make_error_code(Error::PolicyWithoutCallback));
+        return false;
+    }
+    if (!request(topic, qos, 0))
+        return false;
+
+    attach(topic.name, qos, policy, std::move(onMessageReceived));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void Client::attach(std::string const& filter, QoS const qos,
+                    ReceptionPolicy const& policy,
+                    Client::ReceptionCallback&& onMessageReceived)
+{
+    auto filtered = std::make_shared<Filtered>(filter, policy,
+                                               std::move(onMessageReceived));
+    bool const conflating = (policy.conflation.count() > 0);
+    {
+        // Subscribing again replaces the callback, with or without a policy.
+        std::unique_lock<std::shared_mutex> lock(m_callbacks.mutex);
+        m_callbacks.reception.erase(filter);
+        dropFiltered(filter);
+        if (conflating)
+            m_callbacks.conflated.push_back(filtered);
+        m_callbacks.filtered.insert(filter, std::move(filtered));
+        m_callbacks.filters = m_callbacks.filtered.size();
+        m_callbacks.subscriptions[filter] = std::make_pair(int(qos), 0);
+    }
+
+    // Conflated messages are delivered by onTick() in Loop::Manual.
+    if (conflating)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_conflation.mutex);
+            if ((m_conflation.period.count() == 0) ||
+                (policy.conflation < m_conflation.period))
+            {
+                m_conflation.period = policy.conflation;
+            }
+        }
+        m_conflation.signal.notify_one();
+        if ((m_loop == Client::Loop::Threaded) && (!m_conflation.thread.joinable()))
+        {
+            m_conflation.thread = std::thread(&Client::conflate, this);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+int Client::sendMultiple(bool const subscribe, char* const* filters,
+    size_t const count, int const qos, int const flags, std::vector<int>& mids,
+    std::function<void(int mid, uint64_t epoch)> const& onSent)
+{
+    uint32_t maximum_packet_size;
+    {
+        std::lock_guard<std::mutex> lock(m_v5.mutex);
+        maximum_packet_size = m_v5.capabilities.maximum_packet_size;
+    }
+
+    return splitPackets(filters, count, subscribe ? 1u : 0u, maximum_packet_size,
+        [&](char* const* first, size_t const n)
+    {
+        int mid = 0;
+        uint64_t const epoch = (onSent != nullptr) ? announce() : 0u;
+        int const rc = subscribe
+            ? mosquitto_subscribe_multiple(m_mosquitto, &mid, int(n), first, qos,
+                                           subscriptionFlags(flags), nullptr)
+            : mosquitto_unsubscribe_multiple(m_mosquitto, &mid, int(n), first,
+                                             nullptr);
+        if (rc != MOSQ_ERR_SUCCESS)
+        {
+            if (onSent != nullptr)
+                withdraw();
+            return rc;
+        }
+        mids.insert(mids.end(), n, mid);
+        if (onSent != nullptr)
+            onSent(mid, epoch);
+        return rc;
+    });
+}
+
+//-----------------------------------------------------------------------------
+bool Client::subscribe(std::vector<Topic>& topics, QoS const qos,
+                       Client::ReceptionCallback onMessageReceived)
+{
+    return subscribe(topics, qos, std::move(onMessageReceived), nullptr);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::subscribe(std::vector<Topic>& topics, QoS const qos,
+                       Client::ReceptionCallback onMessageReceived,
+                       Client::AckCallback onAcknowledged)
+{
+    std::vector<char*> filters;
+    filters.reserve(topics.size());
+    for (auto const& topic: topics)
+    {
+        if (topic.name.size() == 0u)
+        {
+            setError(make_error_code(Error::EmptyTopic));
+            return false;
+        }
+        if (mosquitto_sub_topic_check(topic.name.c_str()) != MOSQ_ERR_SUCCESS)
+        {
+            setError(make_error_code(Error::MalformedTopicFilter));
+            return false;
+        }
+        filters.push_back(const_cast<char*>(topic.name.c_str()));
+    }
+
+    std::shared_ptr<Acknowledgements> acks;
+    std::function<void(int, uint64_t)> onSent = nullptr;
+    if (onAcknowledged != nullptr)
+    {
+        acks = std::make_shared<Acknowledgements>(std::move(onAcknowledged));
+        onSent = [this, &acks](int const mid, uint64_t const epoch)
+        {
+            acks->remaining.fetch_add(1u);
+            expect(mid, epoch, [acks](int const rc) { acks->acknowledge(rc); });
+        };
+    }
+    std::vector<int> mids;
+    int const rc = sendMultiple(true, filters.data(), filters.size(), int(qos),
+                                0, mids, onSent);
+
+    // Topics of the sent packets are subscribed, sharing the callback.
+    std::shared_ptr<Client::ReceptionCallback const> callback =
+        (onMessageReceived == nullptr) ? nullptr
+        : std::make_shared<Client::ReceptionCallback const>(
+            std::move(onMessageReceived));
+    {
+        std::unique_lock<std::shared_mutex> lock(m_callbacks.mutex);
+        for (size_t i = 0u; i < mids.size(); ++i)
+        {
+            topics[i].id = mids[i];
+            dropFiltered(topics[i].name);
+            m_callbacks.reception.insert(topics[i].name, callback);
+            m_callbacks.subscriptions[topics[i].name] = std::make_pair(int(qos), 0);
+        }
+    }
+
+    if (acks != nullptr)
+    {
+        acks->cancelled = (rc != MOSQ_ERR_SUCCESS);
+        acks->acknowledge(0);
+    }
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+        setError(make_error_code(rc));
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::unsubscribe(std::vector<Topic>& topics)
+{
+    return unsubscribe(topics, nullptr);
+}
+
+//-----------------------------------------------------------------------------
+bool Client::unsubscribe(std::vector<Topic>& topics,
+                         Client::AckCallback onAcknowledged)
+{
+    std::vector<char*> filters;
+    filters.reserve(topics.size());
+    for (auto const& topic: topics)
+    {
+        filters.push_back(const_cast<char*>(topic.name.c_str()));
+    }
+
+    std::shared_ptr<Acknowledgements> acks;
+    std::function<void(int, uint64_t)> onSent = nullptr;
+    if (onAcknowledged != nullptr)
+    {
+        acks = std::make_shared<Acknowledgements>(std::move(onAcknowledged));
+        onSent = [this, &acks](int const mid, uint64_t const epoch)
+        {
+            acks->remaining.fetch_add(1u);
+            expect(mid, epoch, [acks](int const rc) { acks->acknowledge(rc); });
+        };
+    }
+    std::vector<int> mids;
+    int const rc = sendMultiple(false, filters.data(), filters.size(), 0, 0,
+                                mids, onSent);
+    {
+        std::unique_lock<std::shared_mutex> lock(m_callbacks.mutex);
+        for (size_t i = 0u; i < mids.size(); ++i)
+        {
+            topics[i].id = mids[i];
+            m_callbacks.reception.erase(topics[i].name);
+            m_callbacks.subscriptions.erase(topics[i].name);
+            dropFiltered(topics[i].name);
+        }
+    }
+
+    if (acks != nullptr)
+    {
+        acks->cancelled = (rc != MOSQ_ERR_SUCCESS);
+        acks->acknowledge(0);
+    }
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+        setError(make_error_code(rc));
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void Client::resubscribe()
+{
+    // Filters sharing the same QoS and options are sent together.
+    std::map<std::pair<int, int>, std::vector<char*>> groups;
+    std::shared_lock<std::shared_mutex> lock(m_callbacks.mutex);
+    for (auto const& it: m_callbacks.subscriptions)
+    {
+        groups[it.second].push_back(const_cast<char*>(it.first.c_str()));
+    }
+    std::vector<int> mids;
+    for (auto& group: groups)
+    {
+        int rc = sendMultiple(true, group.second.data(), group.second.size(),
+            group.first.first, group.first.second, mids, nullptr);
+        if (rc != MOSQ_ERR_SUCCESS)
+        {
+            m_metrics.failed(rc);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+void Client::jitterReconnectDelay()
+{
+    // The mosquitto lib counts delays in seconds.
+    std::chrono::seconds const delay = std::max(std::chrono::seconds(1),
+                                                m_reconnection.delay);
+    std::chrono::seconds const delay_max = std::max(delay, m_reconnection.delay_max);
+    std::chrono::seconds const first =
+        std::chrono::duration_cast<std::chrono::seconds>(jittered(delay, delay_max));
+    mosquitto_reconnect_delay_set(m_mosquitto, unsigned(first.count()),
+                                  unsigned(delay_max.count()), true);
+}
+
+//-----------------------------------------------------------------------------
+void Client::run()
+{
+    std::chrono::seconds delay = m_reconnection.delay;
+    while (!m_network.stopping.load(std::memory_order_relaxed))
+    {
+        // A null timeout polls the socket.
+        int const timeout = m_network.busy_poll.load(std::memory_order_relaxed)
+                          ? 0 : 1000;
+
+        // A queue of received messages is full (Backpressure::Block): do not
+        // read the socket but keep sending pings and acknowledgements until
+        // the consumers make room.
+        Lane* full = nullptr;
+        for (auto const& lane: m_inbound.lanes)
+        {
+            if ((m_inbound.backpressure == Client::Backpressure::Block) &&
+                (lane->queue.size() >= lane->queue.capacity()))
+            {
+                full = lane.get();
+                break;
+            }
+        }
+        if (full != nullptr)
+        {
+            mosquitto_loop_misc(m_mosquitto);
+            if (mosquitto_want_write(m_mosquitto))
+                mosquitto_loop_write(m_mosquitto, 1);
+            awaitRoom(*full, std::chrono::milliseconds(timeout == 0 ? 0 : 100));
+            continue;
+        }
+
+        int const rc = mosquitto_loop(m_mosquitto, timeout, 1);
+        if (rc == MOSQ_ERR_SUCCESS)
+        {
+            delay = m_reconnection.delay;
+            continue;
+        }
+
+        // Disconnected by disconnect(): wait for the next connect().
+        std::unique_lock<std::mutex> lock(m_network.mutex);
+        if (!m_network.wanted)
+        {
+            m_network.signal.wait(lock, [this]() {
+                return m_network.stopping || m_network.wanted;
+            });
+            continue;
+        }
+
+        // Connection lost: wait before reconnecting, a random delay like
+        // jitterReconnectDelay(), with an exponential backoff for
+        // Reconnection::Managed.
+        auto const wait = jittered(delay, m_reconnection.delay_max);
+        if (m_network.signal.wait_for(lock, wait, [this]() {
+                return m_network.stopping.load();
+            }))
+        {
+            return ;
+        }
+        lock.unlock();
+        if (m_reconnection.mode == Client::Reconnection::Managed)
+        {
+            delay = std::min(2 * delay, std::max(delay, m_reconnection.delay_max));
+        }
+        mosquitto_reconnect(m_mosquitto);
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool Client::tune(std::thread& thread, Connection const& settings)
+{
+#if defined(__linux__)
+    pthread_t const handle = thread.native_handle();
+    if (settings.cpu >= 0)
+    {
+        if (settings.cpu >= CPU_SETSIZE)
+        {
+            setError(make_error_code(Error::InvalidCpu));
+            return false;
+        }
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(settings.cpu, &cpus);
+        int const err = pthread_setaffinity_np(handle, sizeof(cpus), &cpus);
+        if (err != 0)
+        {
+            errno = err;
+            setError(make_error_code(Error::CannotPinThread));
+            return false;
+        }
+    }
+
+    if (settings.scheduling != Client::Scheduling::Default)
+    {
+        sched_param param{};
+        param.sched_priority = settings.priority;
+        int const policy = (settings.scheduling == Client::Scheduling::Fifo)
+                         ? SCHED_FIFO : SCHED_RR;
+        int const err = pthread_setschedparam(handle, policy, &param);
+        if (err != 0)
+        {
+            errno = err;
+            setError(make_error_code(Error::CannotScheduleThread));
+            return false;
+        }
+    }
+    return true;
+#else
+    (void) thread;
+    if ((settings.cpu >= 0) || (settings.scheduling != Client::Scheduling::Default))
+    {
+        setError(make_error_code(Error::TuningNeedsLinux));
+        return false;
+    }
+    return true;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+uint64_t Client::announce()
+{
+    m_pending.expecting.fetch_add(1u);
+    std::lock_guard<std::mutex> lock(m_pending.mutex);
+    ++m_pending.sending;
+    return m_pending.epoch;
+}
+
+//-----------------------------------------------------------------------------
+void Client::withdraw()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_pending.mutex);
+        if (--m_pending.sending == 0u)
+            m_pending.early.clear();
+    }
+    m_pending.expecting.fetch_sub(1u);
+}
+
+//-----------------------------------------------------------------------------
+void Client::expect(int const mid, uint64_t const epoch,
+                    Client::AckCallback&& onAcknowledged)
+{
+    int rc = MOSQ_ERR_SUCCESS;
+    bool early = false;
+    {
+        std::lock_guard<std::mutex> lock(m_pending.mutex);
+        // Only acknowledgements received since the request was announced:
+        // older ones with the same id belong to previous requests.
+        auto it = std::find_if(m_pending.early.begin(), m_pending.early.end(),
+            [mid, epoch](auto const& ack)
+        {
+            return (ack.mid == mid) && (ack.epoch > epoch);
+        });
+        if (it != m_pending.early.end())
+        {
+            rc = it->rc;
+            m_pending.early.erase(it);
+            early = true;
+        }
+        if (--m_pending.sending == 0u)
+        {
+            m_pending.early.clear();
+        }
+    if (!early)
+        {
+            m_pending.acks[mid] = std::move(onAcknowledged);
+            return ;
+        }
+    }
+
+    m_pending.expecting.fetch_sub(1u);
+    onAcknowledged(rc);
+}
+
+//-----------------------------------------------------------------------------
+void Client::acknowledge(int const mid, int const rc)
+{
+    // Fast path when nobody is waiting for an acknowledgement.
+    if (m_pending.expecting.load() == 0u)
+        return ;
+
+    Client::AckCallback callback;
+    {
+        std::lock_guard<std::mutex> lock(m_pending.mutex);
+        auto it = m_pending.acks.find(mid);
+        if (it == m_pending.acks.end())
+        {
+            // The request may be still in the function sending it.
+            if (m_pending.sending != 0u)
+            {
+                m_pending.early.push_back({ mid, rc, ++m_pending.epoch });
+            }
+            return ;
+        }
+        callback = std::move(it->second);
+        m_pending.acks.erase(it);
+    }
+
+    m_pending.expecting.fetch_sub(1u);
+    callback(rc);
+}
+
+//-----------------------------------------------------------------------------
+void Client::acknowledgeAll(int const rc)
+{
+    std::vector<Client::AckCallback> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(m_pending.mutex);
+        for (auto& it: m_pending.acks)
+        {
+            callbacks.push_back(std::move(it.second));
+        }
+        m_pending.acks.clear();
+        if (m_pending.connection != nullptr)
+        {
+            callbacks.push_back(std::move(m_pending.connection));
+            m_pending.connection = nullptr;
+        }
+        m_pending.early.clear();
+    }
+
+    for (auto& callback: callbacks)
+    {
+        m_pending.expecting.fetch_sub(1u);
+        callback(rc);
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool Client::publish(Topic& topic, uint8_t const* payload, size_t const size,
+                     QoS const qos, Client::AckCallback onAcknowledged)
+{
+    return post(topic, payload, size, qos, nullptr, false,
+                std::move(onAcknowledged));
+}
+
+//-----------------------------------------------------------------------------
+bool Client::subscribe(Topic& topic, QoS const qos,
+                       Client::ReceptionCallback onMessageReceived,
+                       Client::AckCallback onAcknowledged)
+{
+    uint64_t const epoch = announce();
+    if (!subscribe(topic, qos, std::move(onMessageReceived)))
+    {
+        withdraw();
+        return false;
+    }
+    expect(topic.id, epoch, std::move(onAcknowledged));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::unsubscribe(Topic& topic, Client::AckCallback onAcknowledged)
+{
+    uint64_t const epoch = announce();
+    if (!unsubscribe(topic))
+    {
+        withdraw();
+        return false;
+    }
+    expect(topic.id, epoch, std::move(onAcknowledged));
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool Client::Acknowledgement::start()
+{
+    // Resume the coroutine. It may happen before start() returns, so members
+    // shall not be accessed after sending the request.
+    Client::AckCallback resume = [this](int rc)
+    {
+        m_rc = rc;
+        m_resume(m_address);
+    };
+
+    bool sent = false;
+    switch (m_request)
+    {
+    case Request::Connect:
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_client.m_pending.mutex);
+                if (m_client.m_pending.connection != nullptr)
+                {
+                    m_rc = MOSQ_ERR_INVAL;
+                    return false;
+                }
+                m_client.m_pending.expecting.fetch_add(1u);
+                m_client.m_pending.connection = std::move(resume);
+            }
+            Client& client = m_client;
+            if (client.connect(m_connection))
+                return true;
+
+            // Failed: withdraw the callback unless it has already been called.
+            Client::AckCallback withdrawn;
+            {
+                std::lock_guard<std::mutex> lock(client.m_pending.mutex);
+                withdrawn.swap(client.m_pending.connection);
+            }
+            if (withdrawn == nullptr)
+                return true;
+            client.m_pending.expecting.fetch_sub(1u);
+        }
+        break;
+    case Request::Subscribe:
+        sent = m_client.subscribe(*m_topic, m_qos, std::move(m_callback),
+                                  std::move(resume));
+        break;
+    case Request::Unsubscribe:
+        sent = m_client.unsubscribe(*m_topic, std::move(resume));
+        break;
+    case Request::Publish:
+        sent = m_client.publish(*m_topic, m_payload, m_size, m_qos,
+                                std::move(resume));
+        break;
+    }
+
+    if (sent)
+        return true;
+
+    m_rc = mosquittoError(m_client.error());
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+Client::Acknowledgement Client::co_connect(Connection const& settings)
+{
+    Acknowledgement ack(*this, Acknowledgement::Request::Connect);
+    ack.m_connection = settings;
+    return ack;
+}
+
+//-----------------------------------------------------------------------------
+Client::Acknowledgement Client::co_subscribe(Topic& topic, QoS const qos,
+    Client::ReceptionCallback onMessageReceived)
+{
+    Acknowledgement ack(*this, Acknowledgement::Request::Subscribe);
+    ack.m_topic = &topic;
+    ack.m_qos = qos;
+    ack.m_callback = std::move(onMessageReceived);
+    return ack;
+}
+
+//-----------------------------------------------------------------------------
+Client::Acknowledgement Client::co_unsubscribe(Topic& topic)
+{
+    Acknowledgement ack(*this, Acknowledgement::Request::Unsubscribe);
+    ack.m_topic = &topic;
+    return ack;
+}
+
+//-----------------------------------------------------------------------------
+Client::Acknowledgement Client::co_publish(Topic& topic, uint8_t const* payload,
+    size_t const size, QoS const qos)
+{
+    Acknowledgement ack(*this, Acknowledgement::Request::Publish);
+    ack.m_topic = &topic;
+    ack.m_payload = payload;
+    ack.m_size = size;
+    ack.m_qos = qos;
+    return ack;
+}
+
+//-----------------------------------------------------------------------------
+void Client::dispatch(Message const& message)
+{
+    // Collect callbacks of subscriptions matching the topic, then call them
+    // without holding the lock so they are allowed to subscribe or unsubscribe.
+    // The thread-local vector keeps its capacity: no allocation once warmed up.
+    // Nested calls (a callback calling poll()) use the end of the vector.
+    thread_local std::vector<std::shared_ptr<Client::ReceptionCallback const>> matched;
+    size_t const first = matched.size();
+    {
+        std::shared_lock<std::shared_mutex> lock(m_callbacks.mutex);
+        m_callbacks.reception.match(message.topic,
+            [](std::shared_ptr<Client::ReceptionCallback const> const& callback)
+        {
+            if (callback != nullptr)
+            {
+                matched.push_back(callback);
+            }
+        });
+    }
+
+    size_t const last = matched.size();
+    auto const start = std::chrono::steady_clock::now();
+    for (size_t i = first; i < last; ++i)
+    {
+        std::shared_ptr<Client::ReceptionCallback const> callback =
+            std::move(matched[i]);
+        (*callback)(message);
+    }
+    matched.resize(first);
+
+    // Subscriptions made without callback are delegated to onMessageReceived().
+    if (last == first)
+    {
+        m_metrics.missed();
+        onMessageReceived(message);
+    }
+    m_metrics.called(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start));
+}
+
+//-----------------------------------------------------------------------------
+bool Client::filter(Message const& message)
+{
+    thread_local std::vector<std::shared_ptr<Filtered>> matched;
+    size_t const first = matched.size();
+    bool unfiltered;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_callbacks.mutex);
+        m_callbacks.filtered.match(message.topic,
+            [](std::shared_ptr<Filtered> const& filtered)
+        {
+            matched.push_back(filtered);
+        });
+        if (matched.size() == first)
+            return true;
+
+        // Also given to dispatch() if subscriptions without policy match.
+        unfiltered = (m_callbacks.reception.match(message.topic,
+            [](std::shared_ptr<Client::ReceptionCallback const> const&) {}) != 0u);
+    }
+
+    size_t const last = matched.size();
+    auto const now = ReceptionFilter::Clock::now();
+    for (size_t i = first; i < last; ++i)
+    {
+        std::shared_ptr<Filtered> filtered = std::move(matched[i]);
+        if (filtered->policy.admit(message.topic, message.data(), message.size(),
+                                   message.qos, message.retain, now)
+            == ReceptionFilter::Verdict::Deliver)
+        {
+            if (m_inbound.lanes.empty())
+                deliver(message, filtered->callback);
+            else
+                enqueue(message, filtered->callback);
+        }
+    }
+    matched.resize(first);
+    return unfiltered;
+}
+
+//-----------------------------------------------------------------------------
+void Client::deliver(Message const& message,
+    std::shared_ptr<Client::ReceptionCallback const> const& callback)
+{
+    auto const start = std::chrono::steady_clock::now();
+    (*callback)(message);
+    m_metrics.called(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start));
+}
+
+//-----------------------------------------------------------------------------
+void Client::flushConflated()
+{
+    thread_local std::vector<std::shared_ptr<Filtered>> conflated;
+    size_t const first = conflated.size();
+    {
+        std::shared_lock<std::shared_mutex> lock(m_callbacks.mutex);
+        conflated.insert(conflated.end(), m_callbacks.conflated.begin(),
+                         m_callbacks.conflated.end());
+    }
+
+    size_t const last = conflated.size();
+    auto const now = ReceptionFilter::Clock::now();
+    for (size_t i = first; i < last; ++i)
+    {
+        std::shared_ptr<Filtered> filtered = std::move(conflated[i]);
+        filtered->policy.flush(now, [this, &filtered](ReceptionFilter::Held const& held)
+        {
+            Message message{};
+            message.topic = const_cast<char*>(held.topic.c_str());
+            message.payload = const_cast<uint8_t*>(held.payload.data());
+            message.payloadlen = int(held.payload.size());
+            message.qos = held.qos;
+            message.retain = held.retain;
+            if (m_inbound.lanes.empty())
+                deliver(message, filtered->callback);
+            else
+                enqueue(message, filtered->callback);
+        });
+    }
+    conflated.resize(first);
+}
+
+//-----------------------------------------------------------------------------
+void Client::conflate()
+{
+    std::unique_lock<std::mutex> lock(m_conflation.mutex);
+    while (!m_conflation.stopping)
+    {
+        m_conflation.signal.wait_for(lock, m_conflation.period, [this]() {
+            return m_conflation.stopping;
+        });
+        if (m_conflation.stopping)
+            return ;
+
+        lock.unlock();
+        flushConflated();
+        lock.lock();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void Client::enqueue(Message const& message,
+    std::shared_ptr<Client::ReceptionCallback const> const& callback)
+{
+    // Select the lane: messages with the same key always go to the same worker
+    // thread so they are processed in order.
+    Lane* lane = m_inbound.lanes[0].get();
+    if (m_inbound.lanes.size() > 1u)
+    {
+        size_t const key = (m_inbound.ordering_key != nullptr)
+            ? m_inbound.ordering_key(message)
+            : size_t(topicHash(message.topic));
+        lane = m_inbound.lanes[key % m_inbound.lanes.size()].get();
+    }
+
+    SharedMessage shared = message.share();
+    if (shared == nullptr)
+    {
+        m_inbound.dropped.fetch_add(1u, std::memory_order_relaxed);
+        return ;
+    }
+
+    Received received{std::move(shared), callback};
+    while (!lane->queue.push(std::move(received)))
+    {
+        if ((m_inbound.backpressure == Client::Backpressure::DropNewest) ||
+            (m_inbound.stopping.load(std::memory_order_relaxed)))
+        {
+            m_inbound.dropped.fetch_add(1u, std::memory_order_relaxed);
+            return ;
+        }
+
+        if (m_inbound.backpressure == Client::Backpressure::DropOldest)
+        {
+            Received oldest;
+            if (lane->queue.pop(oldest))
+            {
+                m_inbound.dropped.fetch_add(1u, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            awaitRoom(*lane, std::chrono::milliseconds(100));
+        }
+    }
+
+    // Only pay the mutex when a consumer is sleeping. The fence pairs with the
+    // one in consume() so that either the consumer sees the message or we see
+    // the sleeping consumer.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (lane->sleeping.load(std::memory_order_relaxed) != 0u)
+    {
+        std::lock_guard<std::mutex> lock(lane->mutex);
+        lane->signal.notify_one();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void Client::consume(Lane& lane)
+{
+    Received received;
+    while (!m_inbound.stopping.load(std::memory_order_relaxed))
+    {
+        if (lane.queue.pop(received))
+        {
+            if (received.callback != nullptr)
+                deliver(*received.message, received.callback);
+            else
+                dispatch(*received.message);
+            received = Received();
+
+            // Wake up the network thread waiting for room. The fence pairs
+            // with the one in awaitRoom().
+            if (m_inbound.backpressure == Client::Backpressure::Block)
+            {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (lane.blocked.load(std::memory_order_relaxed) != 0u)
+                {
+                    std::lock_guard<std::mutex> lock(lane.mutex);
+                    lane.room.notify_all();
+                }
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(lane.mutex);
+        lane.sleeping.fetch_add(1u, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        lane.signal.wait(lock, [this, &lane]()
+        {
+            return m_inbound.stopping.load(std::memory_order_relaxed) ||
+                   !lane.queue.empty();
+        });
+        lane.sleeping.fetch_sub(1u, std::memory_order_relaxed);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void Client::awaitRoom(Lane& lane, std::chrono::milliseconds const timeout)
+{
+    std::unique_lock<std::mutex> lock(lane.mutex);
+    lane.blocked.fetch_add(1u, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    lane.room.wait_for(lock, timeout, [this, &lane]()
+    {
+        return m_inbound.stopping.load(std::memory_order_relaxed) ||
+               (lane.queue.size() < lane.queue.capacity());
+    });
+    lane.blocked.fetch_sub(1u, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+void Client::stopConsumers()
+{
+    m_inbound.stopping = true;
+    for (auto& lane: m_inbound.lanes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(lane->mutex);
+        }
+        lane->signal.notify_all();
+        lane->room.notify_all();
+        for (auto& thread: lane->threads)
+        {
+            thread.join();
+        }
+        lane->threads.clear();
+    }
+}
+
+//-----------------------------------------------------------------------------
+Metrics::Snapshot Client::metrics() const
+{
+    Metrics::Snapshot snapshot = m_metrics.snapshot();
+    for (auto const& lane: m_inbound.lanes)
+    {
+        snapshot.queue_depth += lane->queue.size();
+    }
+    snapshot.inflight = m_inflight.size();
+    return snapshot;
+}
+
+//-----------------------------------------------------------------------------
+size_t Client::poll(size_t const max)
+{
+    size_t count = 0u;
+    Received received;
+    for (auto& lane: m_inbound.lanes)
+    {
+        while ((count < max) && (lane->queue.pop(received)))
+        {
+            if (received.callback != nullptr)
+                deliver(*received.message, received.callback);
+            else
+                dispatch(*received.message);
+            received = Received();
+            ++count;
+        }
+    }
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+void Client::on_message_received_wrapper(
+    struct mosquitto*, void *userdata, const struct mosquitto_message *msg,
+    mosquitto_property const* properties)
+{
+    Client* client = static_cast<Client*>(userdata);
+    assert((client != nullptr) && "NULL pointer passed as param");
+    client->m_metrics.received(msg->qos, size_t(msg->payloadlen));
+    if (CaptureLog* log = client->m_capture.load(std::memory_order_acquire))
+    {
+        uint64_t const timestamp = uint64_t(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+        log->append(timestamp, msg->topic,
+                    static_cast<uint8_t const*>(msg->payload),
+                    size_t(msg->payloadlen), msg->qos, msg->retain);
+    }
+
+    // Give the decompressed payload in place of the compressed one.
+    Message decompressed;
+    uint8_t const* payload;
+    size_t size;
+    if (client->m_compressor.decompress(properties,
+                                        static_cast<uint8_t const*>(msg->payload),
+                                        size_t(msg->payloadlen), payload, size))
+    {
+        static_cast<mosquitto_message&>(decompressed) = *msg;
+        decompressed.payload = const_cast<uint8_t*>(payload);
+        decompressed.payloadlen = int(size);
+        msg = &decompressed;
+    }
+    client->receive(*reinterpret_cast<const Message*>(msg));
+}
+
+//-----------------------------------------------------------------------------
+void Client::receive(Message const& message)
+{
+    if (m_cache.capacity() != 0u)
+    {
+        m_cache.store(message.topic, message.data(), message.size());
+    }
+
+    // Delivery policies are applied before queuing.
+    if ((m_callbacks.filters.load(std::memory_order_relaxed) != 0u) &&
+        (!filter(message)))
     {
-        client->onMessageReceived(message);
+        return ;
     }
+
+    if (!m_inbound.lanes.empty())
+    {
+        enqueue(message);
+    }
+    else
+    {
+        dispatch(message);
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool Client::loopback(Topic const& topic, uint8_t const* payload,
+                      size_t const size, QoS const qos)
+{
+    // Invalid names are left to the broker path, which reports them.
+    if (topic.name.find_first_of("+#") != std::string::npos)
+        return false;
+
+    {
+        auto const any = [](auto const&) {};
+        std::shared_lock<std::shared_mutex> lock(m_callbacks.mutex);
+        if ((m_callbacks.reception.match(topic.name, any) == 0u) &&
+            (m_callbacks.filtered.match(topic.name, any) == 0u))
+        {
+            return false;
+        }
+    }
+
+    Message message{};
+    message.topic = const_cast<char*>(topic.name.c_str());
+    message.payload = const_cast<uint8_t*>(payload);
+    message.payloadlen = int(size);
+    message.qos = int(qos);
+    message.retain = topic.retain;
+    receive(message);
+    return true;
 }
 
-} // namespace mqtt
\ No newline at end of file
+} // namespace mqtt
@@ -0,0 +1,168 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/Metrics.hpp"
+#include <mosquitto.h>
+#include <sstream>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+Metrics::Snapshot Metrics::snapshot() const
+{
+    auto load = [](Counter const& counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    };
+
+    Metrics::Snapshot snap;
+    uint64_t connections = 0u;
+    uint64_t callback_time = 0u;
+    for (auto const& s: m_shards)
+    {
+        for (size_t qos = 0u; qos < 3u; ++qos)
+        {
+            snap.messages_in[qos] += load(s.messages_in[qos]);
+            snap.bytes_in[qos] += load(s.bytes_in[qos]);
+            snap.messages_out[qos] += load(s.messages_out[qos]);
+            snap.bytes_out[qos] += load(s.bytes_out[qos]);
+        }
+        snap.dispatch_misses += load(s.dispatch_misses);
+        snap.callbacks += load(s.callbacks);
+        callback_time += load(s.callback_time);
+        connections += load(s.connections);
+        for (size_t code = 0u; code < ERROR_CODES; ++code)
+        {
+            snap.publish_failures[code] += load(s.publish_failures[code]);
+        }
+        snap.rate_limited += load(s.rate_limited);
+    }
+    snap.callback_time = std::chrono::nanoseconds(callback_time);
+    snap.reconnects = (connections > 0u) ? connections - 1u : 0u;
+    return snap;
+}
+
+//-----------------------------------------------------------------------------
+std::string Metrics::Snapshot::prometheus(std::string const& prefix,
+                                          std::string const& labels) const
+{
+    std::ostringstream out;
+
+    // Print a metric with the common labels followed by its own labels.
+    auto metric = [&](char const* name, std::string const& own, auto const value)
+    {
+        out << prefix << '_' << name;
+        if (!labels.empty() || !own.empty())
+        {
+            out << '{' << labels;
+            if (!labels.empty() && !own.empty())
+                out << ',';
+            out << own << '}';
+        }
+        out << ' ' << value << '\n';
+    };
+    auto type = [&](char const* name, char const* kind)
+    {
+        out << "# TYPE " << prefix << '_' << name << ' ' << kind << '\n';
+    };
+    auto perQoS = [&](char const* name, std::array<uint64_t, 3> const& values)
+    {
+        type(name, "counter");
+        for (size_t qos = 0u; qos < 3u; ++qos)
+        {
+            metric(name, "qos=\"" + std::to_string(qos) + "\"", values[qos]);
+        }
+    };
+
+    perQoS("messages_received_total", messages_in);
+    perQoS("received_bytes_total", bytes_in);
+    perQoS("messages_published_total", messages_out);
+    perQoS("published_bytes_total", bytes_out);
+    type("dispatch_misses_total", "counter");
+    metric("dispatch_misses_total", "", dispatch_misses);
+    type("callbacks_total", "counter");
+    metric("callbacks_total", "", callbacks);
+    type("callback_seconds_total", "counter");
+    metric("callback_seconds_total", "",
+           std::chrono::duration<double>(callback_time).count());
+    type("reconnects_total", "counter");
+    metric("reconnects_total", "", reconnects);
+    type("publish_failures_total", "counter");
+    for (size_t code = 0u; code < ERROR_CODES; ++code)
+    {
+        if (publish_failures[code] == 0u)
+            continue;
+        metric("publish_failures_total", "code=\"" + std::to_string(code) +
+               "\",error=\"" + mosquitto_strerror(int(code)) + "\"",
+               publish_failures[code]);
+    }
+    type("publish_rate_limited_total", "counter");
+    metric("publish_rate_limited_total", "", rate_limited);
+    type("queue_depth", "gauge");
+    metric("queue_depth", "", queue_depth);
+    type("inflight_messages", "gauge");
+    metric("inflight_messages", "", inflight);
+    return out.str();
+}
+
+//-----------------------------------------------------------------------------
+std::string Metrics::Snapshot::statsd(std::string const& prefix) const
+{
+    std::ostringstream out;
+
+    auto metric = [&](std::string const& name, auto const value)
+    {
+        out << prefix << '.' << name << ':' << value << "|g\n";
+    };
+
+    for (size_t qos = 0u; qos < 3u; ++qos)
+    {
+        std::string const suffix = ".qos" + std::to_string(qos);
+        metric("messages_received" + suffix, messages_in[qos]);
+        metric("received_bytes" + suffix, bytes_in[qos]);
+        metric("messages_published" + suffix, messages_out[qos]);
+        metric("published_bytes" + suffix, bytes_out[qos]);
+    }
+    metric("dispatch_misses", dispatch_misses);
+    metric("callbacks", callbacks);
+    metric("callback_ms", std::chrono::duration<double, std::milli>(
+        callback_time).count());
+    metric("reconnects", reconnects);
+    for (size_t code = 0u; code < ERROR_CODES; ++code)
+    {
+        if (publish_failures[code] != 0u)
+        {
+            metric("publish_failures.code" + std::to_string(code),
+                   publish_failures[code]);
+        }
+    }
+    metric("publish_rate_limited", rate_limited);
+    metric("queue_depth", queue_depth);
+    metric("inflight_messages", inflight);
+    return out.str();
+}
+
+} // namespace mqtt
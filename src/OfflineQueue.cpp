@@ -0,0 +1,404 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/OfflineQueue.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mqtt {
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x5154514Du; // "MQTQ"
+constexpr uint32_t VERSION = 1u;
+//! \brief Offset of the first record, after the segment header.
+constexpr uint32_t DATA = 64u;
+
+//-----------------------------------------------------------------------------
+//! \brief Header of records, followed by the topic name and the payload.
+//! Records are aligned on 8 bytes.
+//-----------------------------------------------------------------------------
+struct RecordHeader
+{
+    //! \brief FNV-1a of the next fields, the topic name and the payload.
+    uint32_t checksum;
+    uint32_t size;
+    uint16_t topic;
+    uint8_t qos;
+    uint8_t retain;
+};
+
+constexpr size_t align(size_t const n)
+{
+    return (n + 7u) & ~size_t(7u);
+}
+
+//-----------------------------------------------------------------------------
+uint32_t fnv1a(uint32_t hash, void const* data, size_t const size)
+{
+    uint8_t const* bytes = static_cast<uint8_t const*>(data);
+    for (size_t i = 0u; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+//-----------------------------------------------------------------------------
+uint32_t checksum(RecordHeader const& header, uint8_t const* data)
+{
+    uint32_t hash = fnv1a(2166136261u, &header.size,
+                          sizeof(RecordHeader) - sizeof(header.checksum));
+    return fnv1a(hash, data, size_t(header.topic) + size_t(header.size));
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+OfflineQueue::OfflineQueue(std::string directory, size_t const segment_size,
+                           size_t const capacity)
+    : m_directory(std::move(directory)),
+      // Offsets are stored on 32 bits.
+      m_segment_size(std::min<size_t>(std::max<size_t>(segment_size, 4096u),
+                                      size_t(1u) << 31)),
+      m_max_segments(std::max<size_t>(2u, capacity / m_segment_size))
+{}
+
+//-----------------------------------------------------------------------------
+OfflineQueue::~OfflineQueue()
+{
+    for (auto& segment: m_segments)
+    {
+        unmap(segment, false);
+    }
+}
+
+//-----------------------------------------------------------------------------
+std::string OfflineQueue::path(uint64_t const sequence) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.seg",
+                  static_cast<unsigned long long>(sequence));
+    return m_directory + name;
+}
+
+//-----------------------------------------------------------------------------
+bool OfflineQueue::map(Segment& segment, bool const create)
+{
+    std::string const file = path(segment.sequence);
+    int const fd = ::open(file.c_str(), create ? (O_RDWR | O_CREAT | O_EXCL)
+                                               : O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+
+    struct stat status;
+    if (create)
+    {
+        segment.size = m_segment_size;
+        if (::ftruncate(fd, off_t(segment.size)) != 0)
+        {
+            int const error = errno;
+            ::close(fd);
+            ::unlink(file.c_str());
+            errno = error;
+            return false;
+        }
+    }
+    else if (::fstat(fd, &status) == 0)
+    {
+        // Segments written with other settings are kept as they are.
+        segment.size = size_t(status.st_size);
+    }
+
+    void* address = MAP_FAILED;
+    if ((segment.size >= DATA) && (segment.size <= (size_t(1u) << 31)))
+    {
+        address = ::mmap(nullptr, segment.size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    }
+    else
+    {
+        errno = EINVAL;
+    }
+    int const error = errno;
+    ::close(fd);
+    if (address == MAP_FAILED)
+    {
+        if (create)
+            ::unlink(file.c_str());
+        errno = error;
+        return false;
+    }
+
+    segment.base = static_cast<uint8_t*>(address);
+    segment.header = reinterpret_cast<Header*>(segment.base);
+    Header& header = *segment.header;
+    if (create)
+    {
+        header.magic = MAGIC;
+        header.version = VERSION;
+        header.head = header.tail = DATA;
+        header.written = header.sent = 0u;
+    }
+    else if ((header.magic != MAGIC) || (header.version != VERSION) ||
+             (header.head < DATA) || (header.head > header.tail) ||
+             (header.tail > segment.size) || (header.sent > header.written))
+    {
+        unmap(segment, false);
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+void OfflineQueue::unmap(Segment& segment, bool const remove)
+{
+    if (segment.base != nullptr)
+    {
+        ::munmap(segment.base, segment.size);
+        segment.base = nullptr;
+        segment.header = nullptr;
+    }
+    if (remove)
+    {
+        ::unlink(path(segment.sequence).c_str());
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool OfflineQueue::open()
+{
+    DIR* directory = ::opendir(m_directory.c_str());
+    if (directory == nullptr)
+        return false;
+
+    std::vector<uint64_t> sequences;
+    while (struct dirent* entry = ::readdir(directory))
+    {
+        char* end = nullptr;
+        unsigned long long const sequence = std::strtoull(entry->d_name, &end, 16);
+        if ((end == entry->d_name + 16) && (std::strcmp(end, ".seg") == 0))
+        {
+            sequences.push_back(uint64_t(sequence));
+        }
+    }
+    ::closedir(directory);
+    std::sort(sequences.begin(), sequences.end());
+
+    for (auto const sequence: sequences)
+    {
+        Segment segment;
+        segment.sequence = sequence;
+        if (!map(segment, false))
+        {
+            // Not a segment of ours, or damaged: do not append after it.
+            continue;
+        }
+        m_size += segment.header->written - segment.header->sent;
+        m_segments.push_back(segment);
+    }
+
+    // Sent segments, but the one being written.
+    while ((m_segments.size() > 1u) &&
+           (m_segments.front().header->head == m_segments.front().header->tail))
+    {
+        Header const& header = *m_segments.front().header;
+        m_size -= header.written - header.sent;
+        unmap(m_segments.front(), true);
+        m_segments.pop_front();
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool OfflineQueue::roll()
+{
+    if (!m_segments.empty())
+    {
+        Segment& last = m_segments.back();
+        ::msync(last.base, last.size, MS_ASYNC);
+    }
+
+    // Full: drop the oldest messages.
+    if (m_segments.size() >= m_max_segments)
+    {
+        Header const& header = *m_segments.front().header;
+        size_t const lost = header.written - header.sent;
+        m_dropped += lost;
+        m_size -= lost;
+        unmap(m_segments.front(), true);
+        m_segments.pop_front();
+    }
+
+    Segment segment;
+    segment.sequence = m_segments.empty() ? 0u : m_segments.back().sequence + 1u;
+    if (!map(segment, true))
+        return false;
+    m_segments.push_back(segment);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool OfflineQueue::push(std::string_view const topic, uint8_t const* payload,
+                        size_t const size, int const qos, bool const retain)
+{
+    size_t const length = align(sizeof(RecordHeader) + topic.size() + size);
+    if ((topic.size() > 0xFFFFu) || (length > m_segment_size - DATA))
+    {
+        errno = EMSGSIZE;
+        return false;
+    }
+
+    if (m_segments.empty() ||
+        (m_segments.back().header->tail + length > m_segments.back().size))
+    {
+        if (!roll())
+            return false;
+    }
+
+    Segment& segment = m_segments.back();
+    Header& header = *segment.header;
+    uint8_t* record = segment.base + header.tail;
+    uint8_t* data = record + sizeof(RecordHeader);
+    RecordHeader entry;
+    entry.size = uint32_t(size);
+    entry.topic = uint16_t(topic.size());
+    entry.qos = uint8_t(qos);
+    entry.retain = retain ? 1u : 0u;
+    std::memcpy(data, topic.data(), topic.size());
+    if (size != 0u)
+    {
+        std::memcpy(data + topic.size(), payload, size);
+    }
+    entry.checksum = checksum(entry, data);
+    std::memcpy(record, &entry, sizeof(entry));
+
+    // Publish the record once written. The counter is incremented first: a
+    // crash in between leaves it counting a record not yet published, which
+    // front() fixes, rather than losing a published one. The fences keep the
+    // compiler from reordering the stores to the mapped file.
+    std::atomic_signal_fence(std::memory_order_release);
+    header.written += 1u;
+    std::atomic_signal_fence(std::memory_order_release);
+    header.tail += uint32_t(length);
+    ++m_size;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool OfflineQueue::front(Record& record)
+{
+    while (m_size != 0u)
+    {
+        Segment& segment = m_segments.front();
+        Header& header = *segment.header;
+        if (header.head == header.tail)
+        {
+            // Sent, or a header not updated before a crash.
+            m_size -= header.written - header.sent;
+            header.sent = header.written;
+            if (m_segments.size() > 1u)
+            {
+                unmap(segment, true);
+                m_segments.pop_front();
+            }
+            continue;
+        }
+
+        RecordHeader entry;
+        uint8_t const* data = segment.base + header.head + sizeof(RecordHeader);
+        bool valid = (header.head + sizeof(RecordHeader) <= header.tail);
+        if (valid)
+        {
+            std::memcpy(&entry, segment.base + header.head, sizeof(entry));
+            valid = (header.head + align(sizeof(RecordHeader) + entry.topic +
+                                         entry.size) <= header.tail) &&
+                    (entry.checksum == checksum(entry, data));
+        }
+        if (!valid)
+        {
+            // Next records cannot be found: drop the end of the segment.
+            size_t const lost = header.written - header.sent;
+            m_dropped += lost;
+            m_size -= lost;
+            header.sent = header.written;
+            header.head = header.tail;
+            continue;
+        }
+
+        record.topic = std::string_view(reinterpret_cast<char const*>(data),
+                                        entry.topic);
+        record.payload = data + entry.topic;
+        record.size = entry.size;
+        record.qos = entry.qos;
+        record.retain = (entry.retain != 0u);
+        return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+void OfflineQueue::pop()
+{
+    Record record;
+    if (!front(record))
+        return;
+
+    Segment& segment = m_segments.front();
+    Header& header = *segment.header;
+    header.head += uint32_t(align(sizeof(RecordHeader) + record.topic.size() +
+                                  record.size));
+    header.sent += 1u;
+    --m_size;
+
+    if (header.head == header.tail)
+    {
+        if (m_segments.size() > 1u)
+        {
+            unmap(segment, true);
+            m_segments.pop_front();
+        }
+        else
+        {
+            // Reuse the segment being written.
+            header.head = header.tail = DATA;
+            header.written = header.sent = 0u;
+        }
+    }
+}
+
+} // namespace mqtt
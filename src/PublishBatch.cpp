@@ -0,0 +1,100 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/PublishBatch.hpp"
+#include <cstddef>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+PublishBatch::PublishBatch(size_t const capacity, size_t const slab_size)
+    : m_slab_size(slab_size)
+{
+    m_entries.reserve(capacity);
+}
+
+//-----------------------------------------------------------------------------
+uint8_t* PublishBatch::allocate(size_t const size)
+{
+    // Round up to keep payloads aligned.
+    size_t const aligned = (size + alignof(std::max_align_t) - 1u) &
+                           ~(alignof(std::max_align_t) - 1u);
+    if (aligned > m_slab_size)
+    {
+        m_large.emplace_back(new uint8_t[size]);
+        return m_large.back().get();
+    }
+
+    if ((m_slab < m_slabs.size()) && (m_offset + aligned > m_slab_size))
+    {
+        ++m_slab;
+        m_offset = 0u;
+    }
+    if (m_slab == m_slabs.size())
+    {
+        m_slabs.emplace_back(new uint8_t[m_slab_size]);
+        m_offset = 0u;
+    }
+
+    uint8_t* p = m_slabs[m_slab].get() + m_offset;
+    m_offset += aligned;
+    return p;
+}
+
+//-----------------------------------------------------------------------------
+void PublishBatch::add(Topic& topic, uint8_t const* payload, size_t const size,
+                       QoS const qos)
+{
+    uint8_t* copy = nullptr;
+    if ((payload != nullptr) && (size != 0u))
+    {
+        copy = allocate(size);
+        std::memcpy(copy, payload, size);
+    }
+    m_entries.push_back({&topic, copy, size, qos});
+}
+
+//-----------------------------------------------------------------------------
+void PublishBatch::clear()
+{
+    m_entries.clear();
+    m_large.clear();
+    m_slab = 0u;
+    m_offset = 0u;
+}
+
+//-----------------------------------------------------------------------------
+void PublishBatch::drop(size_t const n)
+{
+    if (n >= m_entries.size())
+    {
+        clear();
+        return ;
+    }
+    m_entries.erase(m_entries.begin(), m_entries.begin() + long(n));
+}
+
+} // namespace mqtt
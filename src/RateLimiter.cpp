@@ -0,0 +1,154 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/RateLimiter.hpp"
+#include <algorithm>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+TokenBucket::TokenBucket(double const rate, Clock::duration const burst)
+    : m_cost((rate > 0.0) ? 1e9 / rate : 0.0),
+      m_burst(burst)
+{}
+
+//-----------------------------------------------------------------------------
+TokenBucket::Clock::duration TokenBucket::delay(Clock::time_point const now) const
+{
+    // The burst is the time of tokens available while the bucket is full.
+    if (m_full - now <= m_burst)
+        return Clock::duration::zero();
+    return m_full - now - m_burst;
+}
+
+//-----------------------------------------------------------------------------
+void TokenBucket::take(double const tokens, Clock::time_point const now)
+{
+    if (m_cost == 0.0)
+        return ;
+
+    m_full = std::max(m_full, now) + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::nano>(m_cost * tokens));
+}
+
+//-----------------------------------------------------------------------------
+RateLimiter::Buckets::Buckets(RateLimit const& limit)
+    : enabled(limit.enabled()),
+      messages(limit.messages, limit.burst),
+      bytes(limit.bytes, limit.burst)
+{}
+
+//-----------------------------------------------------------------------------
+RateLimiter::Clock::duration
+RateLimiter::Buckets::delay(Clock::time_point const now) const
+{
+    if (!enabled)
+        return Clock::duration::zero();
+    return std::max(messages.delay(now), bytes.delay(now));
+}
+
+//-----------------------------------------------------------------------------
+void RateLimiter::Buckets::take(size_t const size, Clock::time_point const now)
+{
+    if (!enabled)
+        return ;
+    messages.take(1.0, now);
+    bytes.take(double(size), now);
+}
+
+//-----------------------------------------------------------------------------
+RateLimiter::RateLimiter(RateLimit const& limit,
+                         std::vector<PublishRule> const& rules,
+                         size_t const lanes)
+    : m_client(limit)
+{
+    size_t const last = std::max<size_t>(1u, lanes) - 1u;
+    m_rules.reserve(rules.size());
+    for (auto const& rule: rules)
+    {
+        m_rules.push_back(Rule{rule.prefix, std::min(rule.lane, last),
+                               Buckets(rule.limit)});
+    }
+    std::stable_sort(m_rules.begin(), m_rules.end(),
+                     [](Rule const& a, Rule const& b)
+    {
+        return a.prefix.size() > b.prefix.size();
+    });
+}
+
+//-----------------------------------------------------------------------------
+size_t RateLimiter::find(std::string_view const topic) const
+{
+    for (size_t i = 0u; i < m_rules.size(); ++i)
+    {
+        if (topic.compare(0u, m_rules[i].prefix.size(), m_rules[i].prefix) == 0)
+            return i;
+    }
+    return NONE;
+}
+
+//-----------------------------------------------------------------------------
+size_t RateLimiter::lane(std::string_view const topic) const
+{
+    size_t const rule = find(topic);
+    return (rule == NONE) ? 0u : m_rules[rule].lane;
+}
+
+//-----------------------------------------------------------------------------
+RateLimiter::Clock::duration
+RateLimiter::delay(std::string_view const topic, Clock::time_point const now) const
+{
+    size_t const rule = find(topic);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Clock::duration const delay = m_client.delay(now);
+    return (rule == NONE) ? delay
+                          : std::max(delay, m_rules[rule].buckets.delay(now));
+}
+
+//-----------------------------------------------------------------------------
+RateLimiter::Clock::duration
+RateLimiter::acquire(std::string_view const topic, size_t const size,
+                     Clock::time_point const now)
+{
+    size_t const rule = find(topic);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Clock::duration delay = m_client.delay(now);
+    if (rule != NONE)
+    {
+        delay = std::max(delay, m_rules[rule].buckets.delay(now));
+    }
+    if (delay != Clock::duration::zero())
+        return delay;
+
+    m_client.take(size, now);
+    if (rule != NONE)
+    {
+        m_rules[rule].buckets.take(size, now);
+    }
+    return delay;
+}
+
+} // namespace mqtt
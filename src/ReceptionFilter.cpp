@@ -0,0 +1,109 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/ReceptionFilter.hpp"
+#include "MQTT/TopicTree.hpp"
+#include <utility>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+ReceptionFilter::ReceptionFilter(ReceptionPolicy const& policy)
+    : m_policy(policy)
+{}
+
+//-----------------------------------------------------------------------------
+ReceptionFilter::Verdict ReceptionFilter::admit(std::string_view const topic,
+    uint8_t const* payload, size_t const size, int const qos, bool const retain,
+    Clock::time_point const now)
+{
+    uint64_t const hash = m_policy.deduplicate
+        ? topicHash(std::string_view(reinterpret_cast<char const*>(payload), size))
+        : 0u;
+
+    uint64_t const key = topicHash(topic);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    State& state = m_topics[key];
+    if (m_policy.deduplicate && state.seen && (state.hash == hash))
+        return Verdict::Drop;
+
+    if (m_policy.conflation.count() > 0)
+    {
+        // Replace the held message, reusing its buffers.
+        state.held.topic.assign(topic.data(), topic.size());
+        state.held.payload.assign(payload, payload + size);
+        state.held.qos = qos;
+        state.held.retain = retain;
+        if (!state.pending)
+        {
+            state.pending = true;
+            m_pending.push_back(key);
+        }
+        state.hash = hash;
+        state.seen = true;
+        return Verdict::Held;
+    }
+
+    if ((m_policy.interval.count() > 0) && state.seen &&
+        (now - state.last < m_policy.interval))
+    {
+        return Verdict::Drop;
+    }
+
+    state.last = now;
+    state.hash = hash;
+    state.seen = true;
+    return Verdict::Deliver;
+}
+
+//-----------------------------------------------------------------------------
+size_t ReceptionFilter::collect(Clock::time_point const now)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (now < m_next)
+        return 0u;
+    m_next = now + m_policy.conflation;
+
+    if (m_ready.size() < m_pending.size())
+    {
+        m_ready.resize(m_pending.size());
+    }
+    size_t count = 0u;
+    for (uint64_t const key: m_pending)
+    {
+        State& state = m_topics[key];
+        Held& ready = m_ready[count++];
+        std::swap(ready.topic, state.held.topic);
+        std::swap(ready.payload, state.held.payload);
+        ready.qos = state.held.qos;
+        ready.retain = state.held.retain;
+        state.pending = false;
+    }
+    m_pending.clear();
+    return count;
+}
+
+} // namespace mqtt
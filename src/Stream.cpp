@@ -0,0 +1,279 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/Stream.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace mqtt {
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x5354514Du; // "MQTS"
+constexpr uint16_t VERSION = 1u;
+
+//-----------------------------------------------------------------------------
+//! \brief Return a new stream identifier.
+//-----------------------------------------------------------------------------
+uint64_t newStreamId()
+{
+    thread_local std::mt19937_64 random(std::random_device{}() ^ uint64_t(
+        std::chrono::steady_clock::now().time_since_epoch().count()));
+    uint64_t id;
+    do
+    {
+        id = random();
+    } while (id == 0u);
+    return id;
+}
+
+//-----------------------------------------------------------------------------
+template<class T>
+void storeLittleEndian(uint8_t* data, T value)
+{
+    for (size_t i = 0u; i < sizeof(T); ++i, value = T(value >> 8u))
+    {
+        data[i] = uint8_t(value);
+    }
+}
+
+//-----------------------------------------------------------------------------
+template<class T>
+T loadLittleEndian(uint8_t const* data)
+{
+    T value = 0u;
+    for (size_t i = sizeof(T); i-- > 0u; )
+    {
+        value = T(value << 8u) | T(data[i]);
+    }
+    return value;
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+StreamSource::StreamSource(uint64_t const size, Reader reader,
+                           StreamSettings const& settings)
+    : m_reader(std::move(reader)), m_size(size),
+      m_chunk_size(std::max<size_t>(1u, settings.chunk_size)),
+      m_window(std::max<size_t>(1u, settings.window)),
+      m_id(newStreamId()),
+      m_count(std::max<uint64_t>(1u, (size + m_chunk_size - 1u) / m_chunk_size))
+{}
+
+//-----------------------------------------------------------------------------
+StreamSource::StreamSource(int const fd, uint64_t const size,
+                           StreamSettings const& settings)
+    : StreamSource(size, [fd](uint8_t* buffer, size_t size)
+      {
+          while (size > 0u)
+          {
+              ssize_t const n = ::read(fd, buffer, size);
+              if (n < 0)
+              {
+                  if (errno == EINTR)
+                      continue;
+                  return false;
+              }
+              if (n == 0)
+              {
+                  errno = ENODATA;
+                  return false;
+              }
+              buffer += n;
+              size -= size_t(n);
+          }
+          return true;
+      }, settings)
+{}
+
+//-----------------------------------------------------------------------------
+StreamSource::StreamSource(uint8_t const* data, size_t const size,
+                           StreamSettings const& settings)
+    : StreamSource(size, [data](uint8_t* buffer, size_t size) mutable
+      {
+          std::memcpy(buffer, data, size);
+          data += size;
+          return true;
+      }, settings)
+{}
+
+//-----------------------------------------------------------------------------
+size_t StreamSource::fill(uint64_t const index)
+{
+    uint64_t const offset = index * m_chunk_size;
+    size_t const bytes = size_t(std::min<uint64_t>(m_chunk_size, m_size - offset));
+    m_buffer.resize(HEADER_SIZE + bytes);
+    uint8_t* header = m_buffer.data();
+    storeLittleEndian<uint32_t>(header, MAGIC);
+    storeLittleEndian<uint16_t>(header + 4u, VERSION);
+    storeLittleEndian<uint16_t>(header + 6u, 0u);
+    storeLittleEndian<uint64_t>(header + 8u, m_id);
+    storeLittleEndian<uint64_t>(header + 16u, m_size);
+    storeLittleEndian<uint64_t>(header + 24u, offset);
+    storeLittleEndian<uint32_t>(header + 32u, uint32_t(index));
+    storeLittleEndian<uint32_t>(header + 36u, uint32_t(m_count));
+    if ((bytes != 0u) && (!m_reader(header + HEADER_SIZE, bytes)))
+        return 0u;
+    return HEADER_SIZE + bytes;
+}
+
+//-----------------------------------------------------------------------------
+StreamReceiver::StreamReceiver(uint8_t* buffer, size_t const capacity,
+                               Callback callback)
+    : m_buffer(buffer), m_capacity(capacity), m_callback(std::move(callback))
+{}
+
+//-----------------------------------------------------------------------------
+StreamReceiver::StreamReceiver(std::string const& path, Callback callback)
+    : m_path(path), m_callback(std::move(callback))
+{}
+
+//-----------------------------------------------------------------------------
+StreamReceiver::~StreamReceiver()
+{
+    if (m_map != nullptr)
+        ::munmap(m_map, size_t(m_size));
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+//-----------------------------------------------------------------------------
+bool StreamReceiver::feed(Message const& message)
+{
+    uint8_t const* data = message.data();
+    size_t const size = message.size();
+    if ((size < StreamSource::HEADER_SIZE) ||
+        (loadLittleEndian<uint32_t>(data) != MAGIC) ||
+        (loadLittleEndian<uint16_t>(data + 4u) != VERSION))
+    {
+        return false;
+    }
+
+    uint64_t const id = loadLittleEndian<uint64_t>(data + 8u);
+    uint64_t const total = loadLittleEndian<uint64_t>(data + 16u);
+    uint64_t const offset = loadLittleEndian<uint64_t>(data + 24u);
+    uint64_t const index = loadLittleEndian<uint32_t>(data + 32u);
+    uint64_t const count = loadLittleEndian<uint32_t>(data + 36u);
+    size_t const bytes = size - StreamSource::HEADER_SIZE;
+    if ((index >= count) || (offset > total) || (bytes > total - offset))
+        return false;
+
+    // The last stream is kept once completed, so chunks sent again are
+    // recognized.
+    if ((!m_active) || (id != m_id))
+    {
+        if (m_active && (!m_failed) && (m_received != m_count))
+        {
+            close(MOSQ_ERR_PROTOCOL);
+        }
+        m_id = id;
+        m_size = total;
+        m_count = count;
+        m_received = 0u;
+        m_active = true;
+        m_chunks.assign(size_t((count + 63u) / 64u), 0u);
+        int const rc = open(total);
+        m_failed = (rc != MOSQ_ERR_SUCCESS);
+        if (m_failed)
+        {
+            close(rc);
+            return true;
+        }
+    }
+    else if (m_failed)
+    {
+        return true;
+    }
+    else if ((total != m_size) || (count != m_count))
+    {
+        return false;
+    }
+
+    uint64_t& word = m_chunks[size_t(index / 64u)];
+    uint64_t const bit = uint64_t(1u) << (index % 64u);
+    if ((word & bit) != 0u)
+        return true; // Sent again.
+
+    word |= bit;
+    std::memcpy(((m_map != nullptr) ? m_map : m_buffer) + offset,
+                data + StreamSource::HEADER_SIZE, bytes);
+    if (++m_received == m_count)
+    {
+        close(MOSQ_ERR_SUCCESS);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+int StreamReceiver::open(uint64_t const size)
+{
+    if (m_path.empty())
+        return (size <= m_capacity) ? MOSQ_ERR_SUCCESS : MOSQ_ERR_PAYLOAD_SIZE;
+
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+        return MOSQ_ERR_ERRNO;
+    if (::ftruncate(m_fd, off_t(size)) != 0)
+        return MOSQ_ERR_ERRNO;
+    if (size == 0u)
+        return MOSQ_ERR_SUCCESS;
+
+    void* map = ::mmap(nullptr, size_t(size), PROT_READ | PROT_WRITE, MAP_SHARED,
+                       m_fd, 0);
+    if (map == MAP_FAILED)
+        return MOSQ_ERR_ERRNO;
+    m_map = static_cast<uint8_t*>(map);
+    return MOSQ_ERR_SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+void StreamReceiver::close(int const rc)
+{
+    uint8_t const* data = (m_map != nullptr) ? m_map : m_buffer;
+    if (m_callback != nullptr)
+    {
+        m_callback(m_id, (rc == MOSQ_ERR_SUCCESS) ? data : nullptr, m_size, rc);
+    }
+    if (m_map != nullptr)
+    {
+        ::munmap(m_map, size_t(m_size));
+        m_map = nullptr;
+    }
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+} // namespace mqtt
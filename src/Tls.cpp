@@ -0,0 +1,319 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/Tls.hpp"
+#include <cstring>
+
+#ifdef MQTT_WITH_OPENSSL
+#  include <openssl/ssl.h>
+#  include <openssl/x509v3.h>
+#endif
+
+namespace mqtt {
+
+#ifdef MQTT_WITH_OPENSSL
+
+namespace {
+
+//-----------------------------------------------------------------------------
+//! \brief Decode a key given in hexadecimal.
+//! \return false if the key is not hexadecimal.
+//-----------------------------------------------------------------------------
+bool unhex(std::string const& hex, std::string& key)
+{
+    if ((hex.size() % 2u) != 0u)
+        return false;
+
+    key.clear();
+    key.reserve(hex.size() / 2u);
+    for (size_t i = 0u; i < hex.size(); i += 2u)
+    {
+        int const high = OPENSSL_hexchar2int(static_cast<unsigned char>(hex[i]));
+        int const low = OPENSSL_hexchar2int(static_cast<unsigned char>(hex[i + 1u]));
+        if ((high < 0) || (low < 0))
+            return false;
+        key.push_back(char((high << 4) | low));
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Version of the protocol named like in the mosquitto lib.
+//! \return 0 for the default, -1 for an unknown name.
+//-----------------------------------------------------------------------------
+int protocolVersion(std::string const& version)
+{
+    if (version.empty())
+        return 0;
+    if (version == "tlsv1.3")
+        return TLS1_3_VERSION;
+    if (version == "tlsv1.2")
+        return TLS1_2_VERSION;
+    if (version == "tlsv1.1")
+        return TLS1_1_VERSION;
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+//! \brief Name of the broker, given by the mosquitto lib for SNI.
+//-----------------------------------------------------------------------------
+std::string brokerOf(SSL const* ssl)
+{
+    char const* name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    return (name == nullptr) ? std::string() : std::string(name);
+}
+
+} // anonymous namespace
+
+// *************************************************************************
+//! \brief Callbacks of OpenSSL, finding the TlsContext by the SSL_CTX of the
+//! connection.
+// *************************************************************************
+struct TlsContext::Callbacks
+{
+    static TlsContext* contextOf(SSL const* ssl)
+    {
+        return static_cast<TlsContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Before the ClientHello of the first handshake: give the kept
+    //! session and the name the certificate of the broker shall match.
+    //-------------------------------------------------------------------------
+    static void info(SSL const* ssl, int const where, int const /*ret*/)
+    {
+        TlsContext* context = contextOf(ssl);
+        if (context == nullptr)
+            return;
+
+        SSL* connection = const_cast<SSL*>(ssl);
+        if ((where & SSL_CB_HANDSHAKE_START) && SSL_in_before(connection))
+        {
+            std::string const broker = brokerOf(ssl);
+            if ((!context->m_insecure) && (!broker.empty()))
+            {
+                // Addresses are written in the certificates apart from names.
+                X509_VERIFY_PARAM* param = SSL_get0_param(connection);
+                if (X509_VERIFY_PARAM_set1_ip_asc(param, broker.c_str()) != 1)
+                    SSL_set1_host(connection, broker.c_str());
+            }
+            if (context->m_resumption)
+            {
+                std::lock_guard<std::mutex> lock(context->m_mutex);
+                auto it = context->m_sessions.find(broker);
+                if (it != context->m_sessions.end())
+                    SSL_set_session(connection, static_cast<SSL_SESSION*>(it->second));
+            }
+        }
+        else if (where & SSL_CB_HANDSHAKE_DONE)
+        {
+            ++context->m_handshakes;
+            if (SSL_session_reused(connection))
+                ++context->m_resumed;
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief New session given by the broker: replaces the kept one.
+    //! \return 1 since the context keeps the reference on the session.
+    //-------------------------------------------------------------------------
+    static int session(SSL* ssl, SSL_SESSION* session)
+    {
+        TlsContext* context = contextOf(ssl);
+        if ((context == nullptr) || (SSL_SESSION_is_resumable(session) != 1))
+            return 0;
+
+        std::lock_guard<std::mutex> lock(context->m_mutex);
+        void*& kept = context->m_sessions[brokerOf(ssl)];
+        if (kept != nullptr)
+            SSL_SESSION_free(static_cast<SSL_SESSION*>(kept));
+        kept = session;
+        return 1;
+    }
+
+    //-------------------------------------------------------------------------
+    //! \brief Give the pre-shared key and its identity.
+    //! \return the size of the key, 0 if it does not fit.
+    //-------------------------------------------------------------------------
+    static unsigned int psk(SSL* ssl, char const* /*hint*/, char* identity,
+                            unsigned int const max_identity, unsigned char* key,
+                            unsigned int const max_key)
+    {
+        TlsContext* context = contextOf(ssl);
+        if ((context == nullptr) || (context->m_identity.size() >= max_identity) ||
+            (context->m_psk.size() > max_key))
+            return 0u;
+
+        std::memcpy(identity, context->m_identity.c_str(), context->m_identity.size() + 1u);
+        std::memcpy(key, context->m_psk.data(), context->m_psk.size());
+        return static_cast<unsigned int>(context->m_psk.size());
+    }
+};
+
+//-----------------------------------------------------------------------------
+TlsContext::TlsContext(Tls const& tls)
+    : m_insecure(tls.insecure), m_resumption(tls.resumption),
+      m_identity(tls.identity)
+{
+    int const version = protocolVersion(tls.version);
+    if ((version < 0) || ((!tls.psk.empty()) && (!unhex(tls.psk, m_psk))))
+        return;
+
+    SSL_CTX* context = SSL_CTX_new(TLS_client_method());
+    if (context == nullptr)
+        return;
+
+    bool const certificates = (!tls.cafile.empty()) || (!tls.capath.empty()) ||
+                              tls.os_certificates;
+    bool ok = (version == 0) || (SSL_CTX_set_min_proto_version(context, version) == 1);
+    if (ok && (!tls.ciphers.empty()))
+    {
+        ok = (SSL_CTX_set_cipher_list(context, tls.ciphers.c_str()) == 1);
+    }
+    if (ok && ((!tls.cafile.empty()) || (!tls.capath.empty())))
+    {
+        ok = (SSL_CTX_load_verify_locations(
+            context, tls.cafile.empty() ? nullptr : tls.cafile.c_str(),
+            tls.capath.empty() ? nullptr : tls.capath.c_str()) == 1);
+    }
+    if (ok && tls.os_certificates)
+    {
+        ok = (SSL_CTX_set_default_verify_paths(context) == 1);
+    }
+    if (ok && (!tls.certfile.empty()))
+    {
+        ok = (SSL_CTX_use_certificate_chain_file(context, tls.certfile.c_str()) == 1);
+    }
+    if (ok && (!tls.keyfile.empty()))
+    {
+        ok = (SSL_CTX_use_PrivateKey_file(context, tls.keyfile.c_str(),
+                                          SSL_FILETYPE_PEM) == 1) &&
+             (SSL_CTX_check_private_key(context) == 1);
+    }
+    if (!ok)
+    {
+        SSL_CTX_free(context);
+        return;
+    }
+
+    // Like the mosquitto lib: the broker is only authenticated by a
+    // certificate when certificate authorities are given.
+    SSL_CTX_set_verify(context, certificates ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, nullptr);
+    SSL_CTX_set_app_data(context, this);
+    SSL_CTX_set_info_callback(context, &Callbacks::info);
+    if (m_resumption)
+    {
+        // Sessions are kept by the context, not by the cache of OpenSSL which
+        // does not resume them for clients.
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT |
+                                       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(context, &Callbacks::session);
+    }
+    if (!m_psk.empty())
+    {
+        SSL_CTX_set_psk_client_callback(context, &Callbacks::psk);
+    }
+#ifdef SSL_OP_ENABLE_KTLS
+    if (tls.kernel_offload)
+    {
+        SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS);
+        m_kernel_offload = true;
+    }
+#endif
+    m_context = context;
+}
+
+//-----------------------------------------------------------------------------
+TlsContext::~TlsContext()
+{
+    forget();
+    if (m_context != nullptr)
+    {
+        // The mosquitto lib may still hold a reference on the SSL_CTX.
+        SSL_CTX* context = static_cast<SSL_CTX*>(m_context);
+        SSL_CTX_set_app_data(context, nullptr);
+        SSL_CTX_free(context);
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool TlsContext::supported()
+{
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+bool TlsContext::offloaded(void* ssl)
+{
+#ifdef BIO_get_ktls_send
+    return (ssl != nullptr) &&
+           BIO_get_ktls_send(SSL_get_wbio(static_cast<SSL*>(ssl)));
+#else
+    (void) ssl;
+    return false;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+void TlsContext::forget()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& it: m_sessions)
+    {
+        SSL_SESSION_free(static_cast<SSL_SESSION*>(it.second));
+    }
+    m_sessions.clear();
+}
+
+#else // !MQTT_WITH_OPENSSL
+
+//-----------------------------------------------------------------------------
+TlsContext::TlsContext(Tls const& tls)
+    : m_insecure(tls.insecure), m_resumption(tls.resumption)
+{}
+
+//-----------------------------------------------------------------------------
+TlsContext::~TlsContext() = default;
+
+//-----------------------------------------------------------------------------
+bool TlsContext::supported()
+{
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+bool TlsContext::offloaded(void* /*ssl*/)
+{
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+void TlsContext::forget()
+{}
+
+#endif // MQTT_WITH_OPENSSL
+
+} // namespace mqtt
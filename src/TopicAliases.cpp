@@ -0,0 +1,174 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/TopicAliases.hpp"
+#include <algorithm>
+
+namespace mqtt {
+
+//-----------------------------------------------------------------------------
+std::atomic<uint64_t> TopicAliases::s_stamps{0u};
+
+//-----------------------------------------------------------------------------
+TopicAliases::~TopicAliases()
+{
+    reset(0u);
+}
+
+//-----------------------------------------------------------------------------
+void TopicAliases::reset(size_t const capacity)
+{
+    for (auto& entry: m_entries)
+    {
+        mosquitto_property_free_all(&entry.properties);
+    }
+    m_index.clear();
+    m_entries.clear();
+    // Alias 0 is not allowed and NONE is reserved.
+    m_capacity = std::min<size_t>(capacity, NONE - 1u);
+    m_entries.reserve(m_capacity);
+    m_head = m_tail = NONE;
+}
+
+//-----------------------------------------------------------------------------
+void TopicAliases::unlink(uint16_t const i)
+{
+    Entry& entry = m_entries[i];
+    if (entry.previous != NONE)
+        m_entries[entry.previous].next = entry.next;
+    else
+        m_head = entry.next;
+    if (entry.next != NONE)
+        m_entries[entry.next].previous = entry.previous;
+    else
+        m_tail = entry.previous;
+    entry.previous = entry.next = NONE;
+}
+
+//-----------------------------------------------------------------------------
+void TopicAliases::pushFront(uint16_t const i)
+{
+    Entry& entry = m_entries[i];
+    entry.previous = NONE;
+    entry.next = m_head;
+    if (m_head != NONE)
+        m_entries[m_head].previous = i;
+    m_head = i;
+    if (m_tail == NONE)
+        m_tail = i;
+}
+
+//-----------------------------------------------------------------------------
+uint16_t TopicAliases::alias(std::string_view const topic, bool& known,
+                             Binding* binding)
+{
+    uint16_t i = NONE;
+    if ((binding != nullptr) && (binding->owner == this) &&
+        (binding->alias != 0u) && (binding->alias <= m_entries.size()) &&
+        (m_entries[binding->alias - 1u].stamp == binding->stamp))
+    {
+        i = uint16_t(binding->alias - 1u);
+    }
+    else
+    {
+        auto it = m_index.find(topic);
+        if (it != m_index.end())
+            i = it->second;
+    }
+
+    if (i != NONE)
+    {
+        if (i != m_head)
+        {
+            unlink(i);
+            pushFront(i);
+        }
+        known = true;
+        if (binding != nullptr)
+        {
+            *binding = { this, uint16_t(i + 1u), m_entries[i].stamp };
+        }
+        return uint16_t(i + 1u);
+    }
+
+    known = false;
+    if (m_entries.size() < m_capacity)
+    {
+        i = uint16_t(m_entries.size());
+        m_entries.emplace_back();
+        if (mosquitto_property_add_int16(&m_entries[i].properties,
+                MQTT_PROP_TOPIC_ALIAS, uint16_t(i + 1u)) != MOSQ_ERR_SUCCESS)
+        {
+            m_entries.pop_back();
+            return 0u;
+        }
+    }
+    else if (m_tail != NONE)
+    {
+        // Give the alias of the least recently used topic.
+        i = m_tail;
+        unlink(i);
+        m_index.erase(m_entries[i].topic);
+    }
+    else
+    {
+        return 0u;
+    }
+
+    m_entries[i].topic.assign(topic.data(), topic.size());
+    m_entries[i].stamp = s_stamps.fetch_add(1u, std::memory_order_relaxed) + 1u;
+    m_index.emplace(m_entries[i].topic, i);
+    pushFront(i);
+    if (binding != nullptr)
+    {
+        *binding = { this, uint16_t(i + 1u), m_entries[i].stamp };
+    }
+    return uint16_t(i + 1u);
+}
+
+//-----------------------------------------------------------------------------
+void TopicAliases::forget(std::string_view const topic)
+{
+    auto it = m_index.find(topic);
+    if (it == m_index.end())
+        return ;
+
+    // Keep the alias number for the next topic: move it to the back.
+    uint16_t const i = it->second;
+    m_index.erase(it);
+    m_entries[i].topic.clear();
+    m_entries[i].stamp = 0u;
+    unlink(i);
+    Entry& entry = m_entries[i];
+    entry.previous = m_tail;
+    if (m_tail != NONE)
+        m_entries[m_tail].next = i;
+    m_tail = i;
+    if (m_head == NONE)
+        m_head = i;
+}
+
+} // namespace mqtt
@@ -0,0 +1,249 @@
+//*****************************************************************************
+// A C++ class wrapping Mosquitto MQTT https://github.com/eclipse/mosquitto
+//
+// MIT License
+//
+// Copyright (c) 2024 Quentin Quadrat <lecrapouille@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "MQTT/TopicCache.hpp"
+#include "MQTT/TopicTree.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace mqtt {
+
+namespace {
+
+//! \brief Bytes of the smallest blocks.
+constexpr size_t MIN_BLOCK = 64u;
+//! \brief Bytes of the slabs holding the blocks of a size class.
+constexpr size_t SLAB = 64u * 1024u;
+
+//-----------------------------------------------------------------------------
+//! \brief Return the size class of the payload: blocks of MIN_BLOCK << class
+//! bytes.
+//-----------------------------------------------------------------------------
+size_t sizeClass(size_t const size)
+{
+    size_t cls = 0u;
+    while ((MIN_BLOCK << cls) < size)
+    {
+        ++cls;
+    }
+    return cls;
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+TopicCache::TopicCache(size_t const capacity, size_t const max_payload)
+    : m_capacity(std::min<size_t>(capacity, 0xFFFFFFFEu)),
+      m_max_payload(max_payload)
+{
+    if (m_capacity == 0u)
+        return ;
+
+    size_t slots = 1u;
+    while (slots < 2u * m_capacity)
+    {
+        slots <<= 1u;
+    }
+    m_mask = slots - 1u;
+    m_entries.reset(new Entry[m_capacity]);
+    m_slots.reset(new std::atomic<uint32_t>[slots]);
+    for (size_t i = 0u; i < slots; ++i)
+    {
+        m_slots[i].store(0u, std::memory_order_relaxed);
+    }
+    m_classes.resize(sizeClass(m_max_payload) + 1u);
+}
+
+//-----------------------------------------------------------------------------
+TopicCache::Entry const* TopicCache::find(std::string_view const topic,
+                                          uint64_t const hash) const
+{
+    for (size_t i = size_t(hash) & m_mask; ; i = (i + 1u) & m_mask)
+    {
+        uint32_t const index = m_slots[i].load(std::memory_order_acquire);
+        if (index == 0u)
+            return nullptr;
+
+        Entry const& entry = m_entries[index - 1u];
+        if ((entry.hash == hash) && (entry.topic == topic))
+            return &entry;
+    }
+}
+
+//-----------------------------------------------------------------------------
+TopicCache::Entry* TopicCache::insert(std::string_view const topic,
+                                      uint64_t const hash)
+{
+    size_t const index = m_size.load(std::memory_order_relaxed);
+    if (index == m_capacity)
+        return nullptr;
+
+    // Readers see the topic once the slot is published.
+    Entry& entry = m_entries[index];
+    entry.topic.assign(topic.data(), topic.size());
+    entry.hash = hash;
+    size_t i = size_t(hash) & m_mask;
+    while (m_slots[i].load(std::memory_order_relaxed) != 0u)
+    {
+        i = (i + 1u) & m_mask;
+    }
+    m_slots[i].store(uint32_t(index + 1u), std::memory_order_release);
+    m_size.store(index + 1u, std::memory_order_release);
+    return &entry;
+}
+
+//-----------------------------------------------------------------------------
+TopicCache::Word* TopicCache::allocate(size_t const cls)
+{
+    SizeClass& sc = m_classes[cls];
+    if (sc.free.empty())
+    {
+        // A header word followed by the payload words.
+        size_t const bytes = MIN_BLOCK << cls;
+        size_t const words = 1u + bytes / sizeof(uint64_t);
+        size_t const blocks = std::max<size_t>(1u, SLAB / bytes);
+        sc.slabs.emplace_back(new Word[words * blocks]);
+        Word* slab = sc.slabs.back().get();
+        for (size_t i = blocks; i-- > 0u; )
+        {
+            Word* block = slab + i * words;
+            block[0].store(bytes, std::memory_order_relaxed);
+            sc.free.push_back(block);
+        }
+    }
+
+    Word* block = sc.free.back();
+    sc.free.pop_back();
+    return block;
+}
+
+//-----------------------------------------------------------------------------
+void TopicCache::release(Word* block)
+{
+    size_t const bytes = size_t(block[0].load(std::memory_order_relaxed));
+    m_classes[sizeClass(bytes)].free.push_back(block);
+}
+
+//-----------------------------------------------------------------------------
+bool TopicCache::store(std::string_view const topic, uint8_t const* payload,
+                       size_t const size)
+{
+    if ((m_capacity == 0u) || (size > m_max_payload))
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_writer);
+    uint64_t const hash = topicHash(topic);
+    Entry* entry = const_cast<Entry*>(find(topic, hash));
+    if ((entry == nullptr) && ((entry = insert(topic, hash)) == nullptr))
+        return false;
+
+    uint32_t const sequence = entry->sequence.load(std::memory_order_relaxed);
+    entry->sequence.store(sequence + 1u, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // Change of size class: the old block may still be read by a reader that
+    // will see the new sequence and try again.
+    size_t const cls = sizeClass(size);
+    Word* block = entry->block.load(std::memory_order_relaxed);
+    if ((block == nullptr) ||
+        (size_t(block[0].load(std::memory_order_relaxed)) != (MIN_BLOCK << cls)))
+    {
+        if (block != nullptr)
+            release(block);
+        block = allocate(cls);
+        // Release: a reader seeing the new block also sees its size word.
+        entry->block.store(block, std::memory_order_release);
+    }
+
+    for (size_t offset = 0u, i = 1u; offset < size; offset += sizeof(uint64_t), ++i)
+    {
+        uint64_t word = 0u;
+        std::memcpy(&word, payload + offset, std::min(sizeof(word), size - offset));
+        block[i].store(word, std::memory_order_relaxed);
+    }
+    entry->size.store(uint32_t(size), std::memory_order_relaxed);
+    entry->sequence.store(sequence + 2u, std::memory_order_release);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+template<class Buffer>
+bool TopicCache::read(std::string_view const topic, Buffer& payload) const
+{
+    if (m_capacity == 0u)
+        return false;
+
+    Entry const* entry = find(topic, topicHash(topic));
+    if (entry == nullptr)
+        return false;
+
+    while (true)
+    {
+        uint32_t const before = entry->sequence.load(std::memory_order_acquire);
+        if ((before & 1u) != 0u)
+            continue;
+
+        Word const* block = entry->block.load(std::memory_order_acquire);
+        size_t size = entry->size.load(std::memory_order_relaxed);
+        if (block != nullptr)
+        {
+            // A block being replaced may be smaller than the new size.
+            size = std::min(size, size_t(block[0].load(std::memory_order_relaxed)));
+            payload.resize(size);
+            uint8_t* data = reinterpret_cast<uint8_t*>(payload.data());
+            for (size_t offset = 0u, i = 1u; offset < size;
+                 offset += sizeof(uint64_t), ++i)
+            {
+                uint64_t const word = block[i].load(std::memory_order_relaxed);
+                std::memcpy(data + offset, &word,
+                            std::min(sizeof(word), size - offset));
+            }
+        }
+        else
+        {
+            payload.clear();
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry->sequence.load(std::memory_order_relaxed) == before)
+            return true;
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool TopicCache::get(std::string_view const topic,
+                     std::vector<uint8_t>& payload) const
+{
+    return read(topic, payload);
+}
+
+//-----------------------------------------------------------------------------
+bool TopicCache::get(std::string_view const topic, std::string& payload) const
+{
+    return read(topic, payload);
+}
+
+} // namespace mqtt